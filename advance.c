@@ -1,6 +1,26 @@
 /*
 
   焼きなまし法 + 2-opt法
+  pt を指定すると、温度の違うレプリカをスレッドごとに走らせる並列焼き戻し法になる
+  split を指定すると、都市を数千都市ずつの領域に分けてスレッドごとに焼きなましで解き、つなぎ合わせる
+  (都市数が非常に多いとき用。replicas の位置の数はスレッド数になる)
+
+  最後の引数で初期解の作り方 (random|nn|greedy|sfc|christofides) を選べる。既定は greedy
+  近傍 (2opt,oropt,3opt のカンマ区切り) も最後の方の引数で選べる。既定は 2opt だけ
+
+  -c を指定すると、sa では途中経過 (チェックポイント) を -i 秒 (既定 60) ごとにそのファイルへ書き出す。
+  起動時にファイルがあればそこから再開し、止めずに走らせた場合と同じ結果になる。最後まで終わると消す
+
+  -C を指定すると、解いた巡回路をそのファイル (結果のキャッシュ) に入れておき、同じ都市・同じ設定で
+  もう一度呼ばれたときは解かずにそれを返す。-W も付けると、キャッシュの巡回路から焼きなましを始めて改善を試みる
+
+  終わりに Held-Karp の下界 (1-木 + 劣勾配法) と、それに対する差 gap = (巡回路 - 下界) / 下界 を表示する
+  (キャッシュの巡回路をそのまま返すときは計算しない)。
+  -g を指定すると、gap がその値 (0.01 なら 1%) 以下の巡回路が見つかった時点で止める (sa と pt)
+  sa は、何回も同じ長さの最良解にたどり着くようになったら、信頼度 -p (既定 0.99) でそれ以上回しても
+  良くならないと判断して残りの回をやめる (-p 0 でやめない)。-t の制限時間 (秒) は sa では1回ごと、pt では交換ごとに見る
+
+  使い方: advance [-c checkpoint] [-i seconds] [-C cache [-W]] [-g gap] [-p confidence] [-t seconds] <city file> [sa|pt|split] [replicas] [init] [moves]
 
 */
 
@@ -12,15 +32,27 @@
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h> // open()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+#include <sys/file.h> // flock()
 
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
+// 乱数、都市ファイル、距離テーブル、候補リスト、初期解、下界、打ち切り判定、巡回路の表現と焼きなましは共通のヘッダにある
+#include "tsp_rng.h"
+#define STOP_MIN_RESTARTS 4  // これより少ない回数では確率での判定をしない (sa は既定で10回しか回さない)
+#include "tsp_city.h"
+#include "tsp_dist.h"
+#include "tsp_init.h"
+#include "tsp_bound.h"
+#include "tsp_stop.h"
+#include "tsp_tour.h"
+#include "tsp_sa.h"
 
 // 描画用
+// 都市の座標が地図 (70x40) に収まらないときは縮小して描く
+#define PLOT_LABEL_MAX 1000 // これより都市が多いときは番号を描かない
 typedef struct
 {
   int width;
@@ -33,27 +65,103 @@ typedef struct {
   double dist;
 } Answer;
 
-// 整数最大値をとる関数
-int max(const int a, const int b)
-{
-  return (a > b) ? a : b;
-}
+// チェックポイント (焼きなまし法の途中経過)
+// CkptHeader の後に、今の巡回路と前の初期解までの最良解が int32 で n 個ずつ並ぶ
+// 打ち切り判定の状態 (回数と最良の長さ) も入れておき、再開しても途中で止めたときと同じ回で止まるようにする
+// (経過時間だけは入れない。-t の制限時間は再開してから測る)
+// 巡回路は都市 0 から回さずに Tour の中の順のまま保存する (再開後の tour_flip が同じ側を反転するように)
+// checksum は巡回路部分の FNV-1a (64bit)
+#define CKPT_MAGIC 0x4b435354u // "TSCK"
+#define CKPT_VERSION 2
+#define CKPT_INTERVAL 60       // 既定の保存間隔 (秒)
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int32_t n, init, moves;
+  int32_t restart;    // solve() の何番目の初期解か
+  int32_t T, t0, t;   // 反復回数、開始位置、次に行う反復
+  int32_t stop_restarts; // 以下の4つは StopRule の restarts, since, hits, best
+  double co;
+  double best;        // 前の初期解までの最良の長さ (まだなければ 1e15)
+  int32_t stop_since, stop_hits;
+  double stop_best;
+  uint64_t rng[4];
+  uint64_t city_hash; // 都市の座標の FNV-1a。別の問題のチェックポイントから再開しないように
+  uint64_t checksum;
+} CkptHeader;
+
+// 結果のキャッシュ (都市の座標と解き方ごとに、これまでで一番短い巡回路を持つ)
+// CacheHeader の後にスロットの表 (開番地法) があり、その後ろに巡回路 (int32 で n 個) を追記していく
+// スロットは都市の座標の FNV-1a と解き方 (sa/pt, 初期解, 近傍) のハッシュの組で探す。n == 0 なら空き
+// 引くときは mmap して表をたどるだけ。入れるときは flock で排他してから追記し、スロットを書き換える
+// (前の巡回路の場所は使い回さない)。スロットが 3/4 埋まったら倍の大きさで作り直す
+#define CACHE_MAGIC 0x4b505354u // "TSPK"
+#define CACHE_VERSION 1
+#ifndef CACHE_SLOTS
+#define CACHE_SLOTS 1024        // 新しく作るときのスロット数 (2のべき)
+#endif
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t used;
+  uint64_t end;       // ファイルの使っている長さ (次に巡回路を書く位置)
+} CacheHeader;
+
+typedef struct {
+  uint64_t city_hash;
+  uint64_t param_hash;
+  uint64_t offset;    // 巡回路の位置
+  uint32_t n;
+  uint32_t reserved;
+  double length;
+} CacheSlot;
+
+// 書き出しは別スレッドで行う。焼きなましのループは状態をスナップショットにコピーして知らせるだけで、
+// 前の書き出しが終わっていなければその回は保存しない (待たない)
+typedef struct {
+  const char *path;
+  int interval;
+  time_t last;        // 前に保存した時刻
+  int restart;        // 以下の4つは solve() が設定する
+  double best;
+  const int *best_route;
+  const StopRule *rule;
+  CkptHeader hdr;     // スナップショット
+  int *cur, *best_buf;
+  int pending;        // スナップショットを書き出し中
+  int stop;
+  pthread_t th;
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+} Checkpointer;
 
 // プロトタイプ宣言
 // draw_line: 町の間を線で結ぶ
 // draw_route: routeでの巡回順を元に移動経路を線で結ぶ
 // plot_cities: 描画する
-// distance: 2地点間の距離を計算
 // solve(): TSPをといて距離を返す/ 引数route に巡回順を格納
 
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
-double solve(const City *city, int n, int *route);
+City *fit_to_map(Map map, City *city, int n);
+double solve(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int init, int moves,
+             const int *warm, StopRule *stop, Checkpointer *ck, const CkptHeader *resume, const int *resume_route,
+             const int *resume_best);
+double solve_pt(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nrep, int init, int moves,
+                const int *warm, StopRule *rule);
+double solve_split(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nthreads, int init,
+                   int moves, const int *warm);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
+int parse_moves(const char *s);
+int ckpt_load(const char *path, const City *city, int n, CkptHeader *h, int *cur, int *best);
+void ckpt_start(Checkpointer *ck, const char *path, int interval, const City *city, int n, int init, int moves);
+void ckpt_finish(Checkpointer *ck);
+uint64_t cache_param_hash(int mode, int init, int moves);
+int cache_lookup(const char *path, uint64_t city_hash, uint64_t param_hash, int n, int *route, double *length);
+void cache_store(const char *path, uint64_t city_hash, uint64_t param_hash, int n, const int *route, double length);
 
 Map init_map(const int width, const int height)
 {
@@ -69,63 +177,171 @@ void free_map_dot(Map m)
   free(m.dot);
 }
 
-City *load_cities(const char *filename, int *n)
-{
-  City *city;
-  FILE *fp;
-  if ((fp=fopen(filename,"rb")) == NULL){
-    fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
-  }
-  fread(n,sizeof(int),1,fp);
-  city = (City*)malloc(sizeof(City) * *n);
-  for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
-    //printf("(x, y) = (%d, %d)\n", city[i].x, city[i].y);
-  }
-  fclose(fp);
-  return city;
-}
 int main(int argc, char**argv)
 {
   // const による定数定義
   const int width = 70;
   const int height = 40;
-  const int max_cities = 100;
 
   Map map = init_map(width, height);
   
   FILE *fp = stdout; // とりあえず描画先は標準出力としておく
-  if (argc != 2){
-    fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
+  // チェックポイントのファイルと保存間隔
+  const char *ckpt_path = NULL;
+  int ckpt_interval = CKPT_INTERVAL;
+  // 結果のキャッシュと、キャッシュの巡回路から改善を試みるかどうか
+  const char *cache_path = NULL;
+  int warm_start = 0;
+  // 下界との差がこれ以下になったら止める (負なら止めない)
+  double target_gap = -1;
+  // 打ち切りの信頼度 (0 なら決まった回数だけ回す) と制限時間 (秒)
+  double confidence = STOP_CONFIDENCE, deadline = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:i:C:Wg:p:t:")) != -1) {
+    if (opt == 'c') ckpt_path = optarg;
+    else if (opt == 'i') ckpt_interval = atoi(optarg);
+    else if (opt == 'C') cache_path = optarg;
+    else if (opt == 'W') warm_start = 1;
+    else if (opt == 'g') target_gap = atof(optarg);
+    else if (opt == 'p') confidence = atof(optarg);
+    else if (opt == 't') deadline = atof(optarg);
+    else argc = 0; // 使い方を表示して終わる
+  }
+  if (argc > 0) {
+    argv[optind - 1] = argv[0];
+    argv += optind - 1;
+    argc -= optind - 1;
+  }
+  if (argc < 2 || argc > 6){
+    fprintf(stderr, "Usage: %s [-c checkpoint] [-i seconds] [-C cache [-W]] [-g gap] [-p confidence] [-t seconds] <city file> [sa|pt|split] [replicas] [random|nn|greedy|sfc|christofides] [2opt,oropt,3opt]\n", argv[0]);
     exit(1);
   }
-  int n;
-  City *city = load_cities(argv[1],&n);
-  assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
-
-  // 町の初期配置を表示
-  plot_cities(fp, map, city, n, NULL);
-  sleep(1);
+  // 最後の方の引数が初期解の作り方や近傍の名前なら取り出す
+  int init = INIT_GREEDY;
+  int moves = 1 << SA_MOVE_2OPT;
+  while (argc >= 3) {
+    if (parse_init(argv[argc-1]) >= 0) init = parse_init(argv[--argc]);
+    else if (parse_moves(argv[argc-1]) > 0) moves = parse_moves(argv[--argc]);
+    else break;
+  }
+  // 解法の選択 (sa: 焼きなまし法を初期解を変えて繰り返す, pt: 並列焼き戻し法, split: 領域に分けて並列に解く)
+  const int use_pt = (argc >= 3 && strcmp(argv[2], "pt") == 0);
+  const int use_split = (argc >= 3 && strcmp(argv[2], "split") == 0);
+  if (argc >= 3 && !use_pt && !use_split && strcmp(argv[2], "sa") != 0){
+    fprintf(stderr, "%s: unknown mode.\n", argv[2]);
+    exit(1);
+  }
+  if ((use_pt || use_split) && ckpt_path != NULL){
+    fprintf(stderr, "checkpoint is only supported in sa mode.\n");
+    exit(1);
+  }
+  // レプリカはコアごとに1つ。ただしコア数が少なくても温度の段数は確保する (split ではスレッド数。既定はコア数)
+  const int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int nrep = (argc == 4) ? atoi(argv[3]) : use_split ? ncpu : max(4, ncpu);
+  if (nrep < 1) nrep = 1;
+  CityFile cf = load_cities(argv[1]);
+  const int n = cf.n;
+  City *city = cf.city;
+  assert( n > 1 );
 
   // 訪れる順序を記録する配列を設定
   int *route = (int*)calloc(n, sizeof(int));
   // 訪れた町を記録するフラグ
   //int *visited = (int*)calloc(n, sizeof(int));
 
-  const double d = solve(city,n,route);
+  // キャッシュにあれば、-W がなければそれを答えにする (距離表なども作らない)
+  const uint64_t city_hash = city_checksum(city, sizeof(City) * n);
+  const uint64_t param_hash = cache_param_hash(use_pt + 2 * use_split, init, moves);
+  double cached = 0;
+  const int hit = (cache_path != NULL) && cache_lookup(cache_path, city_hash, param_hash, n, route, &cached);
+  const int solving = !hit || warm_start;
+  if (hit) fprintf(stderr, "%s: cached tour (%f)%s\n", cache_path, cached, solving ? ", improving it" : "");
+
+  // 距離は先にまとめて計算しておく (split では領域ごとに作るので、全体の表は作らない)
+  DistTable dt = init_dist_table(city, n, (solving && !use_split) ? choose_dist_mode(n) : DIST_NONE);
+  // 都市数が多ければ候補リストも作る
+  Cand cand = {.k = 0, .nb = NULL};
+  if (solving && (n >= CAND_MIN_CITIES || use_pt || use_split || (moves != (1 << SA_MOVE_2OPT) && n >= 8)))
+    cand = build_candidates(city, n, CAND_K);
+
+  // Held-Karp の下界。歩幅の目安にはキャッシュの巡回路か貪欲法の巡回路の長さを使う
+  // キャッシュの巡回路をそのまま返すときは計算しない (すぐに返せるのがキャッシュの意味なので)
+  double bound = 0;
+  if (solving && n <= HK_EXACT_MAX) {
+    double ub = cached;
+    if (!hit) {
+      Rng rng = rng_init(1);
+      build_route(INIT_GREEDY, city, (cand.nb != NULL) ? &cand : NULL, n, route, &rng);
+      ub = 0;
+      for (int i = 0; i < n; i++) ub += distance(city[route[i]], city[route[(i+1)%n]]);
+    }
+    bound = held_karp_bound(city, &dt, (cand.nb != NULL) ? &cand : NULL, n, ub);
+  }
+  const double stop_at = (bound > 0 && target_gap >= 0) ? bound * (1 + target_gap) : 0;
+
+  // 町の初期配置を表示
+  plot_cities(fp, map, city, n, NULL);
+  if (n <= PLOT_LABEL_MAX) sleep(1);
+
+  // チェックポイントがあれば、そこから再開する
+  Checkpointer ck;
+  CkptHeader resume;
+  int *resume_route = NULL, *resume_best = NULL;
+  int resumed = 0;
+  if (solving && ckpt_path != NULL) {
+    resume_route = (int*)malloc(sizeof(int) * n);
+    resume_best = (int*)malloc(sizeof(int) * n);
+    resumed = ckpt_load(ckpt_path, city, n, &resume, resume_route, resume_best);
+    if (resumed && (resume.init != init || resume.moves != moves)){
+      fprintf(stderr, "%s: checkpoint was written with different init or moves.\n", ckpt_path);
+      exit(1);
+    }
+    ckpt_start(&ck, ckpt_path, ckpt_interval, city, n, init, moves);
+  }
+
+  // -W のときはキャッシュの巡回路 (route に入っている) から始める
+  int *warm = NULL;
+  if (hit && warm_start) {
+    warm = (int*)malloc(sizeof(int) * n);
+    memcpy(warm, route, sizeof(int) * n);
+  }
+  double d = cached;
+  if (solving) {
+    StopRule stop = stop_init(confidence, deadline, stop_at);
+    if (use_pt) d = solve_pt(city,&dt,&cand,n,route,nrep,init,moves,warm,&stop);
+    else if (use_split) d = solve_split(city,&dt,&cand,n,route,nrep,init,moves,warm);
+    else d = solve(city,&dt,(cand.nb != NULL) ? &cand : NULL,n,route,init,moves,warm,&stop,
+                   (ckpt_path != NULL) ? &ck : NULL, resumed ? &resume : NULL, resume_route, resume_best);
+    if (stop.reason != NULL) fprintf(stderr, "stopped early (%s)\n", stop.reason);
+    // 改善できなかったときはキャッシュの巡回路を返す
+    if (hit && cached <= d) {
+      memcpy(route, warm, sizeof(int) * n);
+      d = cached;
+    }
+  }
+  if (solving && ckpt_path != NULL) {
+    ckpt_finish(&ck);
+    free(resume_route);
+    free(resume_best);
+  }
+  if (cache_path != NULL && (!hit || d < cached)) cache_store(cache_path, city_hash, param_hash, n, route, d);
+  free(warm);
   plot_cities(fp, map, city, n, route);
   printf("total distance = %f\n", d);
   for (int i = 0 ; i < n ; i++){
     printf("%d -> ", route[i]);
   }
   printf("0\n");
+  if (bound > 0) printf("lower bound = %f, gap = %.3f%%\n", bound, 100 * (d - bound) / bound);
+  else if (solving) fprintf(stderr, "no lower bound (more than %d cities)\n", HK_EXACT_MAX);
 
   // 動的確保した環境ではfreeをする
   free(route);
   //free(visited);
-  free(city);
+  free_map_dot(map);
+  free_dist_table(dt);
+  free_candidates(cand);
+  unload_cities(cf);
   
   return 0;
 }
@@ -152,24 +368,51 @@ void draw_route(Map map, City *city, int n, const int *route)
   }
 }
 
+// 地図に収まらない座標の場合は、全体が収まるように縮小した座標を作る (収まるならそのまま返す)
+// 番号の文字列の分だけ右側に余白をとる
+City *fit_to_map(Map map, City *city, int n)
+{
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < minx) minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < miny) miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  if (minx >= 0 && maxx < map.width - 5 && miny >= 0 && maxy < map.height) return city;
+
+  City *pt = (City*)malloc(sizeof(City) * n);
+  const double sx = (map.width - 6) / fmax(1.0, (double)maxx - minx);
+  const double sy = (map.height - 1) / fmax(1.0, (double)maxy - miny);
+  for (int i = 0; i < n; i++) {
+    pt[i].x = (int)(((double)city[i].x - minx) * sx);
+    pt[i].y = (int)(((double)city[i].y - miny) * sy);
+  }
+  return pt;
+}
+
 void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
 {
   fprintf(fp, "----------\n");
 
   memset(map.dot[0], ' ', map.width * map.height); 
+  City *pt = fit_to_map(map, city, n);
 
-  // 町のみ番号付きでプロットする
+  // 町のみ番号付きでプロットする (多すぎるときは番号を省いて点だけ)
   for (int i = 0; i < n; i++) {
     char buf[100];
-    sprintf(buf, "C_%d", i);
-    for (int j = 0; j < strlen(buf); j++) {
-      const int x = city[i].x + j;
-      const int y = city[i].y;
+    if (n <= PLOT_LABEL_MAX) sprintf(buf, "C_%d", i);
+    else strcpy(buf, "o");
+    const size_t len = strlen(buf);
+    for (size_t j = 0; j < len && pt[i].x + (int)j < map.width; j++) {
+      const int x = pt[i].x + (int)j;
+      const int y = pt[i].y;
       map.dot[x][y] = buf[j];
     }
   }
 
-  draw_route(map, city, n, route);
+  draw_route(map, pt, n, route);
+  if (pt != city) free(pt);
 
   for (int y = 0; y < map.height; y++) {
     for (int x = 0; x < map.width; x++) {
@@ -181,107 +424,955 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
+// 名前 (カンマ区切り) から近傍の組み合わせを読む。知らない名前があれば -1
+int parse_moves(const char *s)
 {
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
+  int mask = 0;
+  while (*s != '\0') {
+    const char *e = strchr(s, ',');
+    const size_t len = (e != NULL) ? (size_t)(e - s) : strlen(s);
+    int found = 0;
+    for (int k = 0; k < SA_MOVE_COUNT; k++) {
+      if (strlen(sa_move_names[k]) == len && strncmp(s, sa_move_names[k], len) == 0) {
+        mask |= 1 << k;
+        found = 1;
+      }
+    }
+    if (!found) return -1;
+    s += len;
+    if (*s == ',') s++;
+  }
+  return mask;
 }
 
-void gen_random_route(int n, int *route) {
+// チェックポイントを読む。ファイルがなければ 0、あれば中身を確かめて 1 を返す
+// 別の都市ファイルのものや壊れたものはエラーで終わる (上書きして消してしまわないように)
+int ckpt_load(const char *path, const City *city, int n, CkptHeader *h, int *cur, int *best)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    if (errno == ENOENT) return 0;
+    perror(path);
+    exit(1);
+  }
+  if (fread(h, sizeof(*h), 1, f) != 1 || h->magic != CKPT_MAGIC || h->version != CKPT_VERSION || h->n != n ||
+      fread(cur, sizeof(int), n, f) != (size_t)n || fread(best, sizeof(int), n, f) != (size_t)n) {
+    fprintf(stderr, "%s: not a checkpoint for this city file.\n", path);
+    exit(1);
+  }
+  fclose(f);
+  if (h->city_hash != city_checksum(city, sizeof(City) * n)) {
+    fprintf(stderr, "%s: checkpoint was written for a different city file.\n", path);
+    exit(1);
+  }
+  uint64_t sum = city_checksum(cur, sizeof(int) * n) ^ city_checksum(best, sizeof(int) * n);
+  if (h->checksum != sum) {
+    fprintf(stderr, "%s: checksum mismatch.\n", path);
+    exit(1);
+  }
+  fprintf(stderr, "resume from %s (restart %d, t = %d)\n", path, h->restart, h->t);
+  return 1;
+}
 
-  // 初期化
-  for (int i = 0 ; i < n ; i++){
-    route[i] = i;
+// スナップショットを一時ファイルに書いてから rename で置き換える (途中で止まっても前のファイルが残る)
+static void ckpt_write(Checkpointer *ck)
+{
+  const int n = ck->hdr.n;
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", ck->path);
+  FILE *f = fopen(tmp, "wb");
+  if (f == NULL) {
+    perror(tmp);
+    return;
   }
+  const int ok = fwrite(&ck->hdr, sizeof(ck->hdr), 1, f) == 1 && fwrite(ck->cur, sizeof(int), n, f) == (size_t)n &&
+                 fwrite(ck->best_buf, sizeof(int), n, f) == (size_t)n && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  fclose(f);
+  if (!ok || rename(tmp, ck->path) != 0) perror(ck->path);
+}
 
-  // n回シャッフル
-  for (int i=0; i<n; i++) {
-    int j1 = rand() % (n-1) + 1;
-    int j2 = rand() % (n-1) + 1;
-    int temp = route[j1];
-    route[j1] = route[j2];
-    route[j2] = temp;
+static void *ckpt_writer(void *arg)
+{
+  Checkpointer *ck = (Checkpointer*)arg;
+  pthread_mutex_lock(&ck->mu);
+  while (1) {
+    while (!ck->pending && !ck->stop) pthread_cond_wait(&ck->cv, &ck->mu);
+    if (!ck->pending) break;
+    pthread_mutex_unlock(&ck->mu);
+    ckpt_write(ck);
+    pthread_mutex_lock(&ck->mu);
+    ck->pending = 0;
   }
+  pthread_mutex_unlock(&ck->mu);
+  return NULL;
+}
 
+void ckpt_start(Checkpointer *ck, const char *path, int interval, const City *city, int n, int init, int moves)
+{
+  *ck = (Checkpointer){.path = path, .interval = interval, .last = time(NULL)};
+  ck->hdr = (CkptHeader){.magic = CKPT_MAGIC, .version = CKPT_VERSION, .n = n, .init = init, .moves = moves,
+                         .city_hash = city_checksum(city, sizeof(City) * n)};
+  ck->cur = (int*)malloc(sizeof(int) * n);
+  ck->best_buf = (int*)calloc(n, sizeof(int));
+  pthread_mutex_init(&ck->mu, NULL);
+  pthread_cond_init(&ck->cv, NULL);
+  pthread_create(&ck->th, NULL, ckpt_writer, ck);
 }
 
-void swap(int *a, int *b) {
-  int temp = *a;
-  *a = *b;
-  *b = temp;
+// 最後まで終わったら、書き出し中のものを待ってからファイルを消す
+void ckpt_finish(Checkpointer *ck)
+{
+  pthread_mutex_lock(&ck->mu);
+  ck->stop = 1;
+  pthread_cond_signal(&ck->cv);
+  pthread_mutex_unlock(&ck->mu);
+  pthread_join(ck->th, NULL);
+  unlink(ck->path);
+  pthread_mutex_destroy(&ck->mu);
+  pthread_cond_destroy(&ck->cv);
+  free(ck->cur);
+  free(ck->best_buf);
 }
 
-double dist(const City *city, int *route, int i, int j) {
-  return distance(city[route[i]], city[route[j]]);
+// 反復 t を行う前の状態を保存に回す (sa_calc() のループから SA_CHECK 回ごとに呼ばれる SaHook。arg は Checkpointer)
+// tour が NULL なら route (配列のままの巡回路) を保存する
+static void ckpt_offer(void *arg, Tour *tour, const int *route, const Rng *rng, int T, int t0, int t, double co)
+{
+  Checkpointer *ck = (Checkpointer*)arg;
+  const time_t now = time(NULL);
+  if (now - ck->last < ck->interval) return;
+  pthread_mutex_lock(&ck->mu);
+  const int busy = ck->pending;
+  pthread_mutex_unlock(&ck->mu);
+  if (busy) return;
+
+  const int n = ck->hdr.n;
+  if (tour != NULL) tour_get_sequence(tour, ck->cur);
+  else memcpy(ck->cur, route, sizeof(int) * n);
+  if (ck->best_route != NULL) memcpy(ck->best_buf, ck->best_route, sizeof(int) * n);
+  CkptHeader *h = &ck->hdr;
+  h->restart = ck->restart;
+  h->T = T;
+  h->t0 = t0;
+  h->t = t;
+  h->co = co;
+  h->best = ck->best;
+  if (ck->rule != NULL) {
+    h->stop_restarts = ck->rule->restarts;
+    h->stop_since = ck->rule->since;
+    h->stop_hits = ck->rule->hits;
+    h->stop_best = ck->rule->best;
+  }
+  memcpy(h->rng, rng->s, sizeof(h->rng));
+  h->checksum = city_checksum(ck->cur, sizeof(int) * n) ^ city_checksum(ck->best_buf, sizeof(int) * n);
+  ck->last = now;
+
+  pthread_mutex_lock(&ck->mu);
+  ck->pending = 1;
+  pthread_cond_signal(&ck->cv);
+  pthread_mutex_unlock(&ck->mu);
 }
 
-Answer calc(const City *city, int n) {
-  int route[n];
-  gen_random_route(n, route);
+// 解き方のハッシュ。同じ都市でも解き方 (mode は sa: 0, pt: 1, split: 2) が違えば別の巡回路として持つ
+uint64_t cache_param_hash(int mode, int init, int moves)
+{
+  const int32_t p[3] = {mode, init, moves};
+  return city_checksum(p, sizeof(p));
+}
 
-  double co = -1e-6; //最大化なら正、最小化なら負。絶対値が小さいほど悪化方向へ進みやすい。Tが大きいほど小さくできる。
-  int T = 1e6;
+static inline uint32_t cache_home(uint64_t city_hash, uint64_t param_hash, uint32_t slots)
+{
+  return (uint32_t)((city_hash ^ (param_hash * 0x9e3779b97f4a7c15ULL)) >> 17) & (slots - 1);
+}
 
-  for (int t=0; t<T; t++) {
+// 表の中で (city_hash, param_hash) のスロットか、なければ入れるべき空きスロットの番号
+static uint32_t cache_probe(const CacheSlot *slot, uint32_t slots, uint64_t city_hash, uint64_t param_hash)
+{
+  uint32_t i = cache_home(city_hash, param_hash, slots);
+  while (slot[i].n != 0 && (slot[i].city_hash != city_hash || slot[i].param_hash != param_hash))
+    i = (i + 1) & (slots - 1);
+  return i;
+}
 
-    int i = rand() % (n-1) + 1;
-    int j = rand() % (n-1) + 1;
+// 見つかれば route と *length に入れて 1 を返す。ファイルがない・壊れている・巡回路がおかしいときは 0
+int cache_lookup(const char *path, uint64_t city_hash, uint64_t param_hash, int n, int *route, double *length)
+{
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader))
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return 0;
 
-    // 2-opt法
-    
-    if (i > j) {
-      swap(&i, &j);
-    }
-    if (j - i <= 2) continue; // 確実に交差していない
-
-    double diff = 0;
-    diff -= dist(city, route, i, (i + 1) % n);
-    diff -= dist(city, route, (j - 1 + n) % n, j);
-    diff += dist(city, route, i, (j - 1 + n) % n);
-    diff += dist(city, route, (i + 1) % n, j);
-
-    if ((rand() / (double)RAND_MAX) < exp(co * diff * t)) {
-      // i番目とj番目の間をすべて逆向きにする
-      while (1) {
-        i = (i + 1) % n;
-        j = (j - 1 + n) % n;
-        swap(&route[i], &route[j]);
-        if (0 <= j - i && j - i <= 1) break;
+  const size_t len = (size_t)st.st_size;
+  const CacheHeader *h = (const CacheHeader*)addr;
+  int found = 0;
+  if (h->magic == CACHE_MAGIC && h->version == CACHE_VERSION && h->slots > 0 && (h->slots & (h->slots - 1)) == 0 &&
+      sizeof(CacheHeader) + (size_t)h->slots * sizeof(CacheSlot) <= len) {
+    const CacheSlot *slot = (const CacheSlot*)(h + 1);
+    const CacheSlot *s = &slot[cache_probe(slot, h->slots, city_hash, param_hash)];
+    if (s->n == (uint32_t)n && s->offset + sizeof(int) * (size_t)n <= len) {
+      memcpy(route, (const char*)addr + s->offset, sizeof(int) * n);
+      *length = s->length;
+      // 順列になっているか確かめる
+      char *seen = (char*)calloc(n, 1);
+      found = 1;
+      for (int i = 0; i < n && found; i++) {
+        if (route[i] < 0 || route[i] >= n || seen[route[i]]) found = 0;
+        else seen[route[i]] = 1;
       }
+      free(seen);
     }
+  }
+  munmap(addr, len);
+  return found;
+}
 
+// 空のキャッシュを slots 個のスロットで fd に作る
+static void cache_create(int fd, uint32_t slots)
+{
+  const CacheHeader h = {.magic = CACHE_MAGIC, .version = CACHE_VERSION, .slots = slots, .used = 0,
+                         .end = sizeof(CacheHeader) + (uint64_t)slots * sizeof(CacheSlot)};
+  if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)h.end) != 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+    perror("cache");
+}
+
+// スロットを倍にした新しいファイルへ、今の巡回路を詰めて写し、元のファイルと置き換える
+static int cache_grow(const char *path, int fd, const CacheHeader *h, const char *base)
+{
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  const int nfd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (nfd < 0) {
+    perror(tmp);
+    return fd;
+  }
+  flock(nfd, LOCK_EX);
+  const uint32_t slots = h->slots * 2;
+  cache_create(nfd, slots);
+  CacheHeader nh;
+  if (pread(nfd, &nh, sizeof(nh), 0) != sizeof(nh)) perror(tmp);
+  CacheSlot *nslot = (CacheSlot*)calloc(slots, sizeof(CacheSlot));
+  const CacheSlot *slot = (const CacheSlot*)(base + sizeof(CacheHeader));
+  for (uint32_t i = 0; i < h->slots; i++) {
+    if (slot[i].n == 0) continue;
+    const uint32_t j = cache_probe(nslot, slots, slot[i].city_hash, slot[i].param_hash);
+    nslot[j] = slot[i];
+    nslot[j].offset = nh.end;
+    const size_t bytes = sizeof(int) * (size_t)slot[i].n;
+    if (pwrite(nfd, base + slot[i].offset, bytes, (off_t)nh.end) != (ssize_t)bytes) perror(tmp);
+    nh.end += bytes;
+    nh.used++;
   }
+  if (pwrite(nfd, nslot, sizeof(CacheSlot) * slots, sizeof(CacheHeader)) != (ssize_t)(sizeof(CacheSlot) * slots) ||
+      pwrite(nfd, &nh, sizeof(nh), 0) != sizeof(nh) || fsync(nfd) != 0 || rename(tmp, path) != 0)
+    perror(tmp);
+  free(nslot);
+  close(fd); // 古いファイルのロックも外れる
+  return nfd;
+}
 
-  double sum_d = 0;
-  for (int i = 0 ; i < n ; i++){
-    const int c0 = route[i];
-    const int c1 = route[(i+1)%n]; // nは0に戻る
-    sum_d += distance(city[c0],city[c1]);
+// (city_hash, param_hash) の巡回路として入れる。もっと短いものが入っていれば何もしない
+void cache_store(const char *path, uint64_t city_hash, uint64_t param_hash, int n, const int *route, double length)
+{
+  int fd;
+  struct stat st, cur;
+  while (1) {
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      perror(path);
+      return;
+    }
+    flock(fd, LOCK_EX);
+    // ロックを待っている間に別のプロセスが作り直していたら、新しいファイルを開きなおす
+    if (fstat(fd, &st) == 0 && stat(path, &cur) == 0 && st.st_ino == cur.st_ino) break;
+    close(fd);
   }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader)) cache_create(fd, CACHE_SLOTS);
 
-  //printf("sum:%lf\n", sum_d);
+  CacheHeader h;
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != CACHE_MAGIC || h.version != CACHE_VERSION) {
+    fprintf(stderr, "%s: not a cache file.\n", path);
+    close(fd);
+    return;
+  }
+  fstat(fd, &st);
+  char *base = (char*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    perror(path);
+    close(fd);
+    return;
+  }
+  if ((h.used + 1) * 4 > h.slots * 3) {
+    fd = cache_grow(path, fd, &h, base);
+    munmap(base, (size_t)st.st_size);
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h)) perror(path);
+    fstat(fd, &st);
+    base = (char*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      perror(path);
+      close(fd);
+      return;
+    }
+  }
 
-  int *ans_route = (int*)calloc(n, sizeof(int));
-  memcpy(ans_route, route, sizeof(int) * n);
-  return (Answer){.dist = sum_d, .route = ans_route};
+  const CacheSlot *slot = (const CacheSlot*)(base + sizeof(CacheHeader));
+  const uint32_t i = cache_probe(slot, h.slots, city_hash, param_hash);
+  if (slot[i].n == 0 || length < slot[i].length) {
+    // 巡回路を書いてからスロットを書き換えるので、途中で止まっても前の巡回路が残る
+    CacheSlot s = {.city_hash = city_hash, .param_hash = param_hash, .offset = h.end, .n = (uint32_t)n,
+                   .length = length};
+    const size_t bytes = sizeof(int) * (size_t)n;
+    if (slot[i].n == 0) h.used++;
+    h.end += bytes;
+    if (pwrite(fd, route, bytes, (off_t)s.offset) != (ssize_t)bytes ||
+        pwrite(fd, &s, sizeof(s), sizeof(CacheHeader) + sizeof(CacheSlot) * (off_t)i) != sizeof(s) ||
+        pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+      perror(path);
+  }
+  munmap(base, (size_t)st.st_size);
+  close(fd);
 }
 
-double solve(const City *city, int n, int *route)
+// resume があれば、初期解は作らずにチェックポイントの状態 (巡回路・反復・温度) から続ける
+// そうでなくて start_route があれば、それを初期解にする (作った初期解と同じ温度から始める)
+// 焼きなまし自体は tsp_sa.h の sa_calc()
+Answer calc(const City *city, const DistTable *dt, const Cand *cand, int n, int init, int moves, double nn, Rng *rng,
+            Checkpointer *ck, const CkptHeader *resume, const int *start_route) {
+  // 都市数が多くてもスタックがあふれないようにヒープに確保する
+  int *route = (int*)calloc(n, sizeof(int));
+  if (start_route != NULL) memcpy(route, start_route, sizeof(int) * n);
+  else build_route(init, city, cand, n, route, rng);
+
+  // 反復回数は都市数が多いときは増やす (co*T = -1 になるようにそろえる)
+  int T = max(1e6, 20 * n);
+  double co = -1.0 / T; //最大化なら正、最小化なら負。絶対値が小さいほど悪化方向へ進みやすい。Tが大きいほど小さくできる。
+  // 温度は T/t。初期解を作ったときは、高温で壊してしまわないよう sa_t0() から始める
+  int t0 = (init == INIT_RANDOM && start_route == NULL) ? 0 : sa_t0(T, nn);
+  int start = t0;
+  if (resume != NULL) {
+    T = resume->T;
+    co = resume->co;
+    t0 = resume->t0;
+    start = resume->t;
+  }
+
+  const double sum_d = sa_calc(city, dt, cand, n, moves, route, rng, T, co, t0, start,
+                               (ck != NULL) ? ckpt_offer : NULL, ck, NULL);
+  return (Answer){.dist = sum_d, .route = route};
+}
+
+// warm があれば、どの回もその巡回路から始める
+// stop があれば、1回ごとに打ち切り判定をする (再開したときは、チェックポイントにある判定の状態から続ける)
+// ck があれば途中経過を保存し、resume があればそこから (最良解と乱数の状態も含めて) 再開する
+double solve(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int init, int moves,
+             const int *warm, StopRule *stop, Checkpointer *ck, const CkptHeader *resume, const int *resume_route,
+             const int *resume_best)
 {
 
-  srand((unsigned)time(NULL));
+  init_exp_table();
+  Rng rng = rng_init((uint64_t)time(NULL));
+  const double nn = mean_nn_dist(dt, cand, n);
   Answer ans = (Answer){.dist = 1e15};
-  int times = 10;
-  for (int i=0; i<times; i++) {
-    Answer result = calc(city, n);
+  int first = 0;
+  if (resume != NULL) {
+    memcpy(rng.s, resume->rng, sizeof(rng.s));
+    first = resume->restart;
+    ans.dist = resume->best;
+    if (resume->best < 1e15) {
+      ans.route = (int*)malloc(sizeof(int) * n);
+      memcpy(ans.route, resume_best, sizeof(int) * n);
+    }
+    if (stop != NULL) {
+      stop->restarts = resume->stop_restarts;
+      stop->since = resume->stop_since;
+      stop->hits = resume->stop_hits;
+      stop->best = resume->stop_best;
+    }
+  }
+  int times = (n < 10000) ? 10 : 1; // 都市数が多いときは1回を長くする
+  for (int i=first; i<times; i++) {
+    if (ck != NULL) {
+      ck->restart = i;
+      ck->best = ans.dist;
+      ck->best_route = ans.route;
+      ck->rule = stop;
+    }
+    const int resuming = (i == first && resume != NULL);
+    Answer result = calc(city, dt, cand, n, init, moves, nn, &rng, ck, resuming ? resume : NULL,
+                         resuming ? resume_route : warm);
+    rng_jump(&rng); // 次の初期解は別の乱数列で
     //printf("d:%lf\n", result.dist);
     if (result.dist < ans.dist) {
       free(ans.route);
       ans = result;
+    } else {
+      free(result.route);
     }
+    if (stop != NULL && stop_update(stop, result.dist)) break;
   }
   memcpy(route, ans.route, sizeof(int) * n);
+  if (ck != NULL) {
+    ck->best_route = NULL;
+    ck->rule = NULL;
+  }
+  free(ans.route);
 
   return ans.dist;
 }
+
+// 並列焼き戻し法 (レプリカ交換法)
+// 温度を固定したレプリカを1スレッドに1つずつ走らせ、一定回数ごとに全員がそろったところで
+// 隣り合う温度のレプリカどうしの温度を確率 min(1, exp((1/T_i - 1/T_j)(E_i - E_j))) で入れ替える。
+// 温度を入れ替えるのは巡回路を入れ替えるのと同じことなので、巡回路のコピーはいらない。
+#define PT_SWEEP 10000  // 交換の間に各レプリカが試す移動の回数
+#define PT_T_HIGH 0.5   // 最高温度 (最近傍の都市までの平均距離に対する比)
+#define PT_T_LOW 0.01   // 最低温度 (同上)
+
+typedef struct {
+  const DistTable *dt;
+  const Cand *cand;
+  int n;
+  int moves;      // 使う近傍
+  Tour tour;
+  double energy;  // 現在の巡回路の長さ
+  double temp;    // 現在担当している温度
+  Rng rng;
+} Replica;
+
+typedef struct {
+  Replica *rep;
+  int nrep;
+  int rounds;
+  int *level;     // level[k] = k番目に低い温度を担当しているレプリカ
+  pthread_barrier_t barrier;
+  Rng rng;        // 交換の判定用
+  double best;    // 全レプリカを通しての最良解
+  int *best_route;
+  StopRule *rule; // 最良解が rule->stop_at 以下になるか、時間切れになったら止める
+  int stop;
+} PT;
+
+// 温度を固定した 2-opt を PT_SWEEP 回
+void pt_sweep(Replica *r)
+{
+  const double co = -1.0 / r->temp;
+  int kinds[SA_MOVE_COUNT];
+  const int nk = move_kinds(r->moves, kinds);
+  for (int it = 0; it < PT_SWEEP; it++) {
+    const int kind = (nk == 1) ? kinds[0] : kinds[rng_int(&r->rng, nk)];
+    r->energy += sa_move(&r->tour, r->dt, r->cand, r->n, kind, &r->rng, co, 1, NULL);
+  }
+}
+
+// 全員が止まっている間に1スレッドだけで呼ぶ
+void pt_exchange(PT *pt, int round, int *route, const City *city)
+{
+  // 最良解の更新 (長さは誤差がたまっているので計算しなおす)
+  for (int k = 0; k < pt->nrep; k++) {
+    Replica *r = &pt->rep[k];
+    if (r->energy >= pt->best) continue;
+    tour_get_route(&r->tour, route);
+    double sum_d = 0;
+    for (int i = 0; i < r->n; i++) sum_d += distance(city[route[i]], city[route[(i+1)%r->n]]);
+    r->energy = sum_d;
+    if (sum_d < pt->best) {
+      pt->best = sum_d;
+      memcpy(pt->best_route, route, sizeof(int) * r->n);
+    }
+  }
+  if (pt->best <= pt->rule->stop_at) pt->rule->reason = "gap";
+  else if (stop_time_up(pt->rule)) pt->rule->reason = "deadline";
+  pt->stop = (pt->rule->reason != NULL);
+
+  // 偶数回目は (0,1), (2,3), ...、奇数回目は (1,2), (3,4), ... の組で交換を試す
+  for (int k = round % 2; k + 1 < pt->nrep; k += 2) {
+    Replica *cold = &pt->rep[pt->level[k]];
+    Replica *hot = &pt->rep[pt->level[k+1]];
+    const double x = (1 / cold->temp - 1 / hot->temp) * (cold->energy - hot->energy);
+    if (x >= 0 || rng_double(&pt->rng) < exp(x)) {
+      const double t = cold->temp;
+      cold->temp = hot->temp;
+      hot->temp = t;
+      const int l = pt->level[k];
+      pt->level[k] = pt->level[k+1];
+      pt->level[k+1] = l;
+    }
+  }
+}
+
+typedef struct {
+  PT *pt;
+  const City *city;
+  int id;
+} PTWorker;
+
+void *pt_worker(void *arg)
+{
+  PTWorker *w = (PTWorker*)arg;
+  PT *pt = w->pt;
+  int *route = (w->id == 0) ? (int*)malloc(sizeof(int) * pt->rep[0].n) : NULL;
+  for (int round = 0; round < pt->rounds; round++) {
+    pt_sweep(&pt->rep[w->id]);
+    pthread_barrier_wait(&pt->barrier);
+    if (w->id == 0) pt_exchange(pt, round, route, w->city);
+    pthread_barrier_wait(&pt->barrier);
+    if (pt->stop) break; // 全員が同じ回で見る
+  }
+  if (w->id == 0) {
+    pt_exchange(pt, pt->rounds, route, w->city); // 最後の状態も最良解の候補にする
+    free(route);
+  }
+  return NULL;
+}
+
+// warm があれば、全レプリカをその巡回路から始める。rule の目標か制限時間に達したら途中でも止める
+double solve_pt(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nrep, int init, int moves,
+                const int *warm, StopRule *rule)
+{
+  init_exp_table();
+  PT pt = {.nrep = nrep, .best = 1e300, .rule = rule};
+  pt.rng = rng_init((uint64_t)time(NULL));
+  // 逐次版 (初期解10個 x 1e6回) と同じ総反復回数にする
+  pt.rounds = max(1, (int)(1e7 / ((double)PT_SWEEP * nrep)));
+  pt.rep = (Replica*)malloc(sizeof(Replica) * nrep);
+  pt.level = (int*)malloc(sizeof(int) * nrep);
+  pt.best_route = (int*)malloc(sizeof(int) * n);
+
+  // 温度の目安は最近傍の都市までの平均距離
+  const double nn = mean_nn_dist(dt, cand, n);
+
+  for (int k = 0; k < nrep; k++) {
+    Replica *r = &pt.rep[k];
+    rng_jump(&pt.rng);
+    r->rng = pt.rng;
+    r->dt = dt;
+    r->cand = cand;
+    r->n = n;
+    r->moves = moves;
+    if (warm != NULL) memcpy(route, warm, sizeof(int) * n);
+    else build_route(init, city, cand, n, route, &r->rng);
+    r->tour = tour_init((n >= TOUR_TREE_MIN_CITIES) ? TOUR_TREE : TOUR_ARRAY, route, n);
+    r->energy = 0;
+    for (int i = 0; i < n; i++) r->energy += distance(city[route[i]], city[route[(i+1)%n]]);
+    // 温度は等比数列で並べる
+    const double ratio = (nrep == 1) ? 0 : (double)k / (nrep - 1);
+    r->temp = nn * PT_T_LOW * pow(PT_T_HIGH / PT_T_LOW, ratio);
+    pt.level[k] = k;
+  }
+  rng_jump(&pt.rng);
+
+  pthread_barrier_init(&pt.barrier, NULL, nrep);
+  pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nrep);
+  PTWorker *w = (PTWorker*)malloc(sizeof(PTWorker) * nrep);
+  for (int k = 0; k < nrep; k++) {
+    w[k] = (PTWorker){.pt = &pt, .city = city, .id = k};
+    pthread_create(&th[k], NULL, pt_worker, &w[k]);
+  }
+  for (int k = 0; k < nrep; k++) pthread_join(th[k], NULL);
+  pthread_barrier_destroy(&pt.barrier);
+
+  memcpy(route, pt.best_route, sizeof(int) * n);
+  const double best = pt.best;
+  for (int k = 0; k < nrep; k++) tour_free(pt.rep[k].tour);
+  free(th);
+  free(w);
+  free(pt.rep);
+  free(pt.level);
+  free(pt.best_route);
+  return best;
+}
+
+// 分割統治 (split)
+// 都市を k-d 木で SPLIT_REGION 都市以下の領域に分け、各領域を calc() でスレッドごとに並列に解く。
+// 領域の巡回路は k-d 木を下からたどって兄弟どうしをつなぎ (境目の近くで一番短くなる2辺を選ぶ)、
+// 最後に領域の境目の都市のまわりだけ局所探索 (2-opt と Or-opt) で直す。
+// 1回の calc() は領域の大きさで決まるので、都市数がどれだけ多くてもコア数に比例して速くなる
+#ifndef SPLIT_REGION
+#define SPLIT_REGION 3000 // 1つの領域の最大の都市数
+#endif
+#define SPLIT_EPS 1e-9    // 局所探索で改善とみなす最小の差
+
+typedef struct {
+  int lo, hi;      // ids[lo..hi) がこの節の都市
+  int left, right; // 子の節 (葉なら -1)
+} KdNode;
+
+typedef struct {
+  const City *city;
+  int n;
+  int *ids;         // k-d 木の順に並べた都市。どの節の都市も連続している
+  int *order;       // order[c] = ids の中での c の位置
+  int *region;      // region[c] = c を含む葉の番号
+  int *next, *prev; // 領域の巡回路 (つないだ後は全体の巡回路)
+  KdNode *node;
+  int *leaf;
+  int nleaf;
+  int init, moves;
+  int nthreads;
+} Split;
+
+typedef struct {
+  Split *sp;
+  int id;
+  Rng rng;
+} SplitWorker;
+
+static inline int kd_coord(const City *city, int c, int axis)
+{
+  return axis ? city[c].y : city[c].x;
+}
+
+// ids[lo..hi) を並べ替え、k 番目に axis の座標が小さい都市を ids[k] に、それより小さいものを前に、大きいものを後ろに置く
+static void kd_select(const City *city, int *ids, int lo, int hi, int k, int axis)
+{
+  hi--;
+  while (lo < hi) {
+    const int pv = kd_coord(city, ids[(lo + hi) / 2], axis);
+    int i = lo, j = hi;
+    while (i <= j) {
+      while (kd_coord(city, ids[i], axis) < pv) i++;
+      while (kd_coord(city, ids[j], axis) > pv) j--;
+      if (i <= j) swap(&ids[i++], &ids[j--]);
+    }
+    if (k <= j) hi = j;
+    else if (k >= i) lo = i;
+    else return;
+  }
+}
+
+// 広がりの大きい方の軸の中央値で、SPLIT_REGION 都市以下になるまで2つに分けていく
+static int kd_build(Split *sp, int lo, int hi, int *count)
+{
+  const int id = (*count)++;
+  sp->node[id] = (KdNode){.lo = lo, .hi = hi, .left = -1, .right = -1};
+  if (hi - lo <= SPLIT_REGION) {
+    sp->leaf[sp->nleaf++] = id;
+    return id;
+  }
+  const City *city = sp->city;
+  int minx = city[sp->ids[lo]].x, maxx = minx, miny = city[sp->ids[lo]].y, maxy = miny;
+  for (int i = lo + 1; i < hi; i++) {
+    const City c = city[sp->ids[i]];
+    minx = min(minx, c.x);
+    maxx = max(maxx, c.x);
+    miny = min(miny, c.y);
+    maxy = max(maxy, c.y);
+  }
+  const int mid = lo + (hi - lo) / 2;
+  kd_select(city, sp->ids, lo, hi, mid, ((double)maxx - minx >= (double)maxy - miny) ? 0 : 1);
+  const int left = kd_build(sp, lo, mid, count);
+  const int right = kd_build(sp, mid, hi, count);
+  sp->node[id].left = left;
+  sp->node[id].right = right;
+  return id;
+}
+
+// 局所探索 (領域の仕上げと境目の修復用)。待ち行列に入っている都市のまわりで、改善がなくなるまで 2-opt と Or-opt を行う
+typedef struct {
+  Tour *tour;
+  const DistTable *dt;
+  const Cand *cand;
+  int n;
+  int *queue;
+  char *in_queue;
+  int head, tail, len;
+} LocalSearch;
+
+static void ls_push(LocalSearch *ls, int c)
+{
+  if (ls->in_queue[c]) return;
+  ls->queue[ls->tail] = c;
+  ls->tail = (ls->tail + 1) % ls->n;
+  ls->len++;
+  ls->in_queue[c] = 1;
+}
+
+// 都市 a の周りで改善する 2-opt か Or-opt を1つ探して行う。行ったら、周りが変わった都市を待ち行列に入れて 1 を返す
+static int ls_improve(LocalSearch *ls, int a)
+{
+  Tour *t = ls->tour;
+  const DistTable *dt = ls->dt;
+  const int k = ls->cand->k;
+  const int *nb = ls->cand->nb;
+  // 2-opt: a とその近くの都市 c を隣り合わせる (a の後ろの辺と前の辺の両方で試す)
+  for (int dir = 0; dir < 2; dir++) {
+    const int b = dir ? tour_prev(t, a) : tour_next(t, a);
+    const double dab = dt_get(dt, a, b);
+    for (int i = 0; i < k; i++) {
+      const int c = nb[(size_t)a * k + i];
+      const double dac = dt_get(dt, a, c);
+      if (dac >= dab) break; // 近い順なので、これより先は改善しない
+      const int d = dir ? tour_prev(t, c) : tour_next(t, c);
+      if (c == b || d == a) continue;
+      if (dac + dt_get(dt, b, d) - dab - dt_get(dt, c, d) < -SPLIT_EPS) {
+        if (dir) tour_flip(t, b, a, d, c);
+        else tour_flip(t, a, b, c, d);
+        const int touched[4] = {a, b, c, d};
+        for (int u = 0; u < 4; u++) ls_push(ls, touched[u]);
+        return 1;
+      }
+    }
+  }
+
+  // Or-opt: a から始まる1〜3都市の区間を、区間の端の近くの都市の前後へ (逆向きにもして) 移す
+  int s2 = a;
+  for (int sl = 1; sl <= 3 && sl < ls->n - 2; sl++) {
+    if (sl > 1) s2 = tour_next(t, s2);
+    const int p = tour_prev(t, a), nx = tour_next(t, s2);
+    if (nx == p) break;
+    const double base = dt_get(dt, p, nx) - dt_get(dt, p, a) - dt_get(dt, s2, nx);
+    for (int i = 0; i < 2 * k; i++) {
+      const int y = nb[(size_t)((i < k) ? a : s2) * k + i % k];
+      if (tour_between(t, a, y, s2)) continue;
+      for (int side = 0; side < 2; side++) {
+        // 辺 (c, d) は y の後ろか前の辺
+        const int c = side ? tour_prev(t, y) : y;
+        const int d = tour_next(t, c);
+        if (c == p || d == a || d == p || tour_between(t, a, c, s2)) continue;
+        const double cut = base - dt_get(dt, c, d);
+        const double fwd = cut + dt_get(dt, c, a) + dt_get(dt, s2, d);
+        const double rev = cut + dt_get(dt, c, s2) + dt_get(dt, a, d);
+        if (fwd < -SPLIT_EPS || rev < -SPLIT_EPS) {
+          tour_move_segment(t, p, a, s2, nx, c, d, rev < fwd);
+          const int touched[6] = {p, a, s2, nx, c, d};
+          for (int u = 0; u < 6; u++) ls_push(ls, touched[u]);
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static void local_search(LocalSearch *ls)
+{
+  while (ls->len > 0) {
+    const int c = ls->queue[ls->head];
+    ls->head = (ls->head + 1) % ls->n;
+    ls->len--;
+    ls->in_queue[c] = 0;
+    if (ls_improve(ls, c)) ls_push(ls, c);
+  }
+}
+
+// 全都市から局所探索する
+static void local_search_all(Tour *tour, const DistTable *dt, const Cand *cand, int n)
+{
+  LocalSearch ls = {.tour = tour, .dt = dt, .cand = cand, .n = n};
+  ls.queue = (int*)malloc(sizeof(int) * n);
+  ls.in_queue = (char*)calloc(n, sizeof(char));
+  for (int c = 0; c < n; c++) ls_push(&ls, c);
+  local_search(&ls);
+  free(ls.queue);
+  free(ls.in_queue);
+}
+
+// 1つの領域を取り出して calc() で解き、巡回路を next, prev に書く
+static void split_region(Split *sp, int l, Rng *rng)
+{
+  const KdNode *nd = &sp->node[sp->leaf[l]];
+  const int m = nd->hi - nd->lo;
+  const int *ids = sp->ids + nd->lo;
+  for (int i = 0; i < m; i++) sp->region[ids[i]] = l;
+  int *route = (int*)malloc(sizeof(int) * m);
+  if (m <= 3) {
+    // どう回っても同じ
+    for (int i = 0; i < m; i++) route[i] = i;
+  } else {
+    City *sub = (City*)malloc(sizeof(City) * m);
+    for (int i = 0; i < m; i++) sub[i] = sp->city[ids[i]];
+    DistTable dt = init_dist_table(sub, m, choose_dist_mode(m));
+    Cand cand = {.k = 0, .nb = NULL};
+    if (m >= CAND_MIN_CITIES || (sp->moves != (1 << SA_MOVE_2OPT) && m >= 8)) cand = build_candidates(sub, m, CAND_K);
+    const Cand *cp = (cand.nb != NULL) ? &cand : NULL;
+    Answer ans = calc(sub, &dt, cp, m, sp->init, sp->moves, mean_nn_dist(&dt, cp, m), rng, NULL, NULL, NULL);
+    memcpy(route, ans.route, sizeof(int) * m);
+    free(ans.route);
+    // 焼きなましの終わりは局所最適とは限らないので、領域の中で仕上げておく (全体でやるより速い)
+    if (cp != NULL) {
+      Tour tour = tour_init(TOUR_ARRAY, route, m);
+      local_search_all(&tour, &dt, cp, m);
+      tour_get_route(&tour, route);
+      tour_free(tour);
+    }
+    free_candidates(cand);
+    free_dist_table(dt);
+    free(sub);
+  }
+  for (int i = 0; i < m; i++) {
+    const int c = ids[route[i]];
+    sp->next[c] = ids[route[(i + 1) % m]];
+    sp->prev[c] = ids[route[(i + m - 1) % m]];
+  }
+  free(route);
+}
+
+void *split_worker(void *arg)
+{
+  SplitWorker *w = (SplitWorker*)arg;
+  // 領域の大きさはほぼそろっているので、順に割り振るだけでよい
+  for (int l = w->id; l < w->sp->nleaf; l += w->sp->nthreads) {
+    split_region(w->sp, l, &w->rng);
+    rng_jump(&w->rng);
+  }
+  return NULL;
+}
+
+// 節 nd の中で、都市 x を含む側の巡回路 B と、もう一方の巡回路 A を、辺 (a, na), (b, nb) を外してつなぐ
+// rev なら B を逆向きにして a b .. nb na、そうでなければ a nb .. b na
+static void split_join(Split *sp, const KdNode *bn, int a, int b, int rev)
+{
+  int *next = sp->next, *prev = sp->prev;
+  const int na = next[a], nb = next[b];
+  if (rev) {
+    for (int i = bn->lo; i < bn->hi; i++) {
+      const int c = sp->ids[i];
+      const int t = next[c];
+      next[c] = prev[c];
+      prev[c] = t;
+    }
+    next[a] = b;
+    prev[b] = a;
+    next[nb] = na;
+    prev[na] = nb;
+  } else {
+    next[a] = nb;
+    prev[nb] = a;
+    next[b] = na;
+    prev[na] = b;
+  }
+}
+
+// 都市 x (B の都市) と y (A の都市) が隣り合うつなぎ方4通りのうち、一番短くなるものを best と比べる
+static void split_try(const Split *sp, int x, int y, double *best, int *ba, int *bb, int *brev)
+{
+  const City *city = sp->city;
+  const int nx = sp->next[x], px = sp->prev[x], ny = sp->next[y], py = sp->prev[y];
+  const double dxy = distance(city[x], city[y]);
+  // (a, b, rev, 増える長さ)
+  const int a[4] = {y, y, py, py}, b[4] = {x, px, x, px}, rev[4] = {1, 0, 0, 1};
+  const double diff[4] = {
+    dxy + distance(city[ny], city[nx]) - distance(city[y], city[ny]) - distance(city[x], city[nx]),
+    dxy + distance(city[px], city[ny]) - distance(city[y], city[ny]) - distance(city[px], city[x]),
+    dxy + distance(city[py], city[nx]) - distance(city[py], city[y]) - distance(city[x], city[nx]),
+    dxy + distance(city[py], city[px]) - distance(city[py], city[y]) - distance(city[px], city[x]),
+  };
+  for (int o = 0; o < 4; o++) {
+    if (diff[o] < *best) {
+      *best = diff[o];
+      *ba = a[o];
+      *bb = b[o];
+      *brev = rev[o];
+    }
+  }
+}
+
+// 子の巡回路をそれぞれつないでから、2つの子をつなぐ
+// 小さい方 (B) の都市の候補リストに大きい方 (A) の都市があれば、その組を隣り合わせるつなぎ方を試す
+static void split_merge(Split *sp, const Cand *cand, int id)
+{
+  const KdNode *nd = &sp->node[id];
+  if (nd->left < 0) return;
+  split_merge(sp, cand, nd->left);
+  split_merge(sp, cand, nd->right);
+  const KdNode *l = &sp->node[nd->left], *r = &sp->node[nd->right];
+  const KdNode *bn = (l->hi - l->lo <= r->hi - r->lo) ? l : r;
+  const KdNode *an = (bn == l) ? r : l;
+  double best = 1e300;
+  int a = -1, b = -1, rev = 0;
+  for (int i = bn->lo; i < bn->hi; i++) {
+    const int x = sp->ids[i];
+    for (int t = 0; t < cand->k; t++) {
+      const int y = cand->nb[(size_t)x * cand->k + t];
+      if (an->lo <= sp->order[y] && sp->order[y] < an->hi) split_try(sp, x, y, &best, &a, &b, &rev);
+    }
+  }
+  if (a < 0) {
+    // 候補リストでは届かなかった (領域が細長いなど)。B の1都市から A の一番近い都市を探す
+    const int x = sp->ids[bn->lo];
+    int y = sp->ids[an->lo];
+    for (int i = an->lo; i < an->hi; i++)
+      if (distance(sp->city[x], sp->city[sp->ids[i]]) < distance(sp->city[x], sp->city[y])) y = sp->ids[i];
+    split_try(sp, x, y, &best, &a, &b, &rev);
+  }
+  split_join(sp, bn, a, b, rev);
+}
+
+// warm があれば分割はせず、その巡回路の全都市から局所探索だけ行う
+double solve_split(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nthreads, int init,
+                   int moves, const int *warm)
+{
+  Split sp = {.city = city, .n = n, .init = init, .moves = moves, .nthreads = nthreads};
+  sp.ids = (int*)malloc(sizeof(int) * n);
+  sp.order = (int*)malloc(sizeof(int) * n);
+  sp.region = (int*)calloc(n, sizeof(int));
+  sp.next = (int*)malloc(sizeof(int) * n);
+  sp.prev = (int*)malloc(sizeof(int) * n);
+  // 葉は SPLIT_REGION / 2 都市以上あるので、節の数はこれで足りる
+  const int max_nodes = 2 * (2 * (n / SPLIT_REGION) + 2);
+  sp.node = (KdNode*)malloc(sizeof(KdNode) * max_nodes);
+  sp.leaf = (int*)malloc(sizeof(int) * max_nodes);
+
+  if (warm == NULL) {
+    for (int i = 0; i < n; i++) sp.ids[i] = i;
+    int count = 0;
+    kd_build(&sp, 0, n, &count);
+    for (int i = 0; i < n; i++) sp.order[sp.ids[i]] = i;
+
+    init_exp_table();
+    Rng rng = rng_init((uint64_t)time(NULL));
+    pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    SplitWorker *w = (SplitWorker*)malloc(sizeof(SplitWorker) * nthreads);
+    for (int k = 0; k < nthreads; k++) {
+      rng_jump(&rng);
+      w[k] = (SplitWorker){.sp = &sp, .id = k, .rng = rng};
+      // 各スレッドの乱数列が重ならないように、領域の数だけ先へ進めておく
+      for (int l = 0; l < sp.nleaf; l++) rng_jump(&rng);
+      pthread_create(&th[k], NULL, split_worker, &w[k]);
+    }
+    for (int k = 0; k < nthreads; k++) pthread_join(th[k], NULL);
+    free(th);
+    free(w);
+    split_merge(&sp, cand, 0);
+    double stitched = 0;
+    for (int c = 0; c < n; c++) stitched += distance(city[c], city[sp.next[c]]);
+    fprintf(stderr, "split: %d regions, %f after stitching\n", sp.nleaf, stitched);
+    for (int i = 0, c = 0; i < n; i++, c = sp.next[c]) route[i] = c;
+  } else {
+    memcpy(route, warm, sizeof(int) * n);
+  }
+
+  // 境目の修復: 候補リストに別の領域の都市がある都市から局所探索する (warm なら全都市から)
+  Tour tour = tour_init((n >= TOUR_TREE_MIN_CITIES) ? TOUR_TREE : TOUR_ARRAY, route, n);
+  LocalSearch ls = {.tour = &tour, .dt = dt, .cand = cand, .n = n};
+  ls.queue = (int*)malloc(sizeof(int) * n);
+  ls.in_queue = (char*)calloc(n, sizeof(char));
+  for (int c = 0; c < n; c++) {
+    for (int t = 0; t < cand->k; t++) {
+      if (warm != NULL || sp.region[cand->nb[(size_t)c * cand->k + t]] != sp.region[c]) {
+        ls_push(&ls, c);
+        break;
+      }
+    }
+  }
+  if (n > 3) local_search(&ls);
+  tour_get_route(&tour, route);
+  tour_free(tour);
+
+  double sum_d = 0;
+  for (int i = 0; i < n; i++) sum_d += distance(city[route[i]], city[route[(i+1)%n]]);
+
+  free(ls.queue);
+  free(ls.in_queue);
+  free(sp.ids);
+  free(sp.order);
+  free(sp.region);
+  free(sp.next);
+  free(sp.prev);
+  free(sp.node);
+  free(sp.leaf);
+  return sum_d;
+}
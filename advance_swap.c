@@ -12,15 +12,18 @@
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
 #include <time.h>
+#include <stdint.h>
 
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
+// 乱数、都市ファイル、距離テーブル、候補リスト、ランダムな初期解、焼きなましは共通のヘッダにある
+#include "tsp_rng.h"
+#include "tsp_city.h"
+#include "tsp_dist.h"
+#include "tsp_init.h"
+#include "tsp_sa.h"
 
 // 描画用
+// 都市の座標が地図 (70x40) に収まらないときは縮小して描く
+#define PLOT_LABEL_MAX 1000 // これより都市が多いときは番号を描かない
 typedef struct
 {
   int width;
@@ -33,27 +36,19 @@ typedef struct {
   double dist;
 } Answer;
 
-// 整数最大値をとる関数
-int max(const int a, const int b)
-{
-  return (a > b) ? a : b;
-}
-
 // プロトタイプ宣言
 // draw_line: 町の間を線で結ぶ
 // draw_route: routeでの巡回順を元に移動経路を線で結ぶ
 // plot_cities: 描画する
-// distance: 2地点間の距離を計算
 // solve(): TSPをといて距離を返す/ 引数route に巡回順を格納
 
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
-double solve(const City *city, int n, int *route);
+City *fit_to_map(Map map, City *city, int n);
+double solve(const City *city, const DistTable *dt, int n, int *route);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
 
 Map init_map(const int width, const int height)
 {
@@ -69,30 +64,11 @@ void free_map_dot(Map m)
   free(m.dot);
 }
 
-City *load_cities(const char *filename, int *n)
-{
-  City *city;
-  FILE *fp;
-  if ((fp=fopen(filename,"rb")) == NULL){
-    fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
-  }
-  fread(n,sizeof(int),1,fp);
-  city = (City*)malloc(sizeof(City) * *n);
-  for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
-    //printf("(x, y) = (%d, %d)\n", city[i].x, city[i].y);
-  }
-  fclose(fp);
-  return city;
-}
 int main(int argc, char**argv)
 {
   // const による定数定義
   const int width = 70;
   const int height = 40;
-  const int max_cities = 100;
 
   Map map = init_map(width, height);
   
@@ -101,20 +77,24 @@ int main(int argc, char**argv)
     fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
     exit(1);
   }
-  int n;
-  City *city = load_cities(argv[1],&n);
-  assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
+  CityFile cf = load_cities(argv[1]);
+  const int n = cf.n;
+  City *city = cf.city;
+  assert( n > 1 );
+
+  // 距離は先にまとめて計算しておく
+  DistTable dt = init_dist_table(city, n, choose_dist_mode(n));
 
   // 町の初期配置を表示
   plot_cities(fp, map, city, n, NULL);
-  sleep(1);
+  if (n <= PLOT_LABEL_MAX) sleep(1);
 
   // 訪れる順序を記録する配列を設定
   int *route = (int*)calloc(n, sizeof(int));
   // 訪れた町を記録するフラグ
   //int *visited = (int*)calloc(n, sizeof(int));
 
-  const double d = solve(city,n,route);
+  const double d = solve(city,&dt,n,route);
   plot_cities(fp, map, city, n, route);
   printf("total distance = %f\n", d);
   for (int i = 0 ; i < n ; i++){
@@ -125,7 +105,8 @@ int main(int argc, char**argv)
   // 動的確保した環境ではfreeをする
   free(route);
   //free(visited);
-  free(city);
+  free_dist_table(dt);
+  unload_cities(cf);
   
   return 0;
 }
@@ -152,24 +133,51 @@ void draw_route(Map map, City *city, int n, const int *route)
   }
 }
 
+// 地図に収まらない座標の場合は、全体が収まるように縮小した座標を作る (収まるならそのまま返す)
+// 番号の文字列の分だけ右側に余白をとる
+City *fit_to_map(Map map, City *city, int n)
+{
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < minx) minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < miny) miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  if (minx >= 0 && maxx < map.width - 5 && miny >= 0 && maxy < map.height) return city;
+
+  City *pt = (City*)malloc(sizeof(City) * n);
+  const double sx = (map.width - 6) / fmax(1.0, (double)maxx - minx);
+  const double sy = (map.height - 1) / fmax(1.0, (double)maxy - miny);
+  for (int i = 0; i < n; i++) {
+    pt[i].x = (int)(((double)city[i].x - minx) * sx);
+    pt[i].y = (int)(((double)city[i].y - miny) * sy);
+  }
+  return pt;
+}
+
 void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
 {
   fprintf(fp, "----------\n");
 
   memset(map.dot[0], ' ', map.width * map.height); 
+  City *pt = fit_to_map(map, city, n);
 
-  // 町のみ番号付きでプロットする
+  // 町のみ番号付きでプロットする (多すぎるときは番号を省いて点だけ)
   for (int i = 0; i < n; i++) {
     char buf[100];
-    sprintf(buf, "C_%d", i);
-    for (int j = 0; j < strlen(buf); j++) {
-      const int x = city[i].x + j;
-      const int y = city[i].y;
+    if (n <= PLOT_LABEL_MAX) sprintf(buf, "C_%d", i);
+    else strcpy(buf, "o");
+    const size_t len = strlen(buf);
+    for (size_t j = 0; j < len && pt[i].x + (int)j < map.width; j++) {
+      const int x = pt[i].x + (int)j;
+      const int y = pt[i].y;
       map.dot[x][y] = buf[j];
     }
   }
 
-  draw_route(map, city, n, route);
+  draw_route(map, pt, n, route);
+  if (pt != city) free(pt);
 
   for (int y = 0; y < map.height; y++) {
     for (int x = 0; x < map.width; x++) {
@@ -181,94 +189,28 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
-{
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
-}
-
-void gen_random_route(int n, int *route) {
-
-  // 初期化
-  for (int i = 0 ; i < n ; i++){
-    route[i] = i;
-  }
-
-  // n回シャッフル
-  for (int i=0; i<n; i++) {
-    int j1 = rand() % (n-1) + 1;
-    int j2 = rand() % (n-1) + 1;
-    int temp = route[j1];
-    route[j1] = route[j2];
-    route[j2] = temp;
-  }
-
-}
-
-void swap(int *a, int *b) {
-  int temp = *a;
-  *a = *b;
-  *b = temp;
-}
-
-double dist(const City *city, int *route, int i, int j) {
-  return distance(city[route[i]], city[route[j]]);
-}
-
-Answer calc(const City *city, int n) {
-  int route[n];
-  gen_random_route(n, route);
-
-  double co = -1e-6; //最大化なら正、最小化なら負。絶対値が小さいほど悪化方向へ進みやすい。Tが大きいほど小さくできる。
-  int T = 1e6;
-
-  for (int t=0; t<T; t++) {
-
-    int i = rand() % (n-1) + 1;
-    int j = rand() % (n-1) + 1;
-
-    // 2点スワップ
-
-    double diff = 0;
-    diff -= dist(city, route, i, (i+n-1)%n);
-    diff -= dist(city, route, i, (i+1)%n);
-    diff -= dist(city, route, j, (j+n-1)%n);
-    diff -= dist(city, route, j, (j+1)%n);
-    swap(&route[i], &route[j]);
-    diff += dist(city, route, i, (i+n-1)%n);
-    diff += dist(city, route, i, (i+1)%n);
-    diff += dist(city, route, j, (j+n-1)%n);
-    diff += dist(city, route, j, (j+1)%n);
-
-    if ((rand() / (double)RAND_MAX) > exp(co * diff * t)) { // 大きく悪化した場合
-      swap(&route[i], &route[j]); // 元に戻す
-    }
-
-  }
-
-  double sum_d = 0;
-  for (int i = 0 ; i < n ; i++){
-    const int c0 = route[i];
-    const int c1 = route[(i+1)%n]; // nは0に戻る
-    sum_d += distance(city[c0],city[c1]);
-  }
-
-  //printf("sum:%lf\n", sum_d);
+// 焼きなまし自体は tsp_sa.h の sa_swap_calc()
+Answer calc(const City *city, const DistTable *dt, int n, Rng *rng) {
+  // 都市数が多くてもスタックがあふれないようにヒープに確保する
+  int *route = (int*)calloc(n, sizeof(int));
+  gen_random_route(n, route, rng);
 
-  int *ans_route = (int*)calloc(n, sizeof(int));
-  memcpy(ans_route, route, sizeof(int) * n);
-  return (Answer){.dist = sum_d, .route = ans_route};
+  // 反復回数は都市数が多いときは増やす
+  const int T = max(1e6, 20 * n);
+  const double sum_d = sa_swap_calc(city, dt, n, route, rng, T, 0, NULL);
+  return (Answer){.dist = sum_d, .route = route};
 }
 
-double solve(const City *city, int n, int *route)
+double solve(const City *city, const DistTable *dt, int n, int *route)
 {
 
-  srand((unsigned)time(NULL));
+  init_exp_table();
+  Rng rng = rng_init((uint64_t)time(NULL));
   Answer ans = (Answer){.dist = 1e15};
-  int times = 10;
+  int times = (n < 10000) ? 10 : 1; // 都市数が多いときは1回を長くする
   for (int i=0; i<times; i++) {
-    Answer result = calc(city, n);
+    Answer result = calc(city, dt, n, &rng);
+    rng_jump(&rng); // 次の初期解は別の乱数列で
     //printf("d:%lf\n", result.dist);
     if (result.dist < ans.dist) {
       free(ans.route);
@@ -0,0 +1,343 @@
+/*
+
+  ベンチマーク
+  山登り法 (tsp1.c)、焼きなまし + 2点スワップ (advance_swap.c)、焼きなまし + 2-opt (advance.c) を
+  同じ条件 (都市ファイル、乱数の種、反復回数・時間制限、スレッド数) で動かし、
+  実行時間・CPU時間・試した移動の回数・最終的な距離・最良既知値との差を CSV か JSON で出力する。
+  tsp1_experiment.c のように結果を手で集計しなくてよいようにする。
+  探索は各プログラムと同じ関数 (tsp_hc.h の hc_calc()、tsp_sa.h の sa_swap_calc() と sa_calc()) を呼ぶ。
+  試した移動の回数は、それらが差分を計算した回数
+
+  使い方: bench [-s hc,swap-sa,2opt-sa] [-S 1,2,3] [-r restarts] [-i iters] [-t seconds]
+                [-j threads] [-I init] [-f csv|json] [-o file] [-k best_known.txt] <city file>...
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+
+// 乱数、都市ファイル、距離テーブル、候補リスト、初期解と、計測する探索そのものは共通のヘッダにある
+#include "tsp_rng.h"
+#include "tsp_city.h"
+#include "tsp_dist.h"
+#include "tsp_init.h"
+#include "tsp_hc.h"
+#include "tsp_sa.h"
+
+// 解法が共通で使う問題のデータ
+typedef struct {
+  const City *city;
+  const DistTable *dt;
+  const Cand *cand; // 8都市より少ないときは NULL
+  int n;
+  int iters;        // 焼きなまし1回あたりの反復回数
+  int init;         // 初期解の作り方
+  double nn;        // 最近傍の都市までの平均距離 (初期解を作ったときの開始温度の目安)
+} Problem;
+
+// 近傍はそれぞれのプログラムの既定 (tsp1.c は swap,oropt,3opt、advance.c は 2opt)
+#define HC_MOVES ((1 << HC_MOVE_SWAP) | (1 << HC_MOVE_OROPT) | (1 << HC_MOVE_3OPT))
+#define SA_MOVES (1 << SA_MOVE_2OPT)
+
+// 区間を移さない探索 (焼きなまし) の候補リスト。advance.c と同じく、都市数が少なければ使わない
+static const Cand *sa_cand(const Problem *p)
+{
+  return (p->n >= CAND_MIN_CITIES) ? p->cand : NULL;
+}
+
+// 焼きなましの開始時刻。初期解を作ったときは高温の部分を飛ばす (advance.c の calc と同じ)
+int sa_start(const Problem *p)
+{
+  return (p->init == INIT_RANDOM) ? 0 : sa_t0(p->iters, p->nn);
+}
+
+// 山登り法 (tsp1.c の calc)
+double calc_hc(const Problem *p, int *route, Rng *rng, long *moves)
+{
+  build_route(p->init, p->city, p->cand, p->n, route, rng);
+  return hc_calc(p->city, p->dt, p->cand, p->n, HC_MOVES, route, moves);
+}
+
+// 焼きなまし法 + 2点スワップ (advance_swap.c の calc)
+double calc_swap_sa(const Problem *p, int *route, Rng *rng, long *moves)
+{
+  build_route(p->init, p->city, sa_cand(p), p->n, route, rng);
+  return sa_swap_calc(p->city, p->dt, p->n, route, rng, p->iters, sa_start(p), moves);
+}
+
+// 焼きなまし法 + 2-opt法 (advance.c の calc)
+double calc_2opt_sa(const Problem *p, int *route, Rng *rng, long *moves)
+{
+  const Cand *cand = sa_cand(p);
+  build_route(p->init, p->city, cand, p->n, route, rng);
+  const int t0 = sa_start(p);
+  return sa_calc(p->city, p->dt, cand, p->n, SA_MOVES, route, rng, p->iters, -1.0 / p->iters, t0, t0, NULL, NULL, moves);
+}
+
+typedef double (*CalcFunc)(const Problem *p, int *route, Rng *rng, long *moves);
+
+typedef struct {
+  const char *name;
+  CalcFunc calc;
+  int restarts; // 初期解の個数の既定値
+} Solver;
+
+static const Solver solvers[] = {
+  {"hc", calc_hc, 5000},
+  {"swap-sa", calc_swap_sa, 10},
+  {"2opt-sa", calc_2opt_sa, 10},
+};
+#define NUM_SOLVERS ((int)(sizeof(solvers) / sizeof(solvers[0])))
+
+// ここから計測
+double wall_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+  const Problem *p;
+  const Solver *solver;
+  int restarts;
+  uint64_t seed;
+  double deadline;        // これを過ぎたら新しい初期解を始めない (0なら制限なし)
+  atomic_int *next;
+  double best;
+  int *best_route;
+  int best_id;
+  long moves;
+  int done;               // 実際に解いた初期解の数
+} BenchWorker;
+
+void *bench_worker(void *arg)
+{
+  BenchWorker *w = (BenchWorker*)arg;
+  int *route = (int*)malloc(sizeof(int) * w->p->n);
+  int id;
+  while ((id = atomic_fetch_add(w->next, 1)) < w->restarts) {
+    if (w->deadline > 0 && wall_time() > w->deadline) break;
+    // 初期解の番号ごとに乱数を作るので、スレッド数によらず同じ結果になる
+    Rng rng = rng_init(w->seed ^ ((uint64_t)id * 0xd1342543de82ef95ULL));
+    const double d = w->solver->calc(w->p, route, &rng, &w->moves);
+    w->done++;
+    if (d < w->best || (d == w->best && id < w->best_id)) {
+      w->best = d;
+      w->best_id = id;
+      memcpy(w->best_route, route, sizeof(int) * w->p->n);
+    }
+  }
+  free(route);
+  return NULL;
+}
+
+typedef struct {
+  double wall, cpu;
+  long moves;
+  int done;
+  double dist;
+} BenchResult;
+
+BenchResult run_bench(const Problem *p, const Solver *solver, int restarts, uint64_t seed,
+                      double time_limit, int nthreads)
+{
+  atomic_int next = 0;
+  const double start = wall_time();
+  const clock_t cpu_start = clock();
+  pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+  BenchWorker *w = (BenchWorker*)malloc(sizeof(BenchWorker) * nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    w[t] = (BenchWorker){.p = p, .solver = solver, .restarts = restarts, .seed = seed,
+                         .deadline = (time_limit > 0) ? start + time_limit : 0, .next = &next,
+                         .best = 1e300, .best_route = (int*)malloc(sizeof(int) * p->n),
+                         .best_id = INT32_MAX, .moves = 0, .done = 0};
+    pthread_create(&th[t], NULL, bench_worker, &w[t]);
+  }
+  BenchResult res = {.dist = 1e300};
+  int best_id = INT32_MAX;
+  for (int t = 0; t < nthreads; t++) {
+    pthread_join(th[t], NULL);
+    res.moves += w[t].moves;
+    res.done += w[t].done;
+    if (w[t].best < res.dist || (w[t].best == res.dist && w[t].best_id < best_id)) {
+      res.dist = w[t].best;
+      best_id = w[t].best_id;
+    }
+    free(w[t].best_route);
+  }
+  res.wall = wall_time() - start;
+  res.cpu = (double)(clock() - cpu_start) / CLOCKS_PER_SEC;
+  free(th);
+  free(w);
+  return res;
+}
+
+// パスのファイル名の部分 ("data/city20.dat" なら "city20.dat")
+static const char *path_base(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  return (slash != NULL) ? slash + 1 : path;
+}
+
+// 最良既知値のファイル ("<都市ファイル> <距離>" の行の並び) から値を探す。なければ警告して 0
+// 都市ファイルはディレクトリを除いた名前で照合する
+double load_best_known(const char *filename, const char *instance)
+{
+  if (filename == NULL) return 0;
+  FILE *fp;
+  if ((fp = fopen(filename, "r")) == NULL) {
+    fprintf(stderr, "%s: cannot open file.\n", filename);
+    exit(1);
+  }
+  char line[1024], name[1024];
+  double value, found = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%1023s %lf", name, &value) == 2 && strcmp(path_base(name), path_base(instance)) == 0) found = value;
+  }
+  fclose(fp);
+  if (found == 0) fprintf(stderr, "%s: no best known value for %s.\n", filename, path_base(instance));
+  return found;
+}
+
+// "1,2,3" のようなカンマ区切りを読む
+int parse_list(const char *arg, uint64_t *out, int max_count)
+{
+  int count = 0;
+  const char *p = arg;
+  while (*p != '\0' && count < max_count) {
+    char *e;
+    out[count++] = strtoull(p, &e, 10);
+    if (e == p) break;
+    p = (*e == ',') ? e + 1 : e;
+  }
+  return count;
+}
+
+void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options] <city file>...\n"
+          "  -s <solvers>   hc,swap-sa,2opt-sa のカンマ区切り (既定: すべて)\n"
+          "  -S <seeds>     乱数の種のカンマ区切り (既定: 1)\n"
+          "  -r <restarts>  初期解の個数 (既定: hc 5000, 焼きなまし 10)\n"
+          "  -i <iters>     焼きなまし1回あたりの反復回数 (既定: 1000000)\n"
+          "  -t <seconds>   時間制限。過ぎたら新しい初期解を始めない (既定: なし)\n"
+          "  -j <threads>   スレッド数 (既定: 1)\n"
+          "  -I <init>      初期解の作り方 random|nn|greedy|sfc|christofides (既定: greedy)\n"
+          "  -f csv|json    出力形式 (既定: csv。json は1行に1つのオブジェクト)\n"
+          "  -o <file>      出力先 (既定: 標準出力)\n"
+          "  -k <file>      最良既知値のファイル\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  char solver_arg[256] = "hc,swap-sa,2opt-sa";
+  uint64_t seeds[64] = {1};
+  int nseeds = 1;
+  int restarts = 0, iters = 1e6, nthreads = 1, json = 0, init = INIT_GREEDY;
+  double time_limit = 0;
+  const char *out_file = NULL, *known_file = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:S:r:i:t:j:I:f:o:k:")) != -1) {
+    switch (opt) {
+    case 's': snprintf(solver_arg, sizeof(solver_arg), "%s", optarg); break;
+    case 'S': nseeds = parse_list(optarg, seeds, 64); break;
+    case 'r': restarts = atoi(optarg); break;
+    case 'i': iters = atoi(optarg); break;
+    case 't': time_limit = atof(optarg); break;
+    case 'j': nthreads = atoi(optarg); break;
+    case 'I':
+      if ((init = parse_init(optarg)) < 0) {
+        fprintf(stderr, "%s: unknown initial tour.\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'f': json = (strcmp(optarg, "json") == 0); break;
+    case 'o': out_file = optarg; break;
+    case 'k': known_file = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc || nseeds < 1 || nthreads < 1 || iters < 1) usage(argv[0]);
+
+  // 解法の選択
+  const Solver *selected[NUM_SOLVERS];
+  int nsel = 0;
+  for (char *tok = strtok(solver_arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    int found = 0;
+    for (int k = 0; k < NUM_SOLVERS; k++) {
+      if (strcmp(tok, solvers[k].name) == 0 && nsel < NUM_SOLVERS) {
+        selected[nsel++] = &solvers[k];
+        found = 1;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "%s: unknown solver.\n", tok);
+      exit(1);
+    }
+  }
+
+  FILE *out = stdout;
+  if (out_file != NULL && (out = fopen(out_file, "w")) == NULL) {
+    fprintf(stderr, "%s: cannot open file.\n", out_file);
+    exit(1);
+  }
+  if (!json)
+    fprintf(out, "solver,init,instance,n,seed,threads,restarts,iters,wall_s,cpu_s,moves,moves_per_s,distance,best_known,gap\n");
+
+  init_exp_table();
+  simd_init();
+  for (int f = optind; f < argc; f++) {
+    CityFile cf = load_cities(argv[f]);
+    const int n = cf.n;
+    City *city = cf.city;
+    DistTable dt = init_dist_table(city, n, choose_dist_mode(n));
+    // 候補リストは tsp1.c と同じく、区間を移す近傍のために少ない都市数 (8都市以上) でも作る
+    Cand cand = {.k = 0, .nb = NULL};
+    if (n >= 8) cand = build_candidates(city, n, CAND_K);
+    const Problem p = {.city = city, .dt = &dt, .cand = (cand.nb != NULL) ? &cand : NULL, .n = n, .iters = iters,
+                       .init = init, .nn = mean_nn_dist(&dt, (cand.nb != NULL) ? &cand : NULL, n)};
+    const double known = load_best_known(known_file, argv[f]);
+
+    for (int s = 0; s < nsel; s++) {
+      for (int k = 0; k < nseeds; k++) {
+        const int r = (restarts > 0) ? restarts : selected[s]->restarts;
+        const BenchResult res = run_bench(&p, selected[s], r, seeds[k], time_limit, nthreads);
+        const double mps = (res.wall > 0) ? res.moves / res.wall : 0;
+        const double gap = (known > 0) ? (res.dist - known) / known : 0;
+        const int it = (selected[s]->calc == calc_hc) ? 0 : iters;
+        if (json) {
+          fprintf(out, "{\"solver\":\"%s\",\"init\":\"%s\",\"instance\":\"%s\",\"n\":%d,\"seed\":%llu,\"threads\":%d,"
+                  "\"restarts\":%d,\"iters\":%d,\"wall_s\":%.6f,\"cpu_s\":%.6f,\"moves\":%ld,"
+                  "\"moves_per_s\":%.0f,\"distance\":%.6f,\"best_known\":%.6f,\"gap\":%.6f}\n",
+                  selected[s]->name, init_names[init], argv[f], n, (unsigned long long)seeds[k], nthreads, res.done, it,
+                  res.wall, res.cpu, res.moves, mps, res.dist, known, gap);
+        } else {
+          fprintf(out, "%s,%s,%s,%d,%llu,%d,%d,%d,%.6f,%.6f,%ld,%.0f,%.6f,%.6f,%.6f\n",
+                  selected[s]->name, init_names[init], argv[f], n, (unsigned long long)seeds[k], nthreads, res.done, it,
+                  res.wall, res.cpu, res.moves, mps, res.dist, known, gap);
+        }
+        fflush(out);
+      }
+    }
+
+    free_candidates(cand);
+    free_dist_table(dt);
+    unload_cities(cf);
+  }
+  if (out != stdout) fclose(out);
+  return 0;
+}
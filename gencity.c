@@ -1,11 +1,17 @@
 // generate a binary data for cities (TSP)
 // the first int means the number of cities
 // the following values are x_0, y_0, 
+// with int16|int32 as the last argument, a v2 file (header with magic,
+// version, coordinate width and checksum) is written instead
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // strerror()
 #include <errno.h> // errno, ERANGE
 #include <assert.h> // assert()
+#include <stdint.h>
+
+// 都市ファイル v2 のヘッダ CityHeader と city_checksum() は solver 側と共通
+#include "tsp_city.h"
 
 int load_int(const char *argvalue)
 {
@@ -25,25 +31,48 @@ int load_int(const char *argvalue)
 }
 
 
+// RAND_MAX が小さい環境でも広い範囲の座標を作れるように2回分つなげる
+long long rand_range(long long m)
+{
+  if (m <= RAND_MAX) return rand() % m; // 従来と同じ乱数列
+  long long r = ((long long)rand() << 31) | rand();
+  return r % m;
+}
+
 int main(int argc, char **argv)
 {
-  const int width = 70;
-  const int height = 40;
-  const int max_cities = 100;
+  // 既定は描画用の地図 (70x40) に収まる大きさ
+  int width = 70;
+  int height = 40;
 
-  if(argc != 4){
-    fprintf(stderr, "usage: %s <number of cities> <random seed> <outputfilename>\n",argv[0]);
+  int coord_bytes = 0; // 0 なら v1 形式で書く
+  if(argc != 4 && argc != 6 && argc != 7){
+    fprintf(stderr, "usage: %s <number of cities> <random seed> <outputfilename> [width height [int16|int32]]\n",argv[0]);
     return EXIT_FAILURE;
   }
   int nc = load_int(argv[1]);
-  assert( nc > 1 && nc <= max_cities);
+  assert( nc > 1 );
   int seed = load_int(argv[2]);
   srand(seed);
+  if (argc >= 6){
+    width = load_int(argv[4]);
+    height = load_int(argv[5]);
+  }
+  if (argc == 7){
+    if (strcmp(argv[6], "int16") == 0) coord_bytes = 2;
+    else if (strcmp(argv[6], "int32") == 0) coord_bytes = 4;
+    else {
+      fprintf(stderr, "%s: unknown coordinate type (int16|int32).\n",argv[6]);
+      return EXIT_FAILURE;
+    }
+  }
+  assert( width > 10 && height > 10 );
+  assert( coord_bytes != 2 || (width <= INT16_MAX && height <= INT16_MAX) );
 
-  int *data = (int*)malloc(sizeof(int)*2*nc);
+  int *data = (int*)malloc(sizeof(int)*2*(size_t)nc);
   for (int i = 0 ; i < nc ; i++){
-    data[2*i] = rand() % (width - 10) + 5;;
-    data[2*i+1] = rand() % (height - 10) + 5;;
+    data[2*i] = rand_range(width - 10) + 5;
+    data[2*i+1] = rand_range(height - 10) + 5;
   }
 
   FILE *fp;
@@ -51,9 +80,25 @@ int main(int argc, char **argv)
     fprintf(stderr, "%s: cannot open file.\n",argv[3]);
     return EXIT_FAILURE;
   }
-  fwrite(&nc,sizeof(int),1,fp);
-  fwrite(data,sizeof(int),2*nc,fp);
+  if (coord_bytes == 0){
+    fwrite(&nc,sizeof(int),1,fp);
+    fwrite(data,sizeof(int),2*(size_t)nc,fp);
+  } else {
+    const size_t body = (size_t)nc * 2 * coord_bytes;
+    void *buf = data;
+    if (coord_bytes == 2){
+      int16_t *c = (int16_t*)malloc(body);
+      for (size_t i = 0 ; i < 2*(size_t)nc ; i++) c[i] = (int16_t)data[i];
+      buf = c;
+    }
+    CityHeader h = {.magic = CITY_MAGIC, .version = CITY_VERSION, .coord_bytes = coord_bytes,
+                    .n = (uint32_t)nc, .reserved = 0, .checksum = city_checksum(buf, body)};
+    fwrite(&h,sizeof(h),1,fp);
+    fwrite(buf,1,body,fp);
+    if (buf != data) free(buf);
+  }
   fclose(fp);
+  free(data);
   
   return EXIT_SUCCESS;
 }
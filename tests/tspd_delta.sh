@@ -0,0 +1,31 @@
+#!/bin/sh
+# tspd -d (変更を当てて巡回路を直す) のテスト
+# 使い方: sh tests/tspd_delta.sh (リポジトリの一番上で実行する)
+set -e
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cc -O1 -g -fsanitize=address,undefined -o "$tmp/tspd" tspd.c -lm -lpthread
+
+seq 0 19 > "$tmp/tour.txt"
+fail=0
+
+# 正しい変更は通り、都市数が合う
+printf 'move 5 1 1\ndelete 7\ninsert 3 3\n' > "$tmp/ok.txt"
+if ! "$tmp/tspd" -d city20.dat "$tmp/tour.txt" "$tmp/ok.txt" > "$tmp/out.txt" 2> "$tmp/err.txt"; then
+  echo "FAIL: valid edits were rejected"; cat "$tmp/err.txt"; fail=1
+elif ! grep -q 'reoptimized 20 -> 20 cities' "$tmp/err.txt"; then
+  echo "FAIL: unexpected city count"; cat "$tmp/err.txt"; fail=1
+fi
+
+# 同じ都市を動かしてから消す / 消してから動かす / 2回動かすのはエラー (範囲外に書き込まない)
+for edits in 'move 5 1 1\ndelete 5\n' 'delete 5\nmove 5 1 1\n' 'move 5 1 1\nmove 5 2 2\n'; do
+  printf "$edits" > "$tmp/bad.txt"
+  if "$tmp/tspd" -d city20.dat "$tmp/tour.txt" "$tmp/bad.txt" > /dev/null 2> "$tmp/err.txt"; then
+    echo "FAIL: accepted $(tr '\n' ';' < "$tmp/bad.txt")"; fail=1
+  elif ! grep -q 'bad edit' "$tmp/err.txt"; then
+    echo "FAIL: $(tr '\n' ';' < "$tmp/bad.txt")"; cat "$tmp/err.txt"; fail=1
+  fi
+done
+
+[ $fail -eq 0 ] && echo "tspd_delta: ok"
+exit $fail
@@ -5,15 +5,14 @@
 #include <assert.h>
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
+#include <stdint.h>
 
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
+// 都市ファイルは共通のヘッダにある
+#include "tsp_city.h"
 
 // 描画用
+// 都市の座標が地図 (70x40) に収まらないときは縮小して描く
+#define PLOT_LABEL_MAX 1000 // これより都市が多いときは番号を描かない
 typedef struct
 {
   int width;
@@ -21,27 +20,19 @@ typedef struct
   char **dot;
 } Map;
 
-// 整数最大値をとる関数
-int max(const int a, const int b)
-{
-  return (a > b) ? a : b;
-}
-
 // プロトタイプ宣言
 // draw_line: 町の間を線で結ぶ
 // draw_route: routeでの巡回順を元に移動経路を線で結ぶ
 // plot_cities: 描画する
-// distance: 2地点間の距離を計算
 // solve(): TSPをといて距離を返す/ 引数route に巡回順を格納
 
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
+City *fit_to_map(Map map, City *city, int n);
 double solve(const City *city, int n, int *route, int *visited);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
 
 Map init_map(const int width, const int height)
 {
@@ -57,29 +48,11 @@ void free_map_dot(Map m)
   free(m.dot);
 }
 
-City *load_cities(const char *filename, int *n)
-{
-  City *city;
-  FILE *fp;
-  if ((fp=fopen(filename,"rb")) == NULL){
-    fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
-  }
-  fread(n,sizeof(int),1,fp);
-  city = (City*)malloc(sizeof(City) * *n);
-  for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
-  }
-  fclose(fp);
-  return city;
-}
 int main(int argc, char**argv)
 {
   // const による定数定義
   const int width = 70;
   const int height = 40;
-  const int max_cities = 100;
 
   Map map = init_map(width, height);
   
@@ -88,14 +61,14 @@ int main(int argc, char**argv)
     fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
     exit(1);
   }
-  int n;
-  assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
-
-  City *city = load_cities(argv[1],&n);
+  CityFile cf = load_cities(argv[1]);
+  const int n = cf.n;
+  City *city = cf.city;
+  assert( n > 1 );
 
   // 町の初期配置を表示
   plot_cities(fp, map, city, n, NULL);
-  sleep(1);
+  if (n <= PLOT_LABEL_MAX) sleep(1);
 
   // 訪れる順序を記録する配列を設定
   int *route = (int*)calloc(n, sizeof(int));
@@ -113,7 +86,7 @@ int main(int argc, char**argv)
   // 動的確保した環境ではfreeをする
   free(route);
   free(visited);
-  free(city);
+  unload_cities(cf);
   
   return 0;
 }
@@ -140,24 +113,51 @@ void draw_route(Map map, City *city, int n, const int *route)
   }
 }
 
+// 地図に収まらない座標の場合は、全体が収まるように縮小した座標を作る (収まるならそのまま返す)
+// 番号の文字列の分だけ右側に余白をとる
+City *fit_to_map(Map map, City *city, int n)
+{
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < minx) minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < miny) miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  if (minx >= 0 && maxx < map.width - 5 && miny >= 0 && maxy < map.height) return city;
+
+  City *pt = (City*)malloc(sizeof(City) * n);
+  const double sx = (map.width - 6) / fmax(1.0, (double)maxx - minx);
+  const double sy = (map.height - 1) / fmax(1.0, (double)maxy - miny);
+  for (int i = 0; i < n; i++) {
+    pt[i].x = (int)(((double)city[i].x - minx) * sx);
+    pt[i].y = (int)(((double)city[i].y - miny) * sy);
+  }
+  return pt;
+}
+
 void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
 {
   fprintf(fp, "----------\n");
 
   memset(map.dot[0], ' ', map.width * map.height); 
+  City *pt = fit_to_map(map, city, n);
 
-  // 町のみ番号付きでプロットする
+  // 町のみ番号付きでプロットする (多すぎるときは番号を省いて点だけ)
   for (int i = 0; i < n; i++) {
     char buf[100];
-    sprintf(buf, "C_%d", i);
-    for (int j = 0; j < strlen(buf); j++) {
-      const int x = city[i].x + j;
-      const int y = city[i].y;
+    if (n <= PLOT_LABEL_MAX) sprintf(buf, "C_%d", i);
+    else strcpy(buf, "o");
+    const size_t len = strlen(buf);
+    for (size_t j = 0; j < len && pt[i].x + (int)j < map.width; j++) {
+      const int x = pt[i].x + (int)j;
+      const int y = pt[i].y;
       map.dot[x][y] = buf[j];
     }
   }
 
-  draw_route(map, city, n, route);
+  draw_route(map, pt, n, route);
+  if (pt != city) free(pt);
 
   for (int y = 0; y < map.height; y++) {
     for (int x = 0; x < map.width; x++) {
@@ -169,13 +169,6 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
-{
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
-}
-
 double solve(const City *city, int n, int *route, int *visited)
 {
   // 以下はとりあえずダミー。ここに探索プログラムを実装する
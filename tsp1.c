@@ -1,6 +1,21 @@
 /*
 
   山登り法で5000個初期解を作って探索する。
+  初期解ごとの探索は独立なので、複数スレッドで分担する。
+  最後の引数で初期解の作り方 (random|nn|greedy|sfc|christofides) を選べる。既定は greedy
+  近傍 (swap|oropt|3opt をカンマ区切りで組み合わせる) も最後の引数で選べる。既定は swap,oropt,3opt
+
+  終わりに Held-Karp の下界 (1-木 + 劣勾配法) と、それに対する差 gap = (巡回路 - 下界) / 下界 を表示する。
+  -g を指定すると、gap がその値 (0.01 なら 1%) 以下の巡回路が見つかった時点で新しい初期解を作るのをやめる
+
+  初期解の数は最大 5000 個だが、最良解に何度も同じ長さでたどり着くようになったら、信頼度 -p (既定 0.99) で
+  それ以上探しても良くならないと判断して止める (-p 0 で止めない)。-t で制限時間 (秒) も付けられる。
+  判定は初期解の番号の順に行うので、時間切れでなければスレッド数によらず同じ結果になる
+
+  -DDIST_NINT でコンパイルすると、距離を TSPLIB (EUC_2D) と同じく四捨五入した整数にして、差分を整数で正確に比べる。
+  表示する長さや下界もその距離で測ったものになる (既定は実数のユークリッド距離)
+
+  使い方: tsp1 [-g gap] [-p confidence] [-t seconds] <city file> [threads] [seed] [init] [moves]
 
 */
 
@@ -12,15 +27,22 @@
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
 #include <time.h>
-
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// 乱数、都市ファイル、距離テーブル、候補リスト、初期解、下界、打ち切り判定、山登りの探索は共通のヘッダにある
+#include "tsp_rng.h"
+#include "tsp_city.h"
+#include "tsp_dist.h"
+#include "tsp_init.h"
+#include "tsp_bound.h"
+#include "tsp_stop.h"
+#include "tsp_hc.h"
 
 // 描画用
+// 都市の座標が地図 (70x40) に収まらないときは縮小して描く
+#define PLOT_LABEL_MAX 1000 // これより都市が多いときは番号を描かない
 typedef struct
 {
   int width;
@@ -33,27 +55,21 @@ typedef struct {
   double dist;
 } Answer;
 
-// 整数最大値をとる関数
-int max(const int a, const int b)
-{
-  return (a > b) ? a : b;
-}
-
 // プロトタイプ宣言
 // draw_line: 町の間を線で結ぶ
 // draw_route: routeでの巡回順を元に移動経路を線で結ぶ
 // plot_cities: 描画する
-// distance: 2地点間の距離を計算
 // solve(): TSPをといて距離を返す/ 引数route に巡回順を格納
 
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
-double solve(const City *city, int n, int *route);
+City *fit_to_map(Map map, City *city, int n);
+double solve(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nthreads, uint64_t seed, int init, int moves,
+             StopRule *stop);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
+int parse_moves(const char *s);
 
 Map init_map(const int width, const int height)
 {
@@ -69,63 +85,115 @@ void free_map_dot(Map m)
   free(m.dot);
 }
 
-City *load_cities(const char *filename, int *n)
-{
-  City *city;
-  FILE *fp;
-  if ((fp=fopen(filename,"rb")) == NULL){
-    fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
-  }
-  fread(n,sizeof(int),1,fp);
-  city = (City*)malloc(sizeof(City) * *n);
-  for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
-    //printf("(x, y) = (%d, %d)\n", city[i].x, city[i].y);
-  }
-  fclose(fp);
-  return city;
-}
 int main(int argc, char**argv)
 {
   // const による定数定義
   const int width = 70;
   const int height = 40;
-  const int max_cities = 100;
 
   Map map = init_map(width, height);
   
   FILE *fp = stdout; // とりあえず描画先は標準出力としておく
-  if (argc != 2){
-    fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
+  // 下界との差がこれ以下になったら止める (負なら止めない)
+  double target_gap = -1;
+  // 打ち切りの信頼度 (0 なら初期解を全部作る) と制限時間 (秒)
+  double confidence = STOP_CONFIDENCE, deadline = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "g:p:t:")) != -1) {
+    if (opt == 'g') target_gap = atof(optarg);
+    else if (opt == 'p') confidence = atof(optarg);
+    else if (opt == 't') deadline = atof(optarg);
+    else argc = 0; // 使い方を表示して終わる
+  }
+  if (argc > 0) {
+    argv[optind - 1] = argv[0];
+    argv += optind - 1;
+    argc -= optind - 1;
+  }
+  if (argc < 2 || argc > 6){
+    fprintf(stderr, "Usage: %s [-g gap] [-p confidence] [-t seconds] <city file> [threads] [seed] [random|nn|greedy|sfc|christofides] [swap,oropt,3opt]\n", argv[0]);
     exit(1);
   }
-  int n;
-  City *city = load_cities(argv[1],&n);
-  assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
+  // 最後の引数が初期解の作り方や近傍の名前なら取り出す (順番はどちらでもよい)
+  int init = INIT_GREEDY;
+  int moves = (1 << HC_MOVE_SWAP) | (1 << HC_MOVE_OROPT) | (1 << HC_MOVE_3OPT);
+  while (argc >= 3) {
+    if (parse_init(argv[argc-1]) >= 0) init = parse_init(argv[--argc]);
+    else if (parse_moves(argv[argc-1]) > 0) moves = parse_moves(argv[--argc]);
+    else break;
+  }
+  if (argc > 4){
+    fprintf(stderr, "%s: unknown init or moves.\n", argv[argc-1]);
+    exit(1);
+  }
+  int nthreads = (argc >= 3) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 1) nthreads = 1;
+  const uint64_t seed = (argc >= 4) ? strtoull(argv[3], NULL, 10) : (uint64_t)time(NULL);
+  CityFile cf = load_cities(argv[1]);
+  const int n = cf.n;
+  City *city = cf.city;
+  assert( n > 1 );
+#ifdef DIST_NINT
+  // 一番離れた2都市の距離も int32 に収まらないといけない
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    minx = min(minx, city[i].x);
+    maxx = max(maxx, city[i].x);
+    miny = min(miny, city[i].y);
+    maxy = max(maxy, city[i].y);
+  }
+  if (hypot((double)maxx - minx, (double)maxy - miny) >= INT32_MAX) {
+    fprintf(stderr, "%s: cities are too far apart for integer distances.\n", argv[1]);
+    exit(1);
+  }
+#endif
 
-  // 町の初期配置を表示
-  plot_cities(fp, map, city, n, NULL);
-  sleep(1);
+  // 距離は先にまとめて計算しておく
+  DistTable dt = init_dist_table(city, n, choose_dist_mode(n));
+  // 都市数が多いか、区間を移す近傍を使うなら候補リストも作る
+  Cand cand = {.k = 0, .nb = NULL};
+  if (n >= CAND_MIN_CITIES || (moves != (1 << HC_MOVE_SWAP) && n >= 8)) cand = build_candidates(city, n, CAND_K);
+  // 差分をまとめて計算する関数を CPU に合わせて選ぶ
+  simd_init();
 
   // 訪れる順序を記録する配列を設定
   int *route = (int*)calloc(n, sizeof(int));
   // 訪れた町を記録するフラグ
   //int *visited = (int*)calloc(n, sizeof(int));
 
-  const double d = solve(city,n,route);
+  // Held-Karp の下界。歩幅の目安には貪欲法の巡回路の長さを使う
+  double bound = 0;
+  if (n <= HK_EXACT_MAX) {
+    Rng rng = rng_init(seed);
+    build_route(INIT_GREEDY, city, (cand.nb != NULL) ? &cand : NULL, n, route, &rng);
+    double ub = 0;
+    for (int i = 0; i < n; i++) ub += city_dist(city[route[i]], city[route[(i+1)%n]]);
+    bound = held_karp_bound(city, &dt, (cand.nb != NULL) ? &cand : NULL, n, ub);
+  }
+  const double stop_at = (bound > 0 && target_gap >= 0) ? bound * (1 + target_gap) : 0;
+
+  // 町の初期配置を表示
+  plot_cities(fp, map, city, n, NULL);
+  if (n <= PLOT_LABEL_MAX) sleep(1);
+
+  StopRule stop = stop_init(confidence, deadline, stop_at); // 時間は表示の待ちの後から測る
+  const double d = solve(city,&dt,(cand.nb != NULL) ? &cand : NULL,n,route,nthreads,seed,init,moves,&stop);
+  fprintf(stderr, "%d restarts (%s)\n", stop.restarts, stop.reason ? stop.reason : "all");
   plot_cities(fp, map, city, n, route);
   printf("total distance = %f\n", d);
   for (int i = 0 ; i < n ; i++){
     printf("%d -> ", route[i]);
   }
   printf("0\n");
+  if (bound > 0) printf("lower bound = %f, gap = %.3f%%\n", bound, 100 * (d - bound) / bound);
+  else fprintf(stderr, "no lower bound (more than %d cities)\n", HK_EXACT_MAX);
 
   // 動的確保した環境ではfreeをする
   free(route);
   //free(visited);
-  free(city);
+  free_dist_table(dt);
+  free_candidates(cand);
+  unload_cities(cf);
   
   return 0;
 }
@@ -152,24 +220,51 @@ void draw_route(Map map, City *city, int n, const int *route)
   }
 }
 
+// 地図に収まらない座標の場合は、全体が収まるように縮小した座標を作る (収まるならそのまま返す)
+// 番号の文字列の分だけ右側に余白をとる
+City *fit_to_map(Map map, City *city, int n)
+{
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < minx) minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < miny) miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  if (minx >= 0 && maxx < map.width - 5 && miny >= 0 && maxy < map.height) return city;
+
+  City *pt = (City*)malloc(sizeof(City) * n);
+  const double sx = (map.width - 6) / fmax(1.0, (double)maxx - minx);
+  const double sy = (map.height - 1) / fmax(1.0, (double)maxy - miny);
+  for (int i = 0; i < n; i++) {
+    pt[i].x = (int)(((double)city[i].x - minx) * sx);
+    pt[i].y = (int)(((double)city[i].y - miny) * sy);
+  }
+  return pt;
+}
+
 void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
 {
   fprintf(fp, "----------\n");
 
   memset(map.dot[0], ' ', map.width * map.height); 
+  City *pt = fit_to_map(map, city, n);
 
-  // 町のみ番号付きでプロットする
+  // 町のみ番号付きでプロットする (多すぎるときは番号を省いて点だけ)
   for (int i = 0; i < n; i++) {
     char buf[100];
-    sprintf(buf, "C_%d", i);
-    for (int j = 0; j < strlen(buf); j++) {
-      const int x = city[i].x + j;
-      const int y = city[i].y;
+    if (n <= PLOT_LABEL_MAX) sprintf(buf, "C_%d", i);
+    else strcpy(buf, "o");
+    const size_t len = strlen(buf);
+    for (size_t j = 0; j < len && pt[i].x + (int)j < map.width; j++) {
+      const int x = pt[i].x + (int)j;
+      const int y = pt[i].y;
       map.dot[x][y] = buf[j];
     }
   }
 
-  draw_route(map, city, n, route);
+  draw_route(map, pt, n, route);
+  if (pt != city) free(pt);
 
   for (int y = 0; y < map.height; y++) {
     for (int x = 0; x < map.width; x++) {
@@ -181,120 +276,137 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
+// 名前 (カンマ区切り) から近傍の組み合わせを読む。知らない名前があれば -1
+int parse_moves(const char *s)
 {
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
-}
-
-void gen_random_route(int n, int *route) {
-
-  // 初期化
-  for (int i = 0 ; i < n ; i++){
-    route[i] = i;
-  }
-
-  // n回シャッフル
-  for (int i=0; i<n; i++) {
-    int j1 = rand() % (n-1) + 1;
-    int j2 = rand() % (n-1) + 1;
-    int temp = route[j1];
-    route[j1] = route[j2];
-    route[j2] = temp;
+  int mask = 0;
+  while (*s != '\0') {
+    const char *e = strchr(s, ',');
+    const size_t len = (e != NULL) ? (size_t)(e - s) : strlen(s);
+    int found = 0;
+    for (int k = 0; k < HC_MOVE_COUNT; k++) {
+      if (strlen(hc_move_names[k]) == len && strncmp(s, hc_move_names[k], len) == 0) {
+        mask |= 1 << k;
+        found = 1;
+      }
+    }
+    if (!found) return -1;
+    s += len;
+    if (*s == ',') s++;
   }
-
+  return mask;
 }
 
-void swap(int *a, int *b) {
-  int temp = *a;
-  *a = *b;
-  *b = temp;
+// 探索自体は tsp_hc.h の hc_calc()
+Answer calc(const City *city, const DistTable *dt, const Cand *cand, int n, int init, int moves, Rng *rng) {
+  // 都市数が多くてもスタックがあふれないようにヒープに確保する
+  int *route = (int*)calloc(n, sizeof(int));
+  build_route(init, city, cand, n, route, rng);
+  const double sum_d = hc_calc(city, dt, cand, n, moves, route, NULL);
+  return (Answer){.dist = sum_d, .route = route};
 }
 
-double dist(const City *city, int *route, int i, int j) {
-  return distance(city[route[i]], city[route[j]]);
+// 結果の比較。初期解 ia の長さ a の方が、初期解 ib の長さ b より良ければ 1
+// 同じ距離なら番号の小さい方を選ぶので、スレッド数によらず同じ結果になる。
+static inline int answer_better(double a, int ia, double b, int ib)
+{
+  return a < b || (a == b && ia < ib);
 }
 
-Answer calc(const City *city, int n) {
-  int route[n];
-  gen_random_route(n, route);
-
-  int count = 0;
-  while (1) {
-    count++;
-
-    int swap_i = -1, swap_j = -1;
-    double min_diff = 0;
-
-    for (int i=1; i<n; i++) {
-      for (int j=i+1; j<n; j++) {
-
-        if (city[route[i]].x == city[route[j]].x && city[route[i]].y == city[route[j]].y)
-          continue;
-
-        // 実際に入れ替えて距離がどれだけ変わるかを計算する
-        // 変わるのは入れ替えた部分周辺のみなので、そこだけで差をとれば十分
-        double diff = 0;
-        diff -= dist(city, route, i, (i+n-1)%n);
-        diff -= dist(city, route, i, (i+1)%n);
-        diff -= dist(city, route, j, (j+n-1)%n);
-        diff -= dist(city, route, j, (j+1)%n);
-        swap(&route[i], &route[j]);
-        diff += dist(city, route, i, (i+n-1)%n);
-        diff += dist(city, route, i, (i+1)%n);
-        diff += dist(city, route, j, (j+n-1)%n);
-        diff += dist(city, route, j, (j+1)%n);
-
-        // 入れ替えて距離が短くなったら
-        // ただし同じ位置に都市があり変化しない場合は0ではなく-1e16くらいになるので無視
-        if (diff < min_diff - 1e-15) {
-          swap_i = i;
-          swap_j = j;
-          min_diff = diff;
-        }
-
-        swap(&route[i], &route[j]); // 元に戻す
-      }
-    }
-
-    if (swap_i == -1) { // 局所最適の場合
-      break;
+typedef struct {
+  const City *city;
+  const DistTable *dt;
+  const Cand *cand;
+  int n;
+  int init;
+  int moves;
+  int times;
+  uint64_t seed;
+  atomic_int *next;          // 次に担当する初期解の番号
+  StopRule *stop;            // 打ち切り判定 (mu で守る)
+  pthread_mutex_t *mu;
+  double *dist;              // 初期解ごとの長さ (まだなら負)
+  int *done;                 // 打ち切り判定に入れた初期解の数
+  Answer ans;                // このスレッドでの最良解
+  int id;                    // ans の初期解の番号 (まだなければ -1)
+} Worker;
+
+void *worker(void *arg)
+{
+  Worker *w = (Worker*)arg;
+  w->ans = (Answer){.dist = 1e15, .route = NULL};
+  w->id = -1;
+
+  int id;
+  while ((id = atomic_fetch_add(w->next, 1)) < w->times) {
+    // 初期解の番号ごとに乱数を初期化するので、どのスレッドが担当しても同じ解になる
+    Rng rng = rng_init(w->seed ^ ((uint64_t)id * 0xd1342543de82ef95ULL));
+    Answer result = calc(w->city, w->dt, w->cand, w->n, w->init, w->moves, &rng);
+    const double d = result.dist;
+    if (w->id < 0 || answer_better(d, id, w->ans.dist, w->id)) {
+      free(w->ans.route);
+      w->ans = result;
+      w->id = id;
     } else {
-      swap(&route[swap_i], &route[swap_j]);
+      free(result.route);
     }
 
+    // 打ち切り判定には初期解の番号の順に入れる (時間切れのほかは、スレッド数によらず同じ回で止まる)
+    pthread_mutex_lock(w->mu);
+    w->dist[id] = d;
+    while (*w->done < w->times && w->dist[*w->done] >= 0 && w->stop->reason == NULL) {
+      if (stop_update(w->stop, w->dist[(*w->done)++])) atomic_store(w->next, w->times);
+    }
+    pthread_mutex_unlock(w->mu);
   }
-
-  double sum_d = 0;
-  for (int i = 0 ; i < n ; i++){
-    const int c0 = route[i];
-    const int c1 = route[(i+1)%n]; // nは0に戻る
-    sum_d += distance(city[c0],city[c1]);
-  }
-
-  //printf("sum:%lf\n", sum_d);
-
-  int *ans_route = (int*)calloc(n, sizeof(int));
-  memcpy(ans_route, route, sizeof(int) * n);
-  return (Answer){.dist = sum_d, .route = ans_route};
+  return NULL;
 }
 
-double solve(const City *city, int n, int *route)
+// 初期解を最大 times 個作って探索する。stop の判定で止まったら、そこまでの番号の初期解のうちで一番良いものを返す
+double solve(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nthreads, uint64_t seed, int init, int moves,
+             StopRule *stop)
 {
+  // 都市数が多いときは1回あたりが重いので初期解を減らす
+  int times = max(1, min(5e3, 5e5 / n));
+  atomic_int next = 0;
+  pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+  double *dist = (double*)malloc(sizeof(double) * times);
+  for (int i = 0; i < times; i++) dist[i] = -1;
+  int done = 0;
+
+  pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+  Worker *w = (Worker*)malloc(sizeof(Worker) * nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    w[t] = (Worker){.city = city, .dt = dt, .cand = cand, .n = n, .init = init, .moves = moves, .times = times, .seed = seed,
+                    .next = &next, .stop = stop, .mu = &mu, .dist = dist, .done = &done};
+    pthread_create(&th[t], NULL, worker, &w[t]);
+  }
+  for (int t = 0; t < nthreads; t++) pthread_join(th[t], NULL);
 
-  srand((unsigned)time(NULL));
-  Answer ans = (Answer){.dist = 1e15};
-  int times = 5e3;
-  for (int i=0; i<times; i++) {
-    Answer result = calc(city, n);
-    //printf("d:%lf\n", result.dist);
-    if (result.dist < ans.dist) {
-      free(ans.route);
-      ans = result;
+  // 判定に入れた初期解 (番号 done 未満) の中で一番良いもの
+  int best_id = 0;
+  for (int i = 1; i < done; i++) {
+    if (answer_better(dist[i], i, dist[best_id], best_id)) best_id = i;
+  }
+  // 持っているスレッドから経路をもらう。止めた後の番号の方が良くて上書きされていたら、同じ乱数で作りなおす
+  double d = -1;
+  for (int t = 0; t < nthreads; t++) {
+    if (w[t].id == best_id) {
+      memcpy(route, w[t].ans.route, sizeof(int) * n);
+      d = w[t].ans.dist;
     }
+    free(w[t].ans.route);
+  }
+  if (d < 0) {
+    Rng rng = rng_init(seed ^ ((uint64_t)best_id * 0xd1342543de82ef95ULL));
+    Answer result = calc(city, dt, cand, n, init, moves, &rng);
+    memcpy(route, result.route, sizeof(int) * n);
+    d = result.dist;
+    free(result.route);
   }
-  memcpy(route, ans.route, sizeof(int) * n);
+  free(th);
+  free(w);
+  free(dist);
 
-  return ans.dist;
+  return d;
 }
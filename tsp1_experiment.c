@@ -12,13 +12,12 @@
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
 #include <time.h>
+#include <stdint.h>
 
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
+// 都市ファイル、距離テーブル、候補リスト、下界は共通のヘッダにある
+#include "tsp_city.h"
+#include "tsp_dist.h"
+#include "tsp_bound.h"
 
 // 描画用
 typedef struct
@@ -33,27 +32,18 @@ typedef struct {
   double dist;
 } Answer;
 
-// 整数最大値をとる関数
-int max(const int a, const int b)
-{
-  return (a > b) ? a : b;
-}
-
 // プロトタイプ宣言
 // draw_line: 町の間を線で結ぶ
 // draw_route: routeでの巡回順を元に移動経路を線で結ぶ
 // plot_cities: 描画する
-// distance: 2地点間の距離を計算
 // solve(): TSPをといて距離を返す/ 引数route に巡回順を格納
 
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
-double solve(const City *city, int n, int *route, int times);
+double solve(const City *city, const DistTable *dt, int n, int *route, int times);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
 
 Map init_map(const int width, const int height)
 {
@@ -69,24 +59,6 @@ void free_map_dot(Map m)
   free(m.dot);
 }
 
-City *load_cities(const char *filename, int *n)
-{
-  City *city;
-  FILE *fp;
-  if ((fp=fopen(filename,"rb")) == NULL){
-    fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
-  }
-  fread(n,sizeof(int),1,fp);
-  city = (City*)malloc(sizeof(City) * *n);
-  for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
-    //printf("(x, y) = (%d, %d)\n", city[i].x, city[i].y);
-  }
-  fclose(fp);
-  return city;
-}
 int main(int argc, char**argv)
 {
   // const による定数定義
@@ -103,10 +75,14 @@ int main(int argc, char**argv)
     fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
     exit(1);
   }
-  int n;
-  City *city = load_cities(argv[1],&n);
+  CityFile cf = load_cities(argv[1]);
+  const int n = cf.n;
+  City *city = cf.city;
   assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
 
+  // 距離は先にまとめて計算しておく
+  DistTable dt = init_dist_table(city, n, choose_dist_mode(n));
+
   // 町の初期配置を表示
   plot_cities(fp, map, city, n, NULL);
   sleep(1);
@@ -116,21 +92,26 @@ int main(int argc, char**argv)
   // 訪れた町を記録するフラグ
   //int *visited = (int*)calloc(n, sizeof(int));
 
+  // 平均がどこまで最適に近づいたかを見るための下界 (歩幅の目安には初期解10個の結果を使う)
+  const double bound = held_karp_bound(city, &dt, NULL, n, solve(city,&dt,n,route,10));
+  printf("lower bound = %f\n", bound);
+
   for (int t=1; t<=8192; t*=2) {
     printf("%d times\n", t);
     double sum = 0;
     for (int s=0; s<8; s++) {
-      const double d = solve(city,n,route,t);
+      const double d = solve(city,&dt,n,route,t);
       sum += d;
       printf("total distance = %f\n", d);
     }
-    printf("average distance = %f\n", sum / 8);
+    printf("average distance = %f (gap %.3f%%)\n", sum / 8, 100 * (sum / 8 - bound) / bound);
   }
 
   // 動的確保した環境ではfreeをする
   free(route);
   //free(visited);
-  free(city);
+  free_dist_table(dt);
+  unload_cities(cf);
   
   return 0;
 }
@@ -167,8 +148,9 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   for (int i = 0; i < n; i++) {
     char buf[100];
     sprintf(buf, "C_%d", i);
-    for (int j = 0; j < strlen(buf); j++) {
-      const int x = city[i].x + j;
+    const size_t len = strlen(buf);
+    for (size_t j = 0; j < len; j++) {
+      const int x = city[i].x + (int)j;
       const int y = city[i].y;
       map.dot[x][y] = buf[j];
     }
@@ -186,13 +168,6 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
-{
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
-}
-
 void gen_random_route(int n, int *route) {
 
   // 初期化
@@ -211,17 +186,7 @@ void gen_random_route(int n, int *route) {
 
 }
 
-void swap(int *a, int *b) {
-  int temp = *a;
-  *a = *b;
-  *b = temp;
-}
-
-double dist(const City *city, int *route, int i, int j) {
-  return distance(city[route[i]], city[route[j]]);
-}
-
-Answer calc(const City *city, int n) {
+Answer calc(const City *city, const DistTable *dt, int n) {
   int route[n];
   gen_random_route(n, route);
 
@@ -241,15 +206,15 @@ Answer calc(const City *city, int n) {
         // 実際に入れ替えて距離がどれだけ変わるかを計算する
         // 変わるのは入れ替えた部分周辺のみなので、そこだけで差をとれば十分
         double diff = 0;
-        diff -= dist(city, route, i, (i+n-1)%n);
-        diff -= dist(city, route, i, (i+1)%n);
-        diff -= dist(city, route, j, (j+n-1)%n);
-        diff -= dist(city, route, j, (j+1)%n);
+        diff -= dist(dt, route, i, (i+n-1)%n);
+        diff -= dist(dt, route, i, (i+1)%n);
+        diff -= dist(dt, route, j, (j+n-1)%n);
+        diff -= dist(dt, route, j, (j+1)%n);
         swap(&route[i], &route[j]);
-        diff += dist(city, route, i, (i+n-1)%n);
-        diff += dist(city, route, i, (i+1)%n);
-        diff += dist(city, route, j, (j+n-1)%n);
-        diff += dist(city, route, j, (j+1)%n);
+        diff += dist(dt, route, i, (i+n-1)%n);
+        diff += dist(dt, route, i, (i+1)%n);
+        diff += dist(dt, route, j, (j+n-1)%n);
+        diff += dist(dt, route, j, (j+1)%n);
 
         // 入れ替えて距離が短くなったら
         // ただし同じ位置に都市があり変化しない場合は0ではなく-1e16くらいになるので無視
@@ -285,12 +250,12 @@ Answer calc(const City *city, int n) {
   return (Answer){.dist = sum_d, .route = ans_route};
 }
 
-double solve(const City *city, int n, int *route, int times)
+double solve(const City *city, const DistTable *dt, int n, int *route, int times)
 {
 
   Answer ans = (Answer){.dist = 1e15};
   for (int i=0; i<times; i++) {
-    Answer result = calc(city, n);
+    Answer result = calc(city, dt, n);
     //printf("d:%lf\n", result.dist);
     if (result.dist < ans.dist) {
       free(ans.route);
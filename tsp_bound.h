@@ -0,0 +1,256 @@
+/*
+
+  Held-Karp の下界 (advance.c, tsp1.c, tsp1_experiment.c, tsp_ga.c で共通)
+  held_karp_bound() で巡回路の長さの下界を求め、最適解との差 (gap) の見積もりに使う
+
+*/
+
+#ifndef TSP_BOUND_H
+#define TSP_BOUND_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tsp_city.h"
+#include "tsp_dist.h"
+
+// Held-Karp の下界 (詳しくは held_karp_bound() の前のコメントを参照)
+#define HK_ITERS 1000     // 劣勾配法の最大反復回数
+#define HK_PATIENCE 20    // この回数 L が上がらなければ歩幅を半分にする
+#define HK_WORK 2e7       // 反復全体で調べる辺の数の目安 (都市数が多いときは反復を減らす)
+#ifndef HK_EXACT_MAX
+#define HK_EXACT_MAX 10000 // これより都市が多いと最後の計算 (n^2) が重すぎるので、下界を出さない
+#endif
+
+// Held-Karp の下界 (1-木の緩和を劣勾配法で強くしたもの)
+// 都市 0 以外の最小全域木に都市 0 からの短い2辺を足したもの (1-木) は、どの巡回路より長くならない。
+// 辺 (i, j) の長さを d(i, j) + π_i + π_j に変えると巡回路はどれもちょうど 2Σπ 長くなるので、
+// L(π) = (変えた長さでの最小の1-木) - 2Σπ も下界になる。次数が2でない都市の π を (次数 - 2) の向きに動かして L を上げる。
+// 反復は候補リストの辺だけで行い (速い)、最後に一番良かった π で全部の辺を使って L(π) を計算しなおす
+
+typedef struct {
+  double w;
+  int v, from;
+} HkItem;
+
+// 二分ヒープ (w の小さい順)
+static inline void hk_push(HkItem *heap, int *len, HkItem x)
+{
+  int i = (*len)++;
+  while (i > 0 && heap[(i - 1) / 2].w > x.w) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = x;
+}
+
+static inline HkItem hk_pop(HkItem *heap, int *len)
+{
+  const HkItem top = heap[0], x = heap[--(*len)];
+  int i = 0;
+  while (2 * i + 1 < *len) {
+    int c = 2 * i + 1;
+    if (c + 1 < *len && heap[c + 1].w < heap[c].w) c++;
+    if (heap[c].w >= x.w) break;
+    heap[i] = heap[c];
+    i = c;
+  }
+  if (*len > 0) heap[i] = x;
+  return top;
+}
+
+// 全部の辺を使った1-木の長さ (π 込み)。deg があれば次数を入れる (プリム法 O(n^2))
+static inline double one_tree_dense(const DistTable *dt, int n, const double *pi, int *deg, double *key, int *parent,
+                             char *done)
+{
+  for (int v = 0; v < n; v++) {
+    key[v] = 1e300;
+    parent[v] = -1;
+    done[v] = 0;
+    if (deg != NULL) deg[v] = 0;
+  }
+  double total = 0;
+  int u = 1;
+  key[u] = 0;
+  for (int step = 1; step < n; step++) {
+    total += key[u];
+    if (parent[u] >= 0 && deg != NULL) {
+      deg[u]++;
+      deg[parent[u]]++;
+    }
+    done[u] = 1;
+    int next = -1;
+    for (int v = 1; v < n; v++) {
+      if (done[v]) continue;
+      const double w = dt_get(dt, u, v) + pi[u] + pi[v];
+      if (w < key[v]) {
+        key[v] = w;
+        parent[v] = u;
+      }
+      if (next < 0 || key[v] < key[next]) next = v;
+    }
+    u = next;
+  }
+  // 都市 0 からの短い2辺
+  int a1 = -1, a2 = -1;
+  double m1 = 1e300, m2 = 1e300;
+  for (int v = 1; v < n; v++) {
+    const double w = dt_get(dt, 0, v) + pi[0] + pi[v];
+    if (w < m1) {
+      m2 = m1, a2 = a1;
+      m1 = w, a1 = v;
+    } else if (w < m2) {
+      m2 = w, a2 = v;
+    }
+  }
+  if (deg != NULL) {
+    deg[0] = 2;
+    deg[a1]++;
+    deg[a2]++;
+  }
+  return total + m1 + m2;
+}
+
+// 候補リストの辺 (両向きにした隣接リスト start, adj) だけでの1-木。つながっていなければ NAN を返す
+// (π 込みの長さは負にもなるので、負の値を印には使えない)
+static inline double one_tree_sparse(const DistTable *dt, int n, const int *start, const int *adj, const double *pi, int *deg,
+                              char *done, HkItem *heap)
+{
+  memset(done, 0, (size_t)n);
+  for (int v = 0; v < n; v++) deg[v] = 0;
+  double total = 0;
+  int len = 0, count = 0;
+  hk_push(heap, &len, (HkItem){.w = 0, .v = 1, .from = -1});
+  while (len > 0) {
+    const HkItem x = hk_pop(heap, &len);
+    if (done[x.v]) continue;
+    done[x.v] = 1;
+    count++;
+    total += x.w;
+    if (x.from >= 0) {
+      deg[x.v]++;
+      deg[x.from]++;
+    }
+    for (int e = start[x.v]; e < start[x.v + 1]; e++) {
+      const int v = adj[e];
+      if (v != 0 && !done[v]) hk_push(heap, &len, (HkItem){.w = dt_get(dt, x.v, v) + pi[x.v] + pi[v], .v = v, .from = x.v});
+    }
+  }
+  if (count < n - 1 || start[1] - start[0] < 2) return NAN;
+  int a1 = -1, a2 = -1;
+  double m1 = 1e300, m2 = 1e300;
+  for (int e = start[0]; e < start[1]; e++) {
+    const int v = adj[e];
+    const double w = dt_get(dt, 0, v) + pi[0] + pi[v];
+    if (v == a1 || v == a2) continue;
+    if (w < m1) {
+      m2 = m1, a2 = a1;
+      m1 = w, a1 = v;
+    } else if (w < m2) {
+      m2 = w, a2 = v;
+    }
+  }
+  deg[0] = 2;
+  deg[a1]++;
+  deg[a2]++;
+  return total + m1 + m2;
+}
+
+// 下界を返す。ub は何かの巡回路の長さ (歩幅の目安)。都市数が多すぎて計算しないときは 0
+static inline double held_karp_bound(const City *city, const DistTable *dt, const Cand *cand, int n, double ub)
+{
+  if (n <= 3) return ub; // どの巡回路も同じ長さ
+  if (n > HK_EXACT_MAX) return 0;
+  Cand local = {.k = 0, .nb = NULL};
+  if (cand == NULL && n >= CAND_MIN_CITIES) {
+    local = build_candidates(city, n, CAND_K);
+    cand = &local;
+  }
+  double *pi = (double*)calloc(n, sizeof(double));
+  double *best_pi = (double*)calloc(n, sizeof(double));
+  double *key = (double*)malloc(sizeof(double) * n);
+  int *parent = (int*)malloc(sizeof(int) * n);
+  int *deg = (int*)malloc(sizeof(int) * n);
+  int *g_prev = (int*)calloc(n, sizeof(int));
+  char *done = (char*)malloc(n);
+
+  // 候補リストの辺を両向きにする (重なりはそのまま)
+  int *start = NULL, *adj = NULL;
+  HkItem *heap = NULL;
+  if (cand != NULL) {
+    const int k = cand->k;
+    start = (int*)calloc(n + 1, sizeof(int));
+    adj = (int*)malloc(sizeof(int) * (size_t)n * k * 2);
+    for (int i = 0; i < n; i++)
+      for (int t = 0; t < k; t++) {
+        start[i + 1]++;
+        start[cand->nb[(size_t)i * k + t] + 1]++;
+      }
+    for (int i = 0; i < n; i++) start[i + 1] += start[i];
+    int *fill = (int*)malloc(sizeof(int) * n);
+    memcpy(fill, start, sizeof(int) * n);
+    for (int i = 0; i < n; i++)
+      for (int t = 0; t < k; t++) {
+        const int j = cand->nb[(size_t)i * k + t];
+        adj[fill[i]++] = j;
+        adj[fill[j]++] = i;
+      }
+    free(fill);
+    heap = (HkItem*)malloc(sizeof(HkItem) * ((size_t)n * k * 2 + 1));
+  }
+
+  const double edges = (cand != NULL) ? 2.0 * n * cand->k : (double)n * n / 2;
+  const int iters = (int)fmax(50, fmin(HK_ITERS, HK_WORK / edges));
+  double best = -1e300, lambda = 2;
+  int stall = 0;
+  for (int it = 0; it < iters; it++) {
+    double w = (cand != NULL) ? one_tree_sparse(dt, n, start, adj, pi, deg, done, heap)
+                              : one_tree_dense(dt, n, pi, deg, key, parent, done);
+    if (isnan(w)) { // 候補リストの辺ではつながっていない。全部の辺で最後の計算だけ行う
+      memset(best_pi, 0, sizeof(double) * n);
+      break;
+    }
+    double sum_pi = 0;
+    for (int v = 0; v < n; v++) sum_pi += pi[v];
+    const double L = w - 2 * sum_pi;
+    if (L > best + 1e-9) {
+      best = L;
+      memcpy(best_pi, pi, sizeof(double) * n);
+      stall = 0;
+    } else if (++stall >= HK_PATIENCE) {
+      lambda /= 2;
+      stall = 0;
+      if (lambda < 1e-6) break;
+    }
+    // 劣勾配 g = 次数 - 2。前回の向きも少し混ぜる (Volgenant-Jonker)
+    double norm = 0;
+    for (int v = 0; v < n; v++) norm += (double)(deg[v] - 2) * (deg[v] - 2);
+    if (norm == 0) break; // 1-木が巡回路になった (最適)
+    const double step = lambda * fmax(ub - L, 1e-9 * ub) / norm;
+    for (int v = 0; v < n; v++) {
+      const int g = deg[v] - 2;
+      pi[v] += step * (0.7 * g + 0.3 * g_prev[v]);
+      g_prev[v] = g;
+    }
+  }
+
+  // 候補リストの辺だけで作った木は全体の最小とは限らないので、全部の辺で計算しなおす (誤差もここでそろう)
+  double sum_pi = 0;
+  for (int v = 0; v < n; v++) sum_pi += best_pi[v];
+  const double bound = one_tree_dense(dt, n, best_pi, NULL, key, parent, done) - 2 * sum_pi;
+
+  free(pi);
+  free(best_pi);
+  free(key);
+  free(parent);
+  free(deg);
+  free(g_prev);
+  free(start);
+  free(adj);
+  free(done);
+  free(heap);
+  free_candidates(local);
+  return bound;
+}
+
+#endif
@@ -0,0 +1,167 @@
+/*
+
+  都市と都市ファイル (各プログラムで共通)
+  都市ファイルの読み込み load_cities() (終了しない read_cities() も) と、2地点間の距離 distance()
+
+  共通のヘッダ (tsp_*.h) の関数はどれも static inline にしてある。プログラムはそれぞれ1つの .c で
+  できていて、使う関数だけがそのプログラムに入る。2つの .c から include してつないでも名前はぶつからない
+
+*/
+
+#ifndef TSP_CITY_H
+#define TSP_CITY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h> // close()
+#include <fcntl.h> // open()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+
+// 町の構造体（今回は2次元座標）を定義
+typedef struct
+{
+  int x;
+  int y;
+} City;
+
+// 都市ファイル
+// v1: int n の後に (x, y) が int で n 組並ぶ (gencity の出力)
+// v2: CityHeader の後に (x, y) が coord_bytes バイトの整数で n 組並ぶ
+//     checksum は座標部分の FNV-1a (64bit)
+// どちらも mmap して、int32 の座標はコピーせずにそのまま City の配列として使う
+#define CITY_MAGIC 0x43505354u // "TSPC"
+#define CITY_VERSION 2
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t coord_bytes; // 2 (int16) か 4 (int32)
+  uint32_t n;
+  uint32_t reserved;
+  uint64_t checksum;
+} CityHeader;
+
+typedef struct {
+  City *city;
+  int n;
+  void *addr; // mmap した領域 (munmap 用)
+  size_t len;
+  int copied; // int16 の座標を City に広げたときは city を free する
+} CityFile;
+
+// 整数最小値をとる関数
+static inline int min(const int a, const int b)
+{
+  return (a < b) ? a : b;
+}
+
+// 整数最大値をとる関数
+static inline int max(const int a, const int b)
+{
+  return (a > b) ? a : b;
+}
+
+// 整数を入れ替える関数
+static inline void swap(int *a, int *b)
+{
+  int temp = *a;
+  *a = *b;
+  *b = temp;
+}
+
+static inline double distance(City a, City b)
+{
+  const double dx = (double)a.x - b.x;
+  const double dy = (double)a.y - b.y;
+  return sqrt(dx * dx + dy * dy);
+}
+
+static inline uint64_t city_checksum(const void *p, size_t len)
+{
+  const unsigned char *c = (const unsigned char*)p;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0 ; i < len ; i++){
+    h ^= c[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// 都市ファイルを開いて *cf に入れる。読めなければ終了はせずに理由を返す (読めたら NULL)
+// max_n より多くの都市が入ったファイルは読まない。エラーのときは何も残さない
+static inline const char *read_cities(const char *filename, int max_n, CityFile *cf)
+{
+  *cf = (CityFile){.city = NULL, .n = 0, .addr = NULL, .len = 0, .copied = 0};
+  int fd;
+  if ((fd = open(filename, O_RDONLY)) < 0) return "cannot open file";
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(int)){
+    close(fd);
+    return "file is too short";
+  }
+  const size_t len = (size_t)st.st_size;
+  void *addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return "mmap failed";
+  madvise(addr, len, MADV_WILLNEED); // 先読みさせる
+
+  const char *err = NULL;
+  const CityHeader *h = (const CityHeader*)addr;
+  if (len >= sizeof(CityHeader) && h->magic == CITY_MAGIC){
+    const size_t body = (size_t)h->n * 2 * h->coord_bytes;
+    const char *p = (const char*)addr + sizeof(CityHeader);
+    if (h->version != CITY_VERSION || (h->coord_bytes != 2 && h->coord_bytes != 4)) err = "unsupported format";
+    else if (h->n > (uint32_t)max_n || len != sizeof(CityHeader) + body) err = "size does not match";
+    else if (city_checksum(p, body) != h->checksum) err = "checksum mismatch";
+    else if (h->coord_bytes == 4){
+      cf->n = (int)h->n;
+      cf->city = (City*)p;
+    } else {
+      // int16 はそのままでは使えないので広げる
+      const int16_t *c = (const int16_t*)p;
+      cf->n = (int)h->n;
+      cf->city = (City*)malloc(sizeof(City) * (size_t)cf->n);
+      for (int i = 0 ; i < cf->n ; i++)
+        cf->city[i] = (City){.x = c[2*i], .y = c[2*i+1]};
+      cf->copied = 1;
+    }
+  } else {
+    const int n = *(const int*)addr;
+    if (n < 0 || n > max_n || len != sizeof(int) + (size_t)n * sizeof(City)) err = "size does not match";
+    else {
+      cf->n = n;
+      cf->city = (City*)((char*)addr + sizeof(int));
+    }
+  }
+  if (err != NULL){
+    munmap(addr, len);
+    return err;
+  }
+  cf->addr = addr;
+  cf->len = len;
+  return NULL;
+}
+
+// 都市ファイルを読む。読めなければ理由を表示して終了する
+static inline CityFile load_cities(const char *filename)
+{
+  CityFile cf;
+  const char *err = read_cities(filename, INT32_MAX, &cf);
+  if (err != NULL){
+    fprintf(stderr, "%s: %s.\n",filename,err);
+    exit(1);
+  }
+  return cf;
+}
+
+static inline void unload_cities(CityFile cf)
+{
+  if (cf.copied) free(cf.city);
+  munmap(cf.addr, cf.len);
+}
+
+#endif
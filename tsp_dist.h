@@ -0,0 +1,253 @@
+/*
+
+  距離テーブルと候補リスト (advance.c, advance_swap.c, bench.c, tsp1.c, tsp1_experiment.c, tsp_ga.c で共通)
+  init_dist_table() で都市間の距離を先にまとめて計算しておき、dt_get() で引く
+  build_candidates() で各都市の近くにある都市を近い順に並べておく
+  tspd.c は都市の一部だけ候補を作りなおすので、格子 (cand_grid_build(), cand_grid_nearest()) だけを使う
+
+*/
+
+#ifndef TSP_DIST_H
+#define TSP_DIST_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tsp_city.h"
+
+// 距離テーブル
+// load_cities() の後に一度だけ作っておき、calc() の中ではこれを引くだけにする (sqrtを毎回計算しない)
+// DIST_FULL  : n x n の表。各行をキャッシュライン(64byte)単位にパディングしてある
+// DIST_PACKED: 上三角 (a < b) の部分だけを詰めた表。メモリは半分で済む
+// DIST_NONE  : 表を作らずに毎回計算する (都市数が多すぎて表が載らない場合)
+// 要素の型は float。-DDIST_DOUBLE でコンパイルすると double になる
+// -DDIST_NINT でコンパイルすると (tsp1.c 用)、距離を TSPLIB の EUC_2D と同じく四捨五入した整数 (int32) にする。
+// 差分は整数の足し引きだけになって誤差がないので、改善の判定はちょうど 0 と比べる。巡回路の長さもこの距離の和になる
+// len_t は差分や長さの型 (表から引いた値の和)
+#ifdef DIST_NINT
+typedef int32_t dist_t;
+typedef int64_t len_t;
+#elif defined(DIST_DOUBLE)
+typedef double dist_t;
+typedef double len_t;
+#else
+typedef float dist_t;
+typedef double len_t;
+#endif
+
+#define CACHE_LINE 64
+#ifndef DIST_TABLE_LIMIT
+#define DIST_TABLE_LIMIT ((size_t)256 << 20) // 表に使ってよい最大バイト数
+#endif
+
+enum { DIST_NONE, DIST_FULL, DIST_PACKED };
+
+typedef struct {
+  int n;
+  int mode;
+  size_t stride; // DIST_FULL での1行あたりの要素数 (パディング込み)
+  dist_t *d;
+  const City *city; // DIST_NONE のときはここから計算する
+} DistTable;
+
+// 候補リスト (各都市の近くにある都市)
+// 都市数が多いときは、近い都市どうしを結ぶ移動だけを試す
+#define CAND_K 8
+#define CAND_MIN_CITIES 50 // これより少ないときは全部の組を試しても十分速い
+
+typedef struct {
+  int k;
+  int *nb; // 都市 i の候補は nb[i*k] 〜 nb[i*k+k-1] (近い順)
+} Cand;
+
+// 探索で使う距離。DIST_NINT なら四捨五入した整数 (TSPLIB の nint)、そうでなければ distance() と同じ
+static inline len_t city_dist(City a, City b)
+{
+#ifdef DIST_NINT
+  return (len_t)(distance(a, b) + 0.5);
+#else
+  return distance(a, b);
+#endif
+}
+
+// メモリの上限に収まる範囲で一番速い形式を選ぶ
+static inline int choose_dist_mode(int n)
+{
+  const size_t per_line = CACHE_LINE / sizeof(dist_t);
+  const size_t stride = (n + per_line - 1) / per_line * per_line;
+  if (stride * n * sizeof(dist_t) <= DIST_TABLE_LIMIT) return DIST_FULL;
+  if ((size_t)n * (n - 1) / 2 * sizeof(dist_t) <= DIST_TABLE_LIMIT) return DIST_PACKED;
+  return DIST_NONE;
+}
+
+// 上三角形式での (a, b) (a < b) の位置
+static inline size_t packed_index(int n, int a, int b)
+{
+  return (size_t)a * (2 * (size_t)n - a - 1) / 2 + (b - a - 1);
+}
+
+static inline DistTable init_dist_table(const City *city, int n, int mode)
+{
+  DistTable dt = {.n = n, .mode = mode, .stride = 0, .d = NULL, .city = city};
+  size_t size;
+  if (mode == DIST_FULL) {
+    const size_t per_line = CACHE_LINE / sizeof(dist_t);
+    dt.stride = (n + per_line - 1) / per_line * per_line;
+    size = dt.stride * n;
+  } else if (mode == DIST_PACKED) {
+    size = (size_t)n * (n - 1) / 2;
+  } else {
+    return dt;
+  }
+
+  // aligned_alloc に渡すサイズはアラインメントの倍数にしておく必要がある
+  const size_t bytes = (size * sizeof(dist_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  dt.d = (dist_t*)aligned_alloc(CACHE_LINE, bytes);
+  if (dt.d == NULL) {
+    fprintf(stderr, "cannot allocate distance table (%zu bytes).\n", bytes);
+    exit(1);
+  }
+
+  for (int a = 0; a < n; a++) {
+    for (int b = a + 1; b < n; b++) {
+      const dist_t d = city_dist(city[a], city[b]);
+      if (mode == DIST_FULL) {
+        dt.d[a * dt.stride + b] = d;
+        dt.d[b * dt.stride + a] = d;
+      } else {
+        dt.d[packed_index(n, a, b)] = d;
+      }
+    }
+    if (mode == DIST_FULL) dt.d[a * dt.stride + a] = 0;
+  }
+  return dt;
+}
+
+static inline void free_dist_table(DistTable dt)
+{
+  free(dt.d);
+}
+
+// 都市 a, b 間の距離
+static inline len_t dt_get(const DistTable *dt, int a, int b)
+{
+  if (dt->mode == DIST_FULL) return dt->d[a * dt->stride + b];
+  if (dt->mode == DIST_PACKED) {
+    if (a == b) return 0;
+    return (a < b) ? dt->d[packed_index(dt->n, a, b)] : dt->d[packed_index(dt->n, b, a)];
+  }
+  return city_dist(dt->city[a], dt->city[b]);
+}
+
+// 巡回路 route の位置 i と j にある都市の間の距離
+static inline double dist(const DistTable *dt, const int *route, int i, int j)
+{
+  return dt_get(dt, route[i], route[j]);
+}
+
+// 候補リスト用の格子。1セルあたり2都市くらいになるように g x g に分ける
+// cell_of[i] は都市 i のセル、セル c の都市は items[start[c]] 〜 items[start[c+1] - 1]
+typedef struct {
+  int g, minx, miny;
+  double cw, ch;
+  int *cell_of, *start, *items;
+} CandGrid;
+
+// 都市を格子に振り分ける。cell_of, start, items は呼ぶ側で用意しておく (n 個, n + 1 個, n 個あれば足りる)
+// fill は詰めるときの作業用 (n 個)
+static inline void cand_grid_build(CandGrid *gr, const City *city, int n, int *fill)
+{
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < minx) minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < miny) miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  // g * g <= n / 2 なので start は n + 1 個で足りる
+  const int g = gr->g = max(1, (int)sqrt(n / 2.0));
+  const double cw = gr->cw = ((double)maxx - minx + 1) / g;
+  const double ch = gr->ch = ((double)maxy - miny + 1) / g;
+  gr->minx = minx;
+  gr->miny = miny;
+  int *cell_of = gr->cell_of, *start = gr->start, *items = gr->items;
+  memset(start, 0, sizeof(int) * (g * g + 1));
+  for (int i = 0; i < n; i++) {
+    const int cx = (int)(((double)city[i].x - minx) / cw);
+    const int cy = (int)(((double)city[i].y - miny) / ch);
+    cell_of[i] = min(cy, g - 1) * g + min(cx, g - 1);
+    start[cell_of[i] + 1]++;
+  }
+  for (int c = 0; c < g * g; c++) start[c + 1] += start[c];
+  memcpy(fill, start, sizeof(int) * g * g);
+  for (int i = 0; i < n; i++) items[fill[cell_of[i]]++] = i;
+}
+
+// 都市 i に近い順に k 個の都市を nb に入れる (best は k 個の作業用)
+// 自分のセルから外側へ1周ずつ広げながら探す
+static inline void cand_grid_nearest(const CandGrid *gr, const City *city, int i, int k, int *nb, double *best)
+{
+  const int g = gr->g;
+  const int *start = gr->start, *items = gr->items;
+  int found = 0;
+  const int cx = gr->cell_of[i] % g, cy = gr->cell_of[i] / g;
+  for (int r = 0; r < g; r++) {
+    // 距離 r のセル (チェビシェフ距離) を1周分調べる
+    for (int y = cy - r; y <= cy + r; y++) {
+      if (y < 0 || y >= g) continue;
+      const int step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+      for (int x = cx - r; x <= cx + r; x += max(step, 1)) {
+        if (x < 0 || x >= g) continue;
+        const int c = y * g + x;
+        for (int p = start[c]; p < start[c + 1]; p++) {
+          const int j = items[p];
+          if (j == i) continue;
+          const double dx = (double)city[i].x - city[j].x;
+          const double dy = (double)city[i].y - city[j].y;
+          const double d2 = dx * dx + dy * dy;
+          if (found == k && d2 >= best[k - 1]) continue;
+          // 挿入ソートで近い順に保つ
+          int a = (found < k) ? found++ : k - 1;
+          while (a > 0 && best[a - 1] > d2) {
+            best[a] = best[a - 1];
+            nb[a] = nb[a - 1];
+            a--;
+          }
+          best[a] = d2;
+          nb[a] = j;
+        }
+      }
+    }
+    // 次の周のセルはどれも r * (セルの短い辺) 以上離れている
+    const double reach = r * (gr->cw < gr->ch ? gr->cw : gr->ch);
+    if (found == k && reach * reach > best[k - 1]) break;
+  }
+}
+
+// 候補リスト: 各都市について近い順に k 個の都市を持つ
+static inline Cand build_candidates(const City *city, int n, int k)
+{
+  if (k > n - 1) k = n - 1;
+  Cand cand = {.k = k, .nb = (int*)malloc(sizeof(int) * (size_t)n * k)};
+
+  CandGrid gr = {.cell_of = (int*)malloc(sizeof(int) * n), .start = (int*)malloc(sizeof(int) * (n + 1)),
+                 .items = (int*)malloc(sizeof(int) * n)};
+  int *fill = (int*)malloc(sizeof(int) * n);
+  cand_grid_build(&gr, city, n, fill);
+  free(fill);
+
+  double *best = (double*)malloc(sizeof(double) * k);
+  for (int i = 0; i < n; i++) cand_grid_nearest(&gr, city, i, k, cand.nb + (size_t)i * k, best);
+  free(best);
+  free(gr.cell_of);
+  free(gr.start);
+  free(gr.items);
+  return cand;
+}
+
+static inline void free_candidates(Cand cand)
+{
+  free(cand.nb);
+}
+
+#endif
@@ -0,0 +1,872 @@
+/*
+
+  遺伝的アルゴリズム (島モデル)
+  島 (個体の集団) を1スレッドに1つずつ持たせ、島ごとに交叉で子を作って 2-opt で磨く。
+  GA_MIGRATE 世代ごとに全員がそろったところで、各島の最良の個体を隣の島の一番悪い個体と入れ替える (移住)。
+  最後の引数で交叉 (eax|ox) を選べる。既定は eax
+  eax: 枝交換交叉 (Edge Assembly Crossover)。親 A と B の辺を交互にたどった閉路 (AB-cycle) を1つ選び、
+       A の辺をその閉路の B の辺に置き換える。できた部分巡回路は近くの都市どうしの 2-opt でつなぐ
+  ox : 順序交叉。A の区間をそのまま残し、残りの都市を B での順に並べる
+
+  個体の巡回路は最初にまとめて確保したプールに置き、世代交代では入れ替えるだけにする (子ごとに calloc しない)
+
+  終わりに Held-Karp の下界 (1-木 + 劣勾配法) と、それに対する差 gap = (巡回路 - 下界) / 下界 を表示する。
+  -g を指定すると、gap がその値 (0.01 なら 1%) 以下の巡回路が見つかった時点で止める。-t は制限時間 (秒)。
+  どちらも移住のときに見る。それ以外では、最良解が GA_STALL 回の移住の間変わらないか、-G の世代数で止める。
+  時間切れでなければ、同じ seed と島の数なら同じ結果になる
+
+  使い方: tsp_ga [-g gap] [-t seconds] [-G generations] [-P population] <city file> [islands] [seed] [eax|ox]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h> // strtol のエラー判定用
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// 乱数、都市ファイル、距離テーブル、候補リスト、下界、打ち切り判定は共通のヘッダにある
+// 打ち切り判定は時間と下界から決めた目標だけを使う (移住のたびに見る。確率での判定はしない)
+#include "tsp_rng.h"
+#include "tsp_city.h"
+#include "tsp_dist.h"
+#include "tsp_bound.h"
+#include "tsp_stop.h"
+
+// 描画用
+// 都市の座標が地図 (70x40) に収まらないときは縮小して描く
+#define PLOT_LABEL_MAX 1000 // これより都市が多いときは番号を描かない
+typedef struct
+{
+  int width;
+  int height;
+  char **dot;
+} Map;
+
+// 遺伝的アルゴリズムの設定
+#define GA_POP 100          // 島ごとの個体数の既定値
+#define GA_KIDS 20          // 1組の親から作る子の数 (eax では AB-cycle の数が上限)
+#define GA_MIGRATE 10       // この世代数ごとに移住する
+#define GA_GENERATIONS 3000 // 世代数の上限の既定値
+#define GA_STALL 5          // 最良解がこの回数の移住の間変わらなければ止める
+#define GA_EPS 1e-9         // 相対差がこれ以下なら同じ長さとみなす
+
+enum { CROSS_EAX, CROSS_OX, CROSS_COUNT };
+static const char *cross_names[CROSS_COUNT] = {"eax", "ox"};
+
+// 調べる都市の待ち行列 (リングバッファ)。in[c] は c が入っているかどうか
+typedef struct {
+  int *q;
+  char *in;
+  int head, tail, len, n;
+} Queue;
+
+// 個体。route は島のプールの中を指すので、個体どうしの入れ替えは構造体の入れ替えで済む
+typedef struct {
+  int *route;
+  double len;
+} Individual;
+
+// 島。個体と作業用の配列は最初に確保したものを使い回す
+// ind[0..size-1] が個体、ind[size] は作っている途中の子、ind[size+1] はその組の親から作った一番良い子
+typedef struct {
+  const DistTable *dt;
+  const Cand *cand;
+  int n;
+  int size;
+  int cross;
+  Individual *ind;
+  int *order;       // 親の組を決める順列 (size)
+  int *pos;         // 2-opt 用。pos[c] は c の位置
+  Queue qu;
+  char *mark;       // ox で使った都市
+  // eax 用 (都市 v の隣の都市は link[2v], link[2v+1])
+  int *link_a, *link_b, *link;
+  int *rest;        // AB-cycle に使っていない辺。A の辺は rest[4v], rest[4v+1]、B の辺は rest[4v+2], rest[4v+3] (なければ -1)
+  int *path;        // AB-cycle を探すときにたどった都市
+  int *seen;        // seen[2v+p] = path の中で偶奇が p の位置にある v の位置 (なければ -1)
+  int *cyc;         // 見つけた AB-cycle。k 番目は cyc[cyc_start[k]] から (偶数番目から次への辺が A の辺)
+  int *cyc_start;
+  int *cyc_order;
+  int ncyc;
+  int *comp, *comp_size, *comp_rep; // 部分巡回路の番号、大きさ、その中の1都市
+  Rng rng;
+} Island;
+
+typedef struct {
+  Island *is;
+  int nisland;
+  int n;
+  int generations;  // 世代数の上限
+  int generation;   // 終わった世代数
+  int gens;         // 次の移住までに進める世代数
+  int *pool;        // 全部の島の個体の巡回路 (島ごとに (size + 2) * n)
+  pthread_barrier_t barrier;
+  double best;      // 全部の島を通しての最良解
+  int *best_route;
+  int stall;        // 最良解が変わらなかった移住の回数
+  StopRule *rule;
+  int stop;
+} Ga;
+
+// プロトタイプ宣言
+// draw_line: 町の間を線で結ぶ
+// draw_route: routeでの巡回順を元に移動経路を線で結ぶ
+// plot_cities: 描画する
+// solve_ga(): TSPをといて距離を返す/ 引数route に巡回順を格納
+
+void draw_line(Map map, City a, City b);
+void draw_route(Map map, City *city, int n, const int *route);
+void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
+City *fit_to_map(Map map, City *city, int n);
+double solve_ga(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nisland, int size, int generations,
+                uint64_t seed, int cross, StopRule *rule);
+Map init_map(const int width, const int height);
+void free_map_dot(Map m);
+double nn_length(const DistTable *dt, int n);
+int parse_cross(const char *s);
+
+Map init_map(const int width, const int height)
+{
+  char **dot = (char**) malloc(width * sizeof(char*));
+  char *tmp = (char*)malloc(width*height*sizeof(char));
+  for (int i = 0 ; i < width ; i++)
+    dot[i] = tmp + i * height;
+  return (Map){.width = width, .height = height, .dot = dot};
+}
+void free_map_dot(Map m)
+{
+  free(m.dot[0]);
+  free(m.dot);
+}
+
+int main(int argc, char**argv)
+{
+  // const による定数定義
+  const int width = 70;
+  const int height = 40;
+
+  Map map = init_map(width, height);
+
+  FILE *fp = stdout; // とりあえず描画先は標準出力としておく
+  // 下界との差がこれ以下になったら止める (負なら止めない)
+  double target_gap = -1;
+  double deadline = 0;
+  int generations = GA_GENERATIONS, size = GA_POP;
+  int opt;
+  while ((opt = getopt(argc, argv, "g:t:G:P:")) != -1) {
+    if (opt == 'g') target_gap = atof(optarg);
+    else if (opt == 't') deadline = atof(optarg);
+    else if (opt == 'G') generations = atoi(optarg);
+    else if (opt == 'P') size = atoi(optarg);
+    else argc = 0; // 使い方を表示して終わる
+  }
+  if (argc > 0) {
+    argv[optind - 1] = argv[0];
+    argv += optind - 1;
+    argc -= optind - 1;
+  }
+  if (argc < 2 || argc > 5 || generations < 0 || size < 2){
+    fprintf(stderr, "Usage: %s [-g gap] [-t seconds] [-G generations] [-P population] <city file> [islands] [seed] [eax|ox]\n", argv[0]);
+    exit(1);
+  }
+  // 最後の引数が交叉の名前なら取り出す
+  int cross = CROSS_EAX;
+  if (argc >= 3 && parse_cross(argv[argc-1]) >= 0) cross = parse_cross(argv[--argc]);
+  if (argc > 4){
+    fprintf(stderr, "%s: unknown crossover.\n", argv[argc-1]);
+    exit(1);
+  }
+  int nisland = (argc >= 3) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (nisland < 1) nisland = 1;
+  const uint64_t seed = (argc >= 4) ? strtoull(argv[3], NULL, 10) : (uint64_t)time(NULL);
+  CityFile cf = load_cities(argv[1]);
+  const int n = cf.n;
+  City *city = cf.city;
+  assert( n > 1 );
+
+  // 距離は先にまとめて計算しておく。2-opt と部分巡回路をつなぐのに候補リストを使う
+  DistTable dt = init_dist_table(city, n, choose_dist_mode(n));
+  Cand cand = {.k = 0, .nb = NULL};
+  if (n > 3) cand = build_candidates(city, n, CAND_K);
+
+  // 訪れる順序を記録する配列を設定
+  int *route = (int*)calloc(n, sizeof(int));
+
+  // Held-Karp の下界。歩幅の目安には最近傍法の巡回路の長さを使う
+  double bound = 0;
+  if (n <= HK_EXACT_MAX) bound = held_karp_bound(city, &dt, (cand.nb != NULL) ? &cand : NULL, n, nn_length(&dt, n));
+  const double stop_at = (bound > 0 && target_gap >= 0) ? bound * (1 + target_gap) : 0;
+
+  // 町の初期配置を表示
+  plot_cities(fp, map, city, n, NULL);
+  if (n <= PLOT_LABEL_MAX) sleep(1);
+
+  StopRule rule = stop_init(0, deadline, stop_at); // 時間は表示の待ちの後から測る
+  double d;
+  if (n <= 3) { // どの巡回路も同じ長さ
+    for (int i = 0; i < n; i++) route[i] = i;
+    d = 0;
+    for (int i = 0; i < n; i++) d += distance(city[i], city[(i+1)%n]);
+  } else {
+    d = solve_ga(city, &dt, &cand, n, route, nisland, size, generations, seed, cross, &rule);
+  }
+  plot_cities(fp, map, city, n, route);
+  printf("total distance = %f\n", d);
+  for (int i = 0 ; i < n ; i++){
+    printf("%d -> ", route[i]);
+  }
+  printf("0\n");
+  if (bound > 0) printf("lower bound = %f, gap = %.3f%%\n", bound, 100 * (d - bound) / bound);
+  else fprintf(stderr, "no lower bound (more than %d cities)\n", HK_EXACT_MAX);
+
+  // 動的確保した環境ではfreeをする
+  free(route);
+  free_map_dot(map);
+  free_dist_table(dt);
+  free_candidates(cand);
+  unload_cities(cf);
+
+  return 0;
+}
+
+// 繋がっている都市間に線を引く
+void draw_line(Map map, City a, City b)
+{
+  const int n = max(abs(a.x - b.x), abs(a.y - b.y));
+  for (int i = 1 ; i <= n ; i++){
+    const int x = a.x + i * (b.x - a.x) / n;
+    const int y = a.y + i * (b.y - a.y) / n;
+    if (map.dot[x][y] == ' ') map.dot[x][y] = '*';
+  }
+}
+
+void draw_route(Map map, City *city, int n, const int *route)
+{
+  if (route == NULL) return;
+
+  for (int i = 0; i < n; i++) {
+    const int c0 = route[i];
+    const int c1 = route[(i+1)%n];// n は 0に戻る必要あり
+    draw_line(map, city[c0], city[c1]);
+  }
+}
+
+// 地図に収まらない座標の場合は、全体が収まるように縮小した座標を作る (収まるならそのまま返す)
+// 番号の文字列の分だけ右側に余白をとる
+City *fit_to_map(Map map, City *city, int n)
+{
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < minx) minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < miny) miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  if (minx >= 0 && maxx < map.width - 5 && miny >= 0 && maxy < map.height) return city;
+
+  City *pt = (City*)malloc(sizeof(City) * n);
+  const double sx = (map.width - 6) / fmax(1.0, (double)maxx - minx);
+  const double sy = (map.height - 1) / fmax(1.0, (double)maxy - miny);
+  for (int i = 0; i < n; i++) {
+    pt[i].x = (int)(((double)city[i].x - minx) * sx);
+    pt[i].y = (int)(((double)city[i].y - miny) * sy);
+  }
+  return pt;
+}
+
+void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
+{
+  fprintf(fp, "----------\n");
+
+  memset(map.dot[0], ' ', map.width * map.height); 
+  City *pt = fit_to_map(map, city, n);
+
+  // 町のみ番号付きでプロットする (多すぎるときは番号を省いて点だけ)
+  for (int i = 0; i < n; i++) {
+    char buf[100];
+    if (n <= PLOT_LABEL_MAX) sprintf(buf, "C_%d", i);
+    else strcpy(buf, "o");
+    const size_t len = strlen(buf);
+    for (size_t j = 0; j < len && pt[i].x + (int)j < map.width; j++) {
+      const int x = pt[i].x + (int)j;
+      const int y = pt[i].y;
+      map.dot[x][y] = buf[j];
+    }
+  }
+
+  draw_route(map, pt, n, route);
+  if (pt != city) free(pt);
+
+  for (int y = 0; y < map.height; y++) {
+    for (int x = 0; x < map.width; x++) {
+      const char c = map.dot[x][y];
+      fputc(c, fp);
+    }
+    fputc('\n', fp);
+  }
+  fflush(fp);
+}
+
+// 最近傍法の巡回路の長さ (下界の計算の歩幅の目安)
+double nn_length(const DistTable *dt, int n)
+{
+  char *used = (char*)calloc(n, sizeof(char));
+  double sum = 0;
+  int cur = 0;
+  used[0] = 1;
+  for (int i = 1; i < n; i++) {
+    int next = -1;
+    double best = 1e300;
+    for (int j = 0; j < n; j++) {
+      if (used[j]) continue;
+      const double d = dt_get(dt, cur, j);
+      if (d < best) {
+        best = d;
+        next = j;
+      }
+    }
+    used[next] = 1;
+    sum += best;
+    cur = next;
+  }
+  free(used);
+  return sum + dt_get(dt, cur, 0);
+}
+
+// 名前から交叉を選ぶ。知らない名前なら -1
+int parse_cross(const char *s)
+{
+  for (int i = 0; i < CROSS_COUNT; i++)
+    if (strcmp(s, cross_names[i]) == 0) return i;
+  return -1;
+}
+
+static inline void queue_push(Queue *qu, int c)
+{
+  if (qu->in[c]) return;
+  qu->q[qu->tail] = c;
+  qu->tail = (qu->tail + 1) % qu->n;
+  qu->len++;
+  qu->in[c] = 1;
+}
+
+static inline int queue_pop(Queue *qu)
+{
+  const int c = qu->q[qu->head];
+  qu->head = (qu->head + 1) % qu->n;
+  qu->len--;
+  qu->in[c] = 0;
+  return c;
+}
+
+double route_length(const DistTable *dt, const int *route, int n)
+{
+  double sum = 0;
+  for (int i = 0; i < n; i++) sum += dt_get(dt, route[i], route[(i+1)%n]);
+  return sum;
+}
+
+void shuffle(int *a, int m, Rng *rng)
+{
+  for (int i = m - 1; i > 0; i--) {
+    const int j = rng_int(rng, i + 1);
+    const int t = a[i];
+    a[i] = a[j];
+    a[j] = t;
+  }
+}
+
+// 位置 i から前向きに位置 j までを反転する。外側を反転しても同じ巡回路になるので、短い方を反転する
+static void reverse_segment(int *route, int *pos, int n, int i, int j)
+{
+  int len = (j - i + n) % n + 1;
+  if (2 * len > n) {
+    const int t = i;
+    i = (j + 1) % n;
+    j = (t + n - 1) % n;
+    len = n - len;
+  }
+  for (int k = 0; k < len / 2; k++) {
+    const int a = route[i], b = route[j];
+    route[i] = b;
+    pos[b] = i;
+    route[j] = a;
+    pos[a] = j;
+    i = (i + 1 == n) ? 0 : i + 1;
+    j = (j == 0) ? n - 1 : j - 1;
+  }
+}
+
+// 待ち行列に入っている都市のまわりだけ 2-opt をかける (don't-look bits)
+// 都市 a と隣の b の辺を外し、a の候補 c と c の同じ側の隣 d の辺につなぎかえる。d(a, c) < d(a, b) の c だけを試す
+void two_opt(Island *is, int *route)
+{
+  const DistTable *dt = is->dt;
+  const int n = is->n, k = is->cand->k;
+  int *pos = is->pos;
+  for (int i = 0; i < n; i++) pos[route[i]] = i;
+  while (is->qu.len > 0) {
+    const int a = queue_pop(&is->qu);
+    int moved = 0;
+    for (int dir = 0; dir < 2 && !moved; dir++) {
+      const int pa = pos[a];
+      const int b = (dir == 0) ? route[(pa + 1) % n] : route[(pa + n - 1) % n];
+      const double dab = dt_get(dt, a, b);
+      for (int t = 0; t < k; t++) {
+        const int c = is->cand->nb[(size_t)a * k + t];
+        const double dac = dt_get(dt, a, c);
+        if (dac >= dab) break;
+        const int pc = pos[c];
+        const int d = (dir == 0) ? route[(pc + 1) % n] : route[(pc + n - 1) % n];
+        if (d == a) continue;
+        if (dac + dt_get(dt, b, d) - dab - dt_get(dt, c, d) < -1e-9) {
+          // 前向きなら b..c、後ろ向きなら a..d を反転すると (a, c) と (b, d) がつながる
+          if (dir == 0) reverse_segment(route, pos, n, pos[b], pc);
+          else reverse_segment(route, pos, n, pa, pos[d]);
+          queue_push(&is->qu, a);
+          queue_push(&is->qu, b);
+          queue_push(&is->qu, c);
+          queue_push(&is->qu, d);
+          moved = 1;
+          break;
+        }
+      }
+    }
+  }
+}
+
+// 巡回路から隣の都市の表を作る
+static void route_links(const int *route, int n, int *link)
+{
+  for (int i = 0; i < n; i++) {
+    link[2 * route[i]] = route[(i + n - 1) % n];
+    link[2 * route[i] + 1] = route[(i + 1) % n];
+  }
+}
+
+static inline int has_link(const int *link, int v, int u)
+{
+  return link[2 * v] == u || link[2 * v + 1] == u;
+}
+
+// v の隣の from を to に変える
+static inline void relink(int *link, int v, int from, int to)
+{
+  if (link[2 * v] == from) link[2 * v] = to;
+  else link[2 * v + 1] = to;
+}
+
+// 順序交叉 (OX)。A の区間を子の先頭にそのまま置き、残りの都市を B で区間の最後の都市の次から順に並べる
+void cross_ox(Island *is, const Individual *a, const Individual *b, Individual *kid)
+{
+  const int n = is->n;
+  int *pos_b = is->pos;
+  for (int i = 0; i < n; i++) pos_b[b->route[i]] = i;
+  memset(is->mark, 0, n);
+  const int i0 = rng_int(&is->rng, n), len = 1 + rng_int(&is->rng, n - 1);
+  for (int k = 0; k < len; k++) {
+    const int c = a->route[(i0 + k) % n];
+    kid->route[k] = c;
+    is->mark[c] = 1;
+  }
+  int p = len;
+  const int start = pos_b[kid->route[len - 1]];
+  for (int k = 1; k < n; k++) {
+    const int c = b->route[(start + k) % n];
+    if (!is->mark[c]) kid->route[p++] = c;
+  }
+  // どちらの親にもない辺の端だけを 2-opt で調べる
+  for (int k = 0; k < n; k++) {
+    const int u = kid->route[k], v = kid->route[(k + 1) % n];
+    if (has_link(is->link_a, u, v) || has_link(is->link_b, u, v)) continue;
+    queue_push(&is->qu, u);
+    queue_push(&is->qu, v);
+  }
+  two_opt(is, kid->route);
+  kid->len = route_length(is->dt, kid->route, n);
+}
+
+// 親 A (link_a) と B (link_b) の AB-cycle を全部作り、数を返す
+// 両方にある辺を除いた残りの辺を、A の辺、B の辺、A の辺、… と乱数で選びながらたどり、
+// 同じ都市に同じ偶奇の位置で戻ってきたら、その間を AB-cycle として取り出す。
+// A だけの辺と B だけの辺の数はどの都市でも同じなので、たどっている途中で行き止まりにはならない
+int ab_cycles(Island *is)
+{
+  const int n = is->n;
+  int *rest = is->rest, *path = is->path, *seen = is->seen;
+  for (int v = 0; v < n; v++) {
+    for (int s = 0; s < 2; s++) {
+      const int ua = is->link_a[2 * v + s], ub = is->link_b[2 * v + s];
+      rest[4 * v + s] = has_link(is->link_b, v, ua) ? -1 : ua;
+      rest[4 * v + 2 + s] = has_link(is->link_a, v, ub) ? -1 : ub;
+    }
+    seen[2 * v] = seen[2 * v + 1] = -1;
+  }
+  is->ncyc = 0;
+  is->cyc_start[0] = 0;
+  const int r = rng_int(&is->rng, n);
+  for (int t = 0; t < n; t++) {
+    const int s = (r + t) % n;
+    if (rest[4 * s] < 0 && rest[4 * s + 1] < 0) continue;
+    int len = 1;
+    path[0] = s;
+    seen[2 * s] = 0;
+    while (len > 1 || rest[4 * s] >= 0 || rest[4 * s + 1] >= 0) {
+      // 奇数本目 (位置 len - 1 が偶数) は A の辺
+      const int v = path[len - 1], type = (len - 1) & 1;
+      int *e = rest + 4 * v + 2 * type;
+      assert(e[0] >= 0 || e[1] >= 0);
+      const int side = (e[0] < 0) ? 1 : (e[1] < 0) ? 0 : rng_int(&is->rng, 2);
+      const int u = e[side];
+      e[side] = -1;
+      int *f = rest + 4 * u + 2 * type;
+      f[(f[0] == v) ? 0 : 1] = -1;
+
+      const int p = seen[2 * u + (len & 1)];
+      if (p < 0) {
+        seen[2 * u + (len & 1)] = len;
+        path[len++] = u;
+        continue;
+      }
+      // path[p..len-1] が AB-cycle。A の辺から始まるようにそろえて取り出す
+      int *c = is->cyc + is->cyc_start[is->ncyc];
+      const int m = len - p;
+      for (int i = 0; i < m; i++) c[i] = path[p + ((p & 1) + i) % m];
+      is->cyc_start[is->ncyc + 1] = is->cyc_start[is->ncyc] + m;
+      is->ncyc++;
+      for (int i = p + 1; i < len; i++) seen[2 * path[i] + (i & 1)] = -1;
+      len = p + 1;
+    }
+    seen[2 * s] = -1;
+  }
+  return is->ncyc;
+}
+
+// 部分巡回路 u0 の都市をすべて label にする
+static void relabel(Island *is, int u0, int label)
+{
+  int prev = is->link[2 * u0 + 1], u = u0;
+  do {
+    is->comp[u] = label;
+    const int next = (is->link[2 * u] != prev) ? is->link[2 * u] : is->link[2 * u + 1];
+    prev = u;
+    u = next;
+  } while (u != u0);
+}
+
+// 部分巡回路 U (都市 u0 を含む) の辺 (u, u2) と、ほかの部分巡回路の辺 (v, v2) を外して2辺でつなぐ方法のうち一番短くなるものを探す
+// v は u の候補リストから選ぶ。見つからなければ (候補がみな U の中なら) 全部の都市を調べる
+static void find_merge(Island *is, int u0, int *best_u, int *best_v, int *best_u2, int *best_v2, int *cross)
+{
+  const DistTable *dt = is->dt;
+  const int n = is->n, k = is->cand->k, label = is->comp[u0];
+  double best = 1e300;
+  for (int all = 0; all < 2 && best == 1e300; all++) {
+    int prev = is->link[2 * u0 + 1], u = u0;
+    do {
+      const int m = all ? n : k;
+      for (int t = 0; t < m; t++) {
+        const int v = all ? t : is->cand->nb[(size_t)u * k + t];
+        if (is->comp[v] == label) continue;
+        for (int s = 0; s < 2; s++) {
+          const int u2 = is->link[2 * u + s];
+          for (int r = 0; r < 2; r++) {
+            const int v2 = is->link[2 * v + r];
+            const double base = dt_get(dt, u, u2) + dt_get(dt, v, v2);
+            const double d1 = dt_get(dt, u, v) + dt_get(dt, u2, v2) - base;
+            const double d2 = dt_get(dt, u, v2) + dt_get(dt, u2, v) - base;
+            if (d1 < best) {
+              best = d1;
+              *best_u = u; *best_u2 = u2; *best_v = v; *best_v2 = v2; *cross = 0;
+            }
+            if (d2 < best) {
+              best = d2;
+              *best_u = u; *best_u2 = u2; *best_v = v; *best_v2 = v2; *cross = 1;
+            }
+          }
+        }
+      }
+      const int next = (is->link[2 * u] != prev) ? is->link[2 * u] : is->link[2 * u + 1];
+      prev = u;
+      u = next;
+    } while (u != u0);
+  }
+}
+
+// 親 A に k 番目の AB-cycle を当てはめた子を作る
+// AB-cycle の A の辺を外して B の辺を足すと、各都市の次数は2のままだが、いくつかの部分巡回路に分かれることがある。
+// 一番小さい部分巡回路から順に、ほかの部分巡回路と2辺の入れ替えでつないで1つにし、変わった都市のまわりを 2-opt で磨く
+void eax_child(Island *is, int k, Individual *kid)
+{
+  const int n = is->n;
+  int *link = is->link;
+  memcpy(link, is->link_a, sizeof(int) * 2 * n);
+  const int *c = is->cyc + is->cyc_start[k];
+  const int m = is->cyc_start[k + 1] - is->cyc_start[k];
+  for (int j = 0; j < m; j += 2) {
+    // c[j]-c[j+1] は A の辺、c[j+1]-c[j+2] は B の辺
+    relink(link, c[j + 1], c[j], c[(j + 2) % m]);
+    relink(link, c[(j + 2) % m], c[(j + 3) % m], c[j + 1]);
+    queue_push(&is->qu, c[j]);
+    queue_push(&is->qu, c[j + 1]);
+  }
+
+  // 部分巡回路に分ける
+  int ncomp = 0;
+  for (int v = 0; v < n; v++) is->comp[v] = -1;
+  for (int v = 0; v < n; v++) {
+    if (is->comp[v] >= 0) continue;
+    relabel(is, v, ncomp);
+    is->comp_rep[ncomp++] = v;
+  }
+  if (ncomp > 1) {
+    for (int i = 0; i < ncomp; i++) is->comp_size[i] = 0;
+    for (int v = 0; v < n; v++) is->comp_size[is->comp[v]]++;
+  }
+  for (int left = ncomp; left > 1; left--) {
+    int small = -1;
+    for (int i = 0; i < ncomp; i++)
+      if (is->comp_size[i] > 0 && (small < 0 || is->comp_size[i] < is->comp_size[small])) small = i;
+    int u = 0, v = 0, u2 = 0, v2 = 0, cross = 0;
+    find_merge(is, is->comp_rep[small], &u, &v, &u2, &v2, &cross);
+    const int label = is->comp[v];
+    relabel(is, u, label);
+    is->comp_size[label] += is->comp_size[small];
+    is->comp_size[small] = 0;
+    if (cross) {
+      const int t = v;
+      v = v2;
+      v2 = t;
+    }
+    // (u, u2), (v, v2) を外して (u, v), (u2, v2) をつなぐ
+    relink(link, u, u2, v);
+    relink(link, u2, u, v2);
+    relink(link, v, v2, u);
+    relink(link, v2, v, u2);
+    queue_push(&is->qu, u);
+    queue_push(&is->qu, u2);
+    queue_push(&is->qu, v);
+    queue_push(&is->qu, v2);
+  }
+
+  // 隣の表から巡回路に戻す
+  int prev = link[1], u = 0;
+  for (int i = 0; i < n; i++) {
+    kid->route[i] = u;
+    const int next = (link[2 * u] != prev) ? link[2 * u] : link[2 * u + 1];
+    prev = u;
+    u = next;
+  }
+  two_opt(is, kid->route);
+  kid->len = route_length(is->dt, kid->route, n);
+}
+
+// 1世代分。個体の順番を乱数で並べ、i 番目を親 A、その次を親 B にして子を作る。
+// 一番良い子が A より短ければ A と入れ替える (B は次の組の A になる)
+void ga_generation(Island *is)
+{
+  const int size = is->size;
+  shuffle(is->order, size, &is->rng);
+  for (int i = 0; i < size; i++) {
+    Individual *a = &is->ind[is->order[i]], *b = &is->ind[is->order[(i + 1) % size]];
+    Individual *kid = &is->ind[size], *best = &is->ind[size + 1];
+    best->len = a->len * (1 - GA_EPS);
+    int found = 0;
+    route_links(a->route, is->n, is->link_a);
+    route_links(b->route, is->n, is->link_b);
+    int kids = GA_KIDS;
+    if (is->cross == CROSS_EAX) {
+      kids = min(kids, ab_cycles(is));
+      for (int t = 0; t < is->ncyc; t++) is->cyc_order[t] = t;
+      // 使う AB-cycle を乱数で選ぶ (先頭の kids 個だけ並べ替えればよい)
+      for (int t = 0; t < kids; t++) {
+        const int j = t + rng_int(&is->rng, is->ncyc - t);
+        const int x = is->cyc_order[t];
+        is->cyc_order[t] = is->cyc_order[j];
+        is->cyc_order[j] = x;
+      }
+    }
+    for (int t = 0; t < kids; t++) {
+      if (is->cross == CROSS_EAX) eax_child(is, is->cyc_order[t], kid);
+      else cross_ox(is, a, b, kid);
+      if (kid->len < best->len) {
+        const Individual x = *kid;
+        *kid = *best;
+        *best = x;
+        found = 1;
+      }
+    }
+    if (found) {
+      const Individual x = *a;
+      *a = *best;
+      *best = x;
+    }
+  }
+}
+
+// 一番短い (worst なら長い) 個体の番号
+static int island_pick(const Island *is, int worst)
+{
+  int k = 0;
+  for (int i = 1; i < is->size; i++)
+    if (worst ? is->ind[i].len > is->ind[k].len : is->ind[i].len < is->ind[k].len) k = i;
+  return k;
+}
+
+// 全員が止まっている間に1スレッドだけで呼ぶ
+// 最良解を更新して止めるかどうか決め、島 k の最良の個体を島 k+1 の一番悪い個体に上書きする (同じ長さの個体がいなければ)
+void ga_exchange(Ga *ga)
+{
+  const int n = ga->n;
+  const double before = ga->best;
+  ga->generation += ga->gens;
+  int *from = (int*)malloc(sizeof(int) * ga->nisland);
+  for (int k = 0; k < ga->nisland; k++) {
+    Island *is = &ga->is[k];
+    from[k] = island_pick(is, 0);
+    if (is->ind[from[k]].len < ga->best) {
+      ga->best = is->ind[from[k]].len;
+      memcpy(ga->best_route, is->ind[from[k]].route, sizeof(int) * n);
+    }
+  }
+  ga->stall = (ga->best < before * (1 - GA_EPS)) ? 0 : ga->stall + 1;
+  if (ga->best <= ga->rule->stop_at) ga->rule->reason = "gap";
+  else if (stop_time_up(ga->rule)) ga->rule->reason = "deadline";
+  else if (ga->generation >= ga->generations) ga->rule->reason = "generations";
+  else if (ga->stall >= GA_STALL) ga->rule->reason = "stall";
+  ga->stop = (ga->rule->reason != NULL);
+  ga->gens = min(GA_MIGRATE, ga->generations - ga->generation);
+
+  for (int k = 0; ga->nisland > 1 && !ga->stop && k < ga->nisland; k++) {
+    const Individual *src = &ga->is[k].ind[from[k]];
+    Island *dst = &ga->is[(k + 1) % ga->nisland];
+    int same = 0;
+    for (int i = 0; i < dst->size; i++)
+      if (fabs(dst->ind[i].len - src->len) <= GA_EPS * src->len) same = 1;
+    Individual *w = &dst->ind[island_pick(dst, 1)];
+    if (same || w->len <= src->len) continue;
+    memcpy(w->route, src->route, sizeof(int) * n);
+    w->len = src->len;
+  }
+  free(from);
+}
+
+typedef struct {
+  Ga *ga;
+  int id;
+} GaWorker;
+
+void *ga_worker(void *arg)
+{
+  GaWorker *w = (GaWorker*)arg;
+  Ga *ga = w->ga;
+  Island *is = &ga->is[w->id];
+  // 初期の個体は乱数の巡回路を 2-opt で磨いたもの
+  for (int i = 0; i < is->size; i++) {
+    int *route = is->ind[i].route;
+    for (int c = 0; c < is->n; c++) route[c] = c;
+    shuffle(route, is->n, &is->rng);
+    for (int c = 0; c < is->n; c++) queue_push(&is->qu, route[c]);
+    two_opt(is, route);
+    is->ind[i].len = route_length(is->dt, route, is->n);
+  }
+  for (;;) {
+    pthread_barrier_wait(&ga->barrier);
+    if (w->id == 0) ga_exchange(ga);
+    pthread_barrier_wait(&ga->barrier);
+    if (ga->stop) break; // 全員が同じ回で見る
+    for (int g = 0; g < ga->gens; g++) ga_generation(is);
+  }
+  return NULL;
+}
+
+// 島を nisland 個 (1スレッドに1つ) 作り、それぞれ size 個体で generations 世代まで進める。rule の目標か制限時間に達したら途中でも止める
+double solve_ga(const City *city, const DistTable *dt, const Cand *cand, int n, int *route, int nisland, int size, int generations,
+                uint64_t seed, int cross, StopRule *rule)
+{
+  Ga ga = {.nisland = nisland, .n = n, .generations = generations, .best = 1e300, .rule = rule};
+  ga.is = (Island*)malloc(sizeof(Island) * nisland);
+  ga.best_route = (int*)malloc(sizeof(int) * n);
+  // 個体のプール (子の作業用の2個分も含めて、全部の島の分を一度に確保する)
+  const size_t per = (size_t)(size + 2) * n;
+  ga.pool = (int*)malloc(sizeof(int) * per * nisland);
+
+  for (int k = 0; k < nisland; k++) {
+    Island *is = &ga.is[k];
+    *is = (Island){.dt = dt, .cand = cand, .n = n, .size = size, .cross = cross};
+    // 島の番号ごとに乱数を初期化するので、スレッドの動く順によらず同じ結果になる
+    is->rng = rng_init(seed ^ ((uint64_t)k * 0xd1342543de82ef95ULL));
+    is->ind = (Individual*)malloc(sizeof(Individual) * (size + 2));
+    for (int i = 0; i < size + 2; i++) is->ind[i] = (Individual){.route = ga.pool + per * k + (size_t)i * n, .len = 1e300};
+    is->order = (int*)malloc(sizeof(int) * size);
+    for (int i = 0; i < size; i++) is->order[i] = i;
+    is->pos = (int*)malloc(sizeof(int) * n);
+    is->qu = (Queue){.q = (int*)malloc(sizeof(int) * n), .in = (char*)calloc(n, sizeof(char)), .n = n};
+    is->mark = (char*)malloc(n);
+    is->link_a = (int*)malloc(sizeof(int) * 2 * n);
+    is->link_b = (int*)malloc(sizeof(int) * 2 * n);
+    is->link = (int*)malloc(sizeof(int) * 2 * n);
+    is->rest = (int*)malloc(sizeof(int) * 4 * n);
+    // A だけの辺と B だけの辺はあわせて 2n 本以下
+    is->path = (int*)malloc(sizeof(int) * (2 * n + 1));
+    is->seen = (int*)malloc(sizeof(int) * 2 * n);
+    is->cyc = (int*)malloc(sizeof(int) * 2 * n);
+    is->cyc_start = (int*)malloc(sizeof(int) * (n + 1));
+    is->cyc_order = (int*)malloc(sizeof(int) * n);
+    is->comp = (int*)malloc(sizeof(int) * n);
+    is->comp_size = (int*)malloc(sizeof(int) * n);
+    is->comp_rep = (int*)malloc(sizeof(int) * n);
+  }
+
+  pthread_barrier_init(&ga.barrier, NULL, nisland);
+  pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nisland);
+  GaWorker *w = (GaWorker*)malloc(sizeof(GaWorker) * nisland);
+  for (int k = 0; k < nisland; k++) {
+    w[k] = (GaWorker){.ga = &ga, .id = k};
+    pthread_create(&th[k], NULL, ga_worker, &w[k]);
+  }
+  for (int k = 0; k < nisland; k++) pthread_join(th[k], NULL);
+  pthread_barrier_destroy(&ga.barrier);
+  fprintf(stderr, "%d generations (%s)\n", ga.generation, rule->reason);
+
+  // 都市 0 から始まるように回し、長さは表を使わずに計算しなおす
+  int s = 0;
+  while (ga.best_route[s] != 0) s++;
+  for (int i = 0; i < n; i++) route[i] = ga.best_route[(s + i) % n];
+  double best = 0;
+  for (int i = 0; i < n; i++) best += distance(city[route[i]], city[route[(i+1)%n]]);
+
+  for (int k = 0; k < nisland; k++) {
+    Island *is = &ga.is[k];
+    free(is->ind);
+    free(is->order);
+    free(is->pos);
+    free(is->qu.q);
+    free(is->qu.in);
+    free(is->mark);
+    free(is->link_a);
+    free(is->link_b);
+    free(is->link);
+    free(is->rest);
+    free(is->path);
+    free(is->seen);
+    free(is->cyc);
+    free(is->cyc_start);
+    free(is->cyc_order);
+    free(is->comp);
+    free(is->comp_size);
+    free(is->comp_rep);
+  }
+  free(th);
+  free(w);
+  free(ga.is);
+  free(ga.pool);
+  free(ga.best_route);
+  return best;
+}
@@ -0,0 +1,466 @@
+/*
+
+  山登り法 (tsp1.c, bench.c で共通)
+  hc_calc() が初期解1つ分の探索。2都市の入れ替え・Or-opt・区間挿入の 3-opt を、都市ごとに最初に見つかった改善で進める
+  入れ替えの差分は座標を巡回路の順に並べて SIMD 命令 (AVX2, AVX-512) でまとめて計算し、ふるいにかける
+  使う命令は simd_init() で実行時に選ぶ (呼ばなければスカラー版)
+
+*/
+
+#ifndef TSP_HC_H
+#define TSP_HC_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h> // AVX2, AVX-512
+#endif
+#include "tsp_city.h"
+#include "tsp_dist.h"
+
+// 座標の SoA (詳しくは coords_init() の前のコメントを参照)
+typedef struct {
+  int n;
+  float *x; // 64byte 境界にそろえてある
+  float *y;
+} Coords;
+
+// 近傍 (移動の種類)。カンマ区切りで組み合わせられ、そのときは都市ごとにこの順に試して最初に見つかった改善を採用する
+// HC_MOVE_SWAP : 2都市の入れ替え
+// HC_MOVE_OROPT: Or-opt。1〜3都市の区間を、区間の端の近くの都市の隣へ (逆向きにもして) 移す
+// HC_MOVE_3OPT : 区間挿入の 3-opt。両端の新しい辺がどちらも候補リストの辺になるような、長さを決めない区間を移す
+// 位置 0 の都市 (都市 0) は動かさない
+enum { HC_MOVE_SWAP, HC_MOVE_OROPT, HC_MOVE_3OPT, HC_MOVE_COUNT };
+static const char *const hc_move_names[HC_MOVE_COUNT] = {"swap", "oropt", "3opt"};
+
+// 座標の SoA (x[] と y[] を別々の float 配列にしたもの)
+// 巡回路の順に並べておくと、位置 j とその前後の都市の座標を位置だけから読めるので、
+// ある位置 i に対する入れ替えの差分を、いくつかの j についてまとめて SIMD 命令で計算できる
+// x[n], y[n] には先頭 (都市 0) の座標をもう一度入れておく (巡回路の最後の辺のため)
+static inline Coords coords_init(const City *city, int n, const int *route)
+{
+  // AVX-512 で1度に読む 16 個単位に切り上げ、64byte 境界にそろえる
+  const size_t len = ((size_t)n + 1 + 15) / 16 * 16;
+  Coords c = {.n = n,
+              .x = (float*)aligned_alloc(CACHE_LINE, sizeof(float) * len),
+              .y = (float*)aligned_alloc(CACHE_LINE, sizeof(float) * len)};
+  for (size_t k = 0; k < len; k++) {
+    const int i = (k < (size_t)n) ? route[k] : route[0];
+    c.x[k] = city[i].x;
+    c.y[k] = city[i].y;
+  }
+  return c;
+}
+
+static inline void free_coords(Coords c)
+{
+  free(c.x);
+  free(c.y);
+}
+
+static inline float distf(float ax, float ay, float bx, float by)
+{
+  return sqrtf((ax - bx) * (ax - bx) + (ay - by) * (ay - by));
+}
+
+// 位置 i と位置 js[t] (0 <= t < m) の都市を入れ替えたときの距離の変化を out[t] に入れる
+// 1 <= i, 1 <= js[t] <= n - 1。隣り合う j (|i - j| <= 1) の値は使えない (呼び出し側で swap_delta を使う)
+// float で計算するので、最終的な判定には swap_delta を使う
+// j は候補リストから選ぶと飛び飛びになるので、座標は gather 命令で集める
+static inline void swap_delta_block_scalar(const Coords *c, int i, const int *js, int m, float *out)
+{
+  const float ax = c->x[i], ay = c->y[i];
+  const float pax = c->x[i-1], pay = c->y[i-1];
+  const float nax = c->x[i+1], nay = c->y[i+1];
+  const float base = distf(pax, pay, ax, ay) + distf(ax, ay, nax, nay);
+  for (int t = 0; t < m; t++) {
+    const int j = js[t];
+    const float bx = c->x[j], by = c->y[j];
+    const float pbx = c->x[j-1], pby = c->y[j-1];
+    const float nbx = c->x[j+1], nby = c->y[j+1];
+    out[t] = distf(pax, pay, bx, by) + distf(bx, by, nax, nay)
+           + distf(pbx, pby, ax, ay) + distf(ax, ay, nbx, nby)
+           - base - distf(pbx, pby, bx, by) - distf(bx, by, nbx, nby);
+  }
+}
+
+#if defined(SIMD_X86) && !defined(NO_SIMD)
+__attribute__((target("avx2,fma")))
+static inline __m256 dist8(__m256 ax, __m256 ay, __m256 bx, __m256 by)
+{
+  const __m256 dx = _mm256_sub_ps(ax, bx);
+  const __m256 dy = _mm256_sub_ps(ay, by);
+  return _mm256_sqrt_ps(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline void swap_delta_block_avx2(const Coords *c, int i, const int *js, int m, float *out)
+{
+  const __m256 ax = _mm256_set1_ps(c->x[i]), ay = _mm256_set1_ps(c->y[i]);
+  const __m256 pax = _mm256_set1_ps(c->x[i-1]), pay = _mm256_set1_ps(c->y[i-1]);
+  const __m256 nax = _mm256_set1_ps(c->x[i+1]), nay = _mm256_set1_ps(c->y[i+1]);
+  const __m256 base = _mm256_add_ps(dist8(pax, pay, ax, ay), dist8(ax, ay, nax, nay));
+  const __m256i one = _mm256_set1_epi32(1);
+  int t = 0;
+  for (; t + 8 <= m; t += 8) {
+    const __m256i j = _mm256_loadu_si256((const __m256i*)(js + t));
+    const __m256i pj = _mm256_sub_epi32(j, one), nj = _mm256_add_epi32(j, one);
+    const __m256 bx = _mm256_i32gather_ps(c->x, j, 4), by = _mm256_i32gather_ps(c->y, j, 4);
+    const __m256 pbx = _mm256_i32gather_ps(c->x, pj, 4), pby = _mm256_i32gather_ps(c->y, pj, 4);
+    const __m256 nbx = _mm256_i32gather_ps(c->x, nj, 4), nby = _mm256_i32gather_ps(c->y, nj, 4);
+    __m256 add = _mm256_add_ps(dist8(pax, pay, bx, by), dist8(bx, by, nax, nay));
+    add = _mm256_add_ps(add, _mm256_add_ps(dist8(pbx, pby, ax, ay), dist8(ax, ay, nbx, nby)));
+    __m256 sub = _mm256_add_ps(dist8(pbx, pby, bx, by), dist8(bx, by, nbx, nby));
+    sub = _mm256_add_ps(sub, base);
+    _mm256_storeu_ps(out + t, _mm256_sub_ps(add, sub));
+  }
+  if (t < m) swap_delta_block_scalar(c, i, js + t, m - t, out + t);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 dist16(__m512 ax, __m512 ay, __m512 bx, __m512 by)
+{
+  const __m512 dx = _mm512_sub_ps(ax, bx);
+  const __m512 dy = _mm512_sub_ps(ay, by);
+  return _mm512_sqrt_ps(_mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy)));
+}
+
+// 端数はマスク付きの読み書きで処理する
+__attribute__((target("avx512f")))
+static inline void swap_delta_block_avx512(const Coords *c, int i, const int *js, int m, float *out)
+{
+  const __m512 ax = _mm512_set1_ps(c->x[i]), ay = _mm512_set1_ps(c->y[i]);
+  const __m512 pax = _mm512_set1_ps(c->x[i-1]), pay = _mm512_set1_ps(c->y[i-1]);
+  const __m512 nax = _mm512_set1_ps(c->x[i+1]), nay = _mm512_set1_ps(c->y[i+1]);
+  const __m512 base = _mm512_add_ps(dist16(pax, pay, ax, ay), dist16(ax, ay, nax, nay));
+  const __m512i one = _mm512_set1_epi32(1);
+  for (int t = 0; t < m; t += 16) {
+    const int rest = m - t;
+    const __mmask16 k = (rest >= 16) ? 0xffff : (__mmask16)((1u << rest) - 1);
+    // 使わない要素は j = 1 にしておく (どこを読んでも範囲内になる)
+    const __m512i j = _mm512_mask_loadu_epi32(one, k, js + t);
+    const __m512i pj = _mm512_sub_epi32(j, one), nj = _mm512_add_epi32(j, one);
+    const __m512 bx = _mm512_i32gather_ps(j, c->x, 4), by = _mm512_i32gather_ps(j, c->y, 4);
+    const __m512 pbx = _mm512_i32gather_ps(pj, c->x, 4), pby = _mm512_i32gather_ps(pj, c->y, 4);
+    const __m512 nbx = _mm512_i32gather_ps(nj, c->x, 4), nby = _mm512_i32gather_ps(nj, c->y, 4);
+    __m512 add = _mm512_add_ps(dist16(pax, pay, bx, by), dist16(bx, by, nax, nay));
+    add = _mm512_add_ps(add, _mm512_add_ps(dist16(pbx, pby, ax, ay), dist16(ax, ay, nbx, nby)));
+    __m512 sub = _mm512_add_ps(dist16(pbx, pby, bx, by), dist16(bx, by, nbx, nby));
+    sub = _mm512_add_ps(sub, base);
+    _mm512_mask_storeu_ps(out + t, k, _mm512_sub_ps(add, sub));
+  }
+}
+#endif
+
+// 実行時に CPU を調べて一番広い命令を選ぶ (-DNO_SIMD なら常にスカラー版)
+typedef void (*SwapDeltaBlockFunc)(const Coords *c, int i, const int *js, int m, float *out);
+static SwapDeltaBlockFunc swap_delta_block = swap_delta_block_scalar;
+
+static inline const char *simd_init(void)
+{
+#if defined(SIMD_X86) && !defined(NO_SIMD)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    swap_delta_block = swap_delta_block_avx512;
+    return "avx512";
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    swap_delta_block = swap_delta_block_avx2;
+    return "avx2";
+  }
+#endif
+  swap_delta_block = swap_delta_block_scalar;
+  return "scalar";
+}
+
+static inline void swap_float(float *a, float *b) {
+  float temp = *a;
+  *a = *b;
+  *b = temp;
+}
+
+// 位置 i と j (1 <= i, j < n, i != j) の都市を入れ替えたときの距離の変化
+// route は書き換えずに、変わる辺だけから計算する
+static inline len_t swap_delta(const DistTable *dt, const int *route, int n, int i, int j) {
+  if (i > j) swap(&i, &j);
+  const int a = route[i], b = route[j];
+  const int pa = route[i-1], nb = route[(j+1)%n];
+  if (j == i + 1) { // 隣り合っている場合は間の辺は変わらない
+    return dt_get(dt, pa, b) + dt_get(dt, a, nb) - dt_get(dt, pa, a) - dt_get(dt, b, nb);
+  }
+  const int na = route[i+1], pb = route[j-1];
+  return dt_get(dt, pa, b) + dt_get(dt, b, na) + dt_get(dt, pb, a) + dt_get(dt, a, nb)
+       - dt_get(dt, pa, a) - dt_get(dt, a, na) - dt_get(dt, pb, b) - dt_get(dt, b, nb);
+}
+
+// 区間の移動: 位置 i から len 個の都市 (1 <= i, i + len <= n) を、位置 g と g + 1 の間 (g == n - 1 なら最後) へ移す
+// g は区間とその直前 (i - 1 .. i + len - 1) 以外。rev なら逆向きに入れる
+typedef struct {
+  int i, len, g, rev;
+} SegMove;
+
+// 区間を移したときの距離の変化。外す辺 3 本と足す辺 3 本だけから計算する
+static inline len_t segment_delta(const DistTable *dt, const int *route, int n, SegMove m)
+{
+  const int p = route[m.i-1], s1 = route[m.i], s2 = route[m.i+m.len-1], nx = route[(m.i+m.len)%n];
+  const int c = route[m.g], d = route[(m.g+1)%n];
+  const len_t add = m.rev ? dt_get(dt, c, s2) + dt_get(dt, s1, d) : dt_get(dt, c, s1) + dt_get(dt, s2, d);
+  return add + dt_get(dt, p, nx) - dt_get(dt, p, s1) - dt_get(dt, s2, nx) - dt_get(dt, c, d);
+}
+
+// 区間を実際に移す。間にある都市を memmove でずらし、位置が変わった都市だけ pos を直す
+// buf には len 個分の作業領域を渡す
+static inline void move_segment(int *route, int *pos, SegMove m, int *buf)
+{
+  memcpy(buf, route + m.i, sizeof(int) * m.len);
+  int at, k;
+  if (m.g > m.i) { // 後ろへ: i + len .. g を前に詰める
+    at = m.g - m.len + 1;
+    memmove(route + m.i, route + m.i + m.len, sizeof(int) * (at - m.i));
+    for (k = m.i; k < at; k++) pos[route[k]] = k;
+  } else {         // 前へ: g + 1 .. i - 1 を後ろにずらす
+    at = m.g + 1;
+    memmove(route + at + m.len, route + at, sizeof(int) * (m.i - at));
+    for (k = at + m.len; k < m.i + m.len; k++) pos[route[k]] = k;
+  }
+  for (k = 0; k < m.len; k++) {
+    route[at + k] = m.rev ? buf[m.len - 1 - k] : buf[k];
+    pos[route[at + k]] = at + k;
+  }
+}
+
+// 改善とみなす差分の下限。float の表から足し引きした誤差で、行ったり来たりしないようにする
+// SWAP_EPS は入れ替え、SEGMENT_EPS は区間の移動用。DIST_NINT なら誤差がないので 0
+#ifdef DIST_NINT
+#define SWAP_EPS 0
+#define SEGMENT_EPS 0
+#else
+#define SWAP_EPS 1e-15
+#define SEGMENT_EPS 1e-9
+#endif
+
+// Or-opt: 位置 i から始まる 1〜3 都市の区間を、区間の端の近くの都市の前か後ろへ、両方の向きで試す
+// 候補リストがなければ全部の位置を試す。改善が見つかれば *out に入れて 1 を返す。試した移動の数を *tried に足す
+static inline int find_oropt(const DistTable *dt, const Cand *cand, const int *route, const int *pos, int n, int i,
+                             SegMove *out, long *tried)
+{
+  for (int len = 1; len <= 3 && i + len <= n; len++) {
+    const int ends[2] = {route[i], route[i+len-1]};
+    const int m = (cand != NULL) ? 2 * cand->k : n;
+    for (int t = 0; t < m; t++) {
+      for (int side = 0; side < 2; side++) {
+        int g;
+        if (cand != NULL) {
+          const int y = cand->nb[ends[t / cand->k] * cand->k + t % cand->k];
+          g = (pos[y] - side + n) % n; // y の後ろ (side == 0) か前 (side == 1)
+        } else {
+          if (side == 1) break;
+          g = t;
+        }
+        if (g >= i - 1 && g <= i + len - 1) continue;
+        for (int rev = 0; rev < ((len > 1) ? 2 : 1); rev++) {
+          const SegMove mv = {.i = i, .len = len, .g = g, .rev = rev};
+          (*tried)++;
+          if (segment_delta(dt, route, n, mv) < -SEGMENT_EPS) {
+            *out = mv;
+            return 1;
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// 区間挿入の 3-opt: 位置 i から始まる区間を、直前の都市 p の近くの都市 y の手前まで伸ばし
+// (p と y がつながる)、区間の先頭の都市の近くの都市 z の隣へ移す (z と先頭がつながるように向きを決める)
+static inline int find_3opt(const DistTable *dt, const Cand *cand, const int *route, const int *pos, int n, int i,
+                            SegMove *out, long *tried)
+{
+  const int p = route[i-1], s1 = route[i];
+  const int m = (cand != NULL) ? cand->k : n;
+  for (int a = 0; a < m; a++) {
+    const int y = (cand != NULL) ? cand->nb[p * cand->k + a] : a;
+    const int e = (pos[y] == 0) ? n : pos[y]; // 区間は i .. e - 1
+    if (e <= i) continue;
+    for (int b = 0; b < m; b++) {
+      const int z = (cand != NULL) ? cand->nb[s1 * cand->k + b] : b;
+      for (int rev = 0; rev < 2; rev++) {
+        // 順向きなら z の後ろ、逆向きなら z の前に入れると z と区間の先頭がつながる
+        const int g = (pos[z] - rev + n) % n;
+        if (g >= i - 1 && g <= e - 1) continue;
+        const SegMove mv = {.i = i, .len = e - i, .g = g, .rev = rev};
+        (*tried)++;
+        if (segment_delta(dt, route, n, mv) < -SEGMENT_EPS) {
+          *out = mv;
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+#define SCREEN_BLOCK 64
+
+// 調べる都市の待ち行列 (リングバッファ)。in[c] は c が入っているかどうか
+typedef struct {
+  int *q;
+  char *in;
+  int head, tail, len, n;
+} Queue;
+
+static inline void queue_push(Queue *qu, int c)
+{
+  if (qu->in[c]) return;
+  qu->q[qu->tail] = c;
+  qu->tail = (qu->tail + 1) % qu->n;
+  qu->len++;
+  qu->in[c] = 1;
+}
+
+static inline int queue_pop(Queue *qu)
+{
+  const int c = qu->q[qu->head];
+  qu->head = (qu->head + 1) % qu->n;
+  qu->len--;
+  qu->in[c] = 0;
+  return c;
+}
+
+// 山登り法で初期解1つ分を探索する (tsp1.c)
+// route の巡回路から、moves の近傍で改善できなくなるまで続け、結果を route に入れて長さを返す
+// tried があれば、差分を計算した移動の回数を足す (入れ替えは、ふるいにかける前の組の数)
+static inline double hc_calc(const City *city, const DistTable *dt, const Cand *cand, int n, int moves, int *route,
+                             long *tried)
+{
+  // 都市数が多くてもスタックがあふれないようにヒープに確保する
+  int *pos = (int*)malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++) pos[route[i]] = i;
+  long count = 0;
+
+  // 入れ替えは、都市数が少なければ候補リストがあっても (区間の移動のために作ってあっても) 全部の組を試す
+  const Cand *swap_cand = (n >= CAND_MIN_CITIES) ? cand : NULL;
+  const int use_swap = moves & (1 << HC_MOVE_SWAP);
+  int *buf = (int*)malloc(sizeof(int) * n);
+
+  // 入れ替えの差分は、巡回路の順に並べた座標でまとめて計算してから、改善しそうなものだけを swap_delta で確かめる
+  // js[t] は t 番目に試す位置 (全部の組を試すときは t + 1)。候補リストの位置は cj[t] に入れてから js にも写す
+  // float の誤差で改善する入れ替えを見落とさないよう、座標の範囲に比例した余裕 tol をもたせてふるいにかける
+  Coords tc = {.n = 0, .x = NULL, .y = NULL};
+  float *screen = NULL;
+  int *js = NULL, *cj = NULL;
+  float tol = 0;
+  if (use_swap) {
+    tc = coords_init(city, n, route);
+    screen = (float*)malloc(sizeof(float) * n);
+    js = (int*)malloc(sizeof(int) * n);
+    for (int t = 0; t < n - 1; t++) js[t] = t + 1;
+    if (swap_cand != NULL) cj = (int*)malloc(sizeof(int) * 2 * swap_cand->k);
+    float lo = tc.x[0], hi = tc.x[0];
+    for (int k = 0; k < n; k++) {
+      lo = fminf(lo, fminf(tc.x[k], tc.y[k]));
+      hi = fmaxf(hi, fmaxf(tc.x[k], tc.y[k]));
+    }
+    tol = 1e-5f * fmaxf(1.0f, hi - lo);
+#ifdef DIST_NINT
+    tol += 4; // 変わる8辺がそれぞれ最大 0.5 ずつ丸められる
+#endif
+  }
+
+  // 調べる都市の待ち行列 (don't-look bits)
+  // 周りが変わっていない都市は、前に調べたときに改善がなかったならもう調べない
+  Queue qu = {.q = (int*)malloc(sizeof(int) * n), .in = (char*)calloc(n, sizeof(char)), .n = n};
+  for (int i = 1; i < n; i++) queue_push(&qu, route[i]);
+
+  while (qu.len > 0) {
+    const int c = queue_pop(&qu);
+    const int i = pos[c];
+    int moved = 0;
+    // 候補リストがあるときは、c の前後の都市の近くにある都市とだけ入れ替えを試す (2k 個をまとめて計算する)
+    // 候補リストがないときは全部の位置を SCREEN_BLOCK 個ずつ計算する。改善が見つかればそこで打ち切るので、先の分は計算しない
+    const int m = !use_swap ? 0 : (swap_cand != NULL) ? 2 * swap_cand->k : n - 1;
+    int screened = 0;
+    if (swap_cand != NULL && m > 0) {
+      for (int t = 0; t < m; t++) {
+        const int nb = (t < swap_cand->k) ? route[i-1] : route[(i+1)%n];
+        cj[t] = pos[swap_cand->nb[nb * swap_cand->k + t % swap_cand->k]];
+        js[t] = (cj[t] == 0) ? 1 : cj[t]; // 位置 0 とは入れ替えないので、読める位置にしておく
+      }
+      swap_delta_block(&tc, i, js, m, screen);
+      screened = m;
+    }
+    for (int t=0; t<m; t++) {
+      const int j = (cj != NULL) ? cj[t] : t + 1;
+      if (t >= screened) {
+        const int b = min(SCREEN_BLOCK, m - t);
+        swap_delta_block(&tc, i, js + t, b, screen + t);
+        screened = t + b;
+      }
+      if (j == 0 || j == i) continue;
+      count++;
+      if (abs(j - i) > 1 && screen[t] > tol) continue;
+
+      if (city[route[i]].x == city[route[j]].x && city[route[i]].y == city[route[j]].y)
+        continue;
+
+      // 入れ替えて距離が短くなったらすぐに採用する (first-improvement)
+      // ただし同じ位置に都市があり変化しない場合は0ではなく-1e16くらいになるので無視 (SWAP_EPS)
+      if (swap_delta(dt, route, n, i, j) < -SWAP_EPS) {
+        swap(&route[i], &route[j]);
+        pos[route[i]] = i;
+        pos[route[j]] = j;
+        swap_float(&tc.x[i], &tc.x[j]);
+        swap_float(&tc.y[i], &tc.y[j]);
+        // 入れ替えた2都市とその前後の都市は周りが変わったので、もう一度調べる
+        const int touched[6] = {route[i], route[i-1], route[(i+1)%n], route[j], route[j-1], route[(j+1)%n]};
+        for (int a = 0; a < 6; a++)
+          if (touched[a] != 0) queue_push(&qu, touched[a]);
+        moved = 1;
+        break;
+      }
+    }
+
+    // 入れ替えで改善しなければ、区間を移す近傍を試す
+    SegMove mv;
+    if (!moved && (((moves & (1 << HC_MOVE_OROPT)) && find_oropt(dt, cand, route, pos, n, i, &mv, &count)) ||
+                   ((moves & (1 << HC_MOVE_3OPT)) && find_3opt(dt, cand, route, pos, n, i, &mv, &count)))) {
+      // 外した辺と足した辺の端の都市は周りが変わったので、もう一度調べる
+      const int touched[6] = {route[mv.i-1], route[mv.i], route[mv.i+mv.len-1], route[(mv.i+mv.len)%n],
+                              route[mv.g], route[(mv.g+1)%n]};
+      move_segment(route, pos, mv, buf);
+      if (tc.x != NULL) {
+        for (int k = min(mv.i, mv.g + 1); k <= max(mv.i + mv.len - 1, mv.g); k++) {
+          tc.x[k] = city[route[k]].x;
+          tc.y[k] = city[route[k]].y;
+        }
+      }
+      for (int a = 0; a < 6; a++)
+        if (touched[a] != 0) queue_push(&qu, touched[a]);
+    }
+  }
+
+  free(pos);
+  free(buf);
+  free(qu.q);
+  free(qu.in);
+  if (tc.x != NULL) {
+    free_coords(tc);
+    free(screen);
+    free(js);
+    free(cj);
+  }
+  if (tried != NULL) *tried += count;
+
+  double sum_d = 0;
+  for (int i = 0 ; i < n ; i++){
+    const int c0 = route[i];
+    const int c1 = route[(i+1)%n]; // nは0に戻る
+    sum_d += city_dist(city[c0],city[c1]);
+  }
+  return sum_d;
+}
+
+#endif
@@ -0,0 +1,483 @@
+/*
+
+  初期解の作り方 (advance.c, advance_swap.c, bench.c, tsp1.c で共通)
+  build_route() で、ランダム・最近傍法・貪欲法・空間充填曲線・クリストフィデス法ふうのどれかで巡回路を作る
+  乱数は tsp_rng.h の Rng を使う (advance_swap.c は gen_random_route() だけを使う)
+
+*/
+
+#ifndef TSP_INIT_H
+#define TSP_INIT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tsp_rng.h"
+#include "tsp_city.h"
+#include "tsp_dist.h"
+
+// 初期解の作り方
+// INIT_RANDOM: 恒等順列を n 回の入れ替えでシャッフルする (gen_random_route)
+// INIT_NN    : 最近傍法。未訪問の都市を格子に入れておき、今いる都市の周りのセルから一番近いものを選ぶ
+// INIT_GREEDY: 貪欲法。候補リストの辺を短い順に見て、次数が2を超えず閉路もできない辺だけ採用する。
+//              残った断片は、端から一番近い別の断片の端へつなぐ
+// INIT_SFC   : 空間充填曲線 (ヒルベルト曲線) に沿った順に並べる
+// INIT_CHRIST: クリストフィデス法ふう。候補リストの辺での最小全域木に、奇数次の都市を近い順に組にした辺を足し、
+//              オイラー閉路をたどって2回目に来た都市を飛ばす (最小重み完全マッチングの代わりに貪欲なマッチング)
+// 開始都市・辺の長さ・曲線の位置に乱数で少し揺らぎを入れるので、初期解ごとに違う巡回路になる
+enum { INIT_RANDOM, INIT_NN, INIT_GREEDY, INIT_SFC, INIT_CHRIST, INIT_COUNT };
+static const char *init_names[INIT_COUNT] = {"random", "nn", "greedy", "sfc", "christofides"};
+
+static inline void gen_random_route(int n, int *route, Rng *rng) {
+
+  // 初期化
+  for (int i = 0 ; i < n ; i++){
+    route[i] = i;
+  }
+
+  // n回シャッフル
+  for (int i=0; i<n; i++) {
+    int j1 = rng_int(rng, n-1) + 1;
+    int j2 = rng_int(rng, n-1) + 1;
+    int temp = route[j1];
+    route[j1] = route[j2];
+    route[j2] = temp;
+  }
+
+}
+
+// 名前から初期解の作り方を選ぶ。知らない名前なら -1
+static inline int parse_init(const char *s)
+{
+  for (int i = 0; i < INIT_COUNT; i++)
+    if (strcmp(s, init_names[i]) == 0) return i;
+  return -1;
+}
+
+// 都市を入れておく格子 (取り除ける)
+// セル c に残っている都市は items[start[c]] から cnt[c] 個
+typedef struct {
+  int g;
+  int minx, miny;
+  double cw, ch;
+  int *start;
+  int *cnt;
+  int *items;
+  int *at;    // 都市 i の items での位置。入っていなければ -1
+  int left;   // 残っている都市の数
+} Grid;
+
+static inline int grid_cell(const Grid *gr, const City *city, int i)
+{
+  const int cx = (int)(((double)city[i].x - gr->minx) / gr->cw);
+  const int cy = (int)(((double)city[i].y - gr->miny) / gr->ch);
+  return min(cy, gr->g - 1) * gr->g + min(cx, gr->g - 1);
+}
+
+// ids の m 個の都市を入れた格子を作る (ids が NULL なら全都市)
+static inline Grid grid_init(const City *city, int n, const int *ids, int m)
+{
+  Grid gr;
+  gr.minx = city[0].x, gr.miny = city[0].y;
+  int maxx = city[0].x, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < gr.minx) gr.minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < gr.miny) gr.miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  // 1セルあたり2都市くらいになるようにする
+  gr.g = max(1, (int)sqrt(m / 2.0));
+  gr.cw = ((double)maxx - gr.minx + 1) / gr.g;
+  gr.ch = ((double)maxy - gr.miny + 1) / gr.g;
+  gr.start = (int*)calloc((size_t)gr.g * gr.g + 1, sizeof(int));
+  gr.cnt = (int*)calloc((size_t)gr.g * gr.g, sizeof(int));
+  gr.items = (int*)malloc(sizeof(int) * (m > 0 ? m : 1));
+  gr.at = (int*)malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++) gr.at[i] = -1;
+  for (int p = 0; p < m; p++) gr.cnt[grid_cell(&gr, city, ids ? ids[p] : p)]++;
+  for (int c = 0; c < gr.g * gr.g; c++) gr.start[c + 1] = gr.start[c] + gr.cnt[c];
+  memset(gr.cnt, 0, sizeof(int) * gr.g * gr.g);
+  for (int p = 0; p < m; p++) {
+    const int i = ids ? ids[p] : p;
+    const int c = grid_cell(&gr, city, i);
+    gr.at[i] = gr.start[c] + gr.cnt[c]++;
+    gr.items[gr.at[i]] = i;
+  }
+  gr.left = m;
+  return gr;
+}
+
+static inline void grid_free(Grid gr)
+{
+  free(gr.start);
+  free(gr.cnt);
+  free(gr.items);
+  free(gr.at);
+}
+
+// 都市 i を取り除く (セルの最後の都市を空いた場所に移す)
+static inline void grid_remove(Grid *gr, const City *city, int i)
+{
+  if (gr->at[i] < 0) return;
+  const int c = grid_cell(gr, city, i);
+  const int last = gr->items[gr->start[c] + --gr->cnt[c]];
+  gr->items[gr->at[i]] = last;
+  gr->at[last] = gr->at[i];
+  gr->at[i] = -1;
+  gr->left--;
+}
+
+// 都市 q に一番近い、格子に残っている都市。残っていなければ -1
+static inline int grid_nearest(const Grid *gr, const City *city, int q)
+{
+  if (gr->left == 0) return -1;
+  const int g = gr->g;
+  const int c0 = grid_cell(gr, city, q);
+  const int cx = c0 % g, cy = c0 / g;
+  int best = -1;
+  double best_d2 = 0;
+  for (int r = 0; r < g; r++) {
+    // 距離 r のセル (チェビシェフ距離) を1周分調べる
+    for (int y = cy - r; y <= cy + r; y++) {
+      if (y < 0 || y >= g) continue;
+      const int step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+      for (int x = cx - r; x <= cx + r; x += max(step, 1)) {
+        if (x < 0 || x >= g) continue;
+        const int c = y * g + x;
+        for (int p = gr->start[c]; p < gr->start[c] + gr->cnt[c]; p++) {
+          const int j = gr->items[p];
+          if (j == q) continue;
+          const double dx = (double)city[q].x - city[j].x;
+          const double dy = (double)city[q].y - city[j].y;
+          const double d2 = dx * dx + dy * dy;
+          if (best < 0 || d2 < best_d2) {
+            best = j;
+            best_d2 = d2;
+          }
+        }
+      }
+    }
+    // 次の周のセルはどれも r * (セルの短い辺) 以上離れている
+    const double reach = r * (gr->cw < gr->ch ? gr->cw : gr->ch);
+    if (best >= 0 && reach * reach > best_d2) break;
+  }
+  return best;
+}
+
+// 都市 0 が先頭に来るように回す
+static inline void rotate_to_zero(int *route, int n)
+{
+  int z = 0;
+  while (route[z] != 0) z++;
+  if (z == 0) return;
+  int *tmp = (int*)malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++) tmp[i] = route[(z + i) % n];
+  memcpy(route, tmp, sizeof(int) * n);
+  free(tmp);
+}
+
+static inline void build_nn_route(const City *city, int n, int *route, Rng *rng)
+{
+  Grid gr = grid_init(city, n, NULL, n);
+  int cur = rng_int(rng, n);
+  for (int k = 0; k < n; k++) {
+    route[k] = cur;
+    grid_remove(&gr, city, cur);
+    cur = grid_nearest(&gr, city, cur);
+  }
+  grid_free(gr);
+}
+
+// ヒルベルト曲線上の位置 (座標は 0..65535)
+static inline uint64_t hilbert_index(uint32_t x, uint32_t y)
+{
+  const uint32_t side = 1u << 16;
+  uint64_t d = 0;
+  for (uint32_t s = side >> 1; s > 0; s >>= 1) {
+    const uint32_t rx = (x & s) > 0;
+    const uint32_t ry = (y & s) > 0;
+    d += (uint64_t)s * s * ((3 * rx) ^ ry);
+    if (ry == 0) {
+      if (rx == 1) {
+        x = side - 1 - x;
+        y = side - 1 - y;
+      }
+      const uint32_t t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+static inline int cmp_u64(const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// 64bit のキーを 16bit ずつ4回の基数ソートで並べる (要素が多ければ qsort より数倍速い)
+static inline void radix_sort_u64(uint64_t *a, size_t m)
+{
+  if (m < 65536) {
+    qsort(a, m, sizeof(uint64_t), cmp_u64);
+    return;
+  }
+  uint64_t *tmp = (uint64_t*)malloc(sizeof(uint64_t) * (m > 0 ? m : 1));
+  size_t *count = (size_t*)malloc(sizeof(size_t) * 65536);
+  for (int shift = 0; shift < 64; shift += 16) {
+    memset(count, 0, sizeof(size_t) * 65536);
+    for (size_t i = 0; i < m; i++) count[(a[i] >> shift) & 0xffff]++;
+    size_t sum = 0;
+    for (int d = 0; d < 65536; d++) {
+      const size_t c = count[d];
+      count[d] = sum;
+      sum += c;
+    }
+    for (size_t i = 0; i < m; i++) tmp[count[(a[i] >> shift) & 0xffff]++] = a[i];
+    uint64_t *t = a;
+    a = tmp;
+    tmp = t;
+  }
+  // 4回入れ替えたので結果は元の配列に戻っている
+  free(tmp);
+  free(count);
+}
+
+static inline void build_sfc_route(const City *city, int n, int *route, Rng *rng)
+{
+  int minx = city[0].x, maxx = city[0].x, miny = city[0].y, maxy = city[0].y;
+  for (int i = 1; i < n; i++) {
+    if (city[i].x < minx) minx = city[i].x;
+    if (city[i].x > maxx) maxx = city[i].x;
+    if (city[i].y < miny) miny = city[i].y;
+    if (city[i].y > maxy) maxy = city[i].y;
+  }
+  // 曲線の折れ目の位置を変えるため、都市全体を曲線の範囲内で少しずらす
+  const double range = fmax(1.0, fmax((double)maxx - minx, (double)maxy - miny));
+  const double ox = rng_double(rng) * range * 0.5;
+  const double oy = rng_double(rng) * range * 0.5;
+  const double scale = 65535.0 / (range * 1.5);
+  uint64_t *key = (uint64_t*)malloc(sizeof(uint64_t) * n);
+  for (int i = 0; i < n; i++) {
+    const uint32_t hx = (uint32_t)(((double)city[i].x - minx + ox) * scale);
+    const uint32_t hy = (uint32_t)(((double)city[i].y - miny + oy) * scale);
+    key[i] = (hilbert_index(hx, hy) << 32) | (uint32_t)i;
+  }
+  radix_sort_u64(key, n);
+  for (int i = 0; i < n; i++) route[i] = (int)(uint32_t)key[i];
+  free(key);
+}
+
+static inline int uf_find(int *parent, int x)
+{
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
+}
+
+// 候補リストの辺 (p / k, nb[p]) を、長さに1割までの揺らぎを掛けて短い順に並べる
+// 返すのは (長さの float のビット列 << 32 | p) の配列。正の float はビット列の大小と値の大小が一致する
+// 両方の候補リストに入っている辺は1本にする
+static inline uint64_t *sorted_cand_edges(const City *city, const Cand *cand, int n, Rng *rng, size_t *m)
+{
+  const int k = cand->k;
+  uint64_t *e = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)n * k);
+  *m = 0;
+  for (int i = 0; i < n; i++) {
+    for (int t = 0; t < k; t++) {
+      const int j = cand->nb[i * k + t];
+      if (j < i) {
+        int dup = 0;
+        for (int u = 0; u < k; u++) dup |= (cand->nb[j * k + u] == i);
+        if (dup) continue;
+      }
+      const float w = distance(city[i], city[j]) * (1 + 0.1 * rng_double(rng));
+      uint32_t bits;
+      memcpy(&bits, &w, sizeof(bits));
+      e[(*m)++] = ((uint64_t)bits << 32) | (uint32_t)(i * k + t);
+    }
+  }
+  radix_sort_u64(e, *m);
+  return e;
+}
+
+static inline void build_greedy_route(const City *city, const Cand *cand, int n, int *route, Rng *rng)
+{
+  size_t me = 0;
+  uint64_t *e = sorted_cand_edges(city, cand, n, rng, &me);
+  int *adj = (int*)malloc(sizeof(int) * 2 * n);
+  int *parent = (int*)malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++) {
+    adj[2*i] = adj[2*i+1] = -1;
+    parent[i] = i;
+  }
+  for (size_t p = 0; p < me; p++) {
+    const uint32_t q = (uint32_t)e[p];
+    const int a = q / cand->k, b = cand->nb[q];
+    if (adj[2*a+1] >= 0 || adj[2*b+1] >= 0) continue; // 次数が2を超える
+    const int ra = uf_find(parent, a), rb = uf_find(parent, b);
+    if (ra == rb) continue; // 閉路ができる
+    parent[ra] = rb;
+    adj[2*a + (adj[2*a] >= 0)] = b;
+    adj[2*b + (adj[2*b] >= 0)] = a;
+  }
+  free(e);
+  free(parent);
+
+  // 断片の端点 (次数0か1の都市) を格子に入れ、断片をたどり終えた端から一番近い端点へ進む
+  int m = 0;
+  int *ends = (int*)malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++)
+    if (adj[2*i+1] < 0) ends[m++] = i;
+  Grid gr = grid_init(city, n, ends, m);
+  int cur = ends[rng_int(rng, m)];
+  int k = 0;
+  while (cur >= 0) {
+    grid_remove(&gr, city, cur);
+    int prev = -1, x = cur;
+    while (1) {
+      route[k++] = x;
+      const int next = (adj[2*x] >= 0 && adj[2*x] != prev) ? adj[2*x] : (adj[2*x+1] != prev ? adj[2*x+1] : -1);
+      if (next < 0) break;
+      prev = x;
+      x = next;
+    }
+    grid_remove(&gr, city, x);
+    cur = grid_nearest(&gr, city, x);
+  }
+  grid_free(gr);
+  free(ends);
+  free(adj);
+}
+
+static inline void build_christofides_route(const City *city, const Cand *cand, int n, int *route, Rng *rng)
+{
+  // 辺は最小全域木の n-1 本とマッチングの n/2 本以下
+  int *ea = (int*)malloc(sizeof(int) * 2 * n);
+  int *eb = (int*)malloc(sizeof(int) * 2 * n);
+  int ne = 0;
+  int *deg = (int*)calloc(n, sizeof(int));
+
+  // 最小全域木 (クラスカル法)
+  size_t me = 0;
+  uint64_t *e = sorted_cand_edges(city, cand, n, rng, &me);
+  int *parent = (int*)malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++) parent[i] = i;
+  for (size_t p = 0; p < me && ne < n - 1; p++) {
+    const uint32_t q = (uint32_t)e[p];
+    const int a = q / cand->k, b = cand->nb[q];
+    const int ra = uf_find(parent, a), rb = uf_find(parent, b);
+    if (ra == rb) continue;
+    parent[ra] = rb;
+    ea[ne] = a;
+    eb[ne++] = b;
+  }
+  free(e);
+  // 候補リストだけでは全体がつながらないとき (離れた集団があるとき) は、各集団の代表どうしを順につなぐ
+  for (int i = 1, last = 0; i < n && ne < n - 1; i++) {
+    const int ri = uf_find(parent, i), rl = uf_find(parent, last);
+    if (ri == rl) continue;
+    parent[ri] = rl;
+    ea[ne] = last;
+    eb[ne++] = i;
+    last = i;
+  }
+  free(parent);
+  for (int p = 0; p < ne; p++) {
+    deg[ea[p]]++;
+    deg[eb[p]]++;
+  }
+
+  // 奇数次の都市を、ランダムな順に一番近い相手と組にする
+  int m = 0;
+  int *odd = (int*)malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++)
+    if (deg[i] % 2) odd[m++] = i;
+  for (int i = m - 1; i > 0; i--) {
+    const int j = rng_int(rng, i + 1);
+    const int t = odd[i];
+    odd[i] = odd[j];
+    odd[j] = t;
+  }
+  Grid gr = grid_init(city, n, odd, m);
+  for (int p = 0; p < m; p++) {
+    const int u = odd[p];
+    if (gr.at[u] < 0) continue;
+    grid_remove(&gr, city, u);
+    const int v = grid_nearest(&gr, city, u);
+    grid_remove(&gr, city, v);
+    ea[ne] = u;
+    eb[ne++] = v;
+    deg[u]++;
+    deg[v]++;
+  }
+  grid_free(gr);
+  free(odd);
+
+  // オイラー閉路 (ヒールホルツァーの方法)。閉路から取り出す順に、初めての都市だけを並べる
+  int *first = (int*)calloc(n + 1, sizeof(int));
+  for (int i = 0; i < n; i++) first[i + 1] = first[i] + deg[i];
+  int *inc = (int*)malloc(sizeof(int) * 2 * ne);
+  int *ptr = (int*)malloc(sizeof(int) * n);
+  memcpy(ptr, first, sizeof(int) * n);
+  for (int p = 0; p < ne; p++) {
+    inc[ptr[ea[p]]++] = p;
+    inc[ptr[eb[p]]++] = p;
+  }
+  memcpy(ptr, first, sizeof(int) * n);
+  char *used = (char*)calloc(ne, sizeof(char));
+  char *seen = (char*)calloc(n, sizeof(char));
+  int *stack = (int*)malloc(sizeof(int) * (ne + 1));
+  int sp = 0, k = 0;
+  stack[sp++] = 0;
+  while (sp > 0) {
+    const int v = stack[sp - 1];
+    while (ptr[v] < first[v + 1] && used[inc[ptr[v]]]) ptr[v]++;
+    if (ptr[v] == first[v + 1]) {
+      sp--;
+      if (!seen[v]) {
+        seen[v] = 1;
+        route[k++] = v;
+      }
+    } else {
+      const int p = inc[ptr[v]++];
+      used[p] = 1;
+      stack[sp++] = (ea[p] == v) ? eb[p] : ea[p];
+    }
+  }
+  free(stack);
+  free(seen);
+  free(used);
+  free(ptr);
+  free(inc);
+  free(first);
+  free(deg);
+  free(ea);
+  free(eb);
+}
+
+// init の方法で初期解を作る。route[0] は 0 になる
+// 候補リストがないとき (都市数が少ないとき) は、この中で作って使う
+static inline void build_route(int init, const City *city, const Cand *cand, int n, int *route, Rng *rng)
+{
+  Cand local = {.k = 0, .nb = NULL};
+  if ((init == INIT_GREEDY || init == INIT_CHRIST) && cand == NULL) {
+    local = build_candidates(city, n, CAND_K);
+    cand = &local;
+  }
+  switch (init) {
+  case INIT_NN: build_nn_route(city, n, route, rng); break;
+  case INIT_GREEDY: build_greedy_route(city, cand, n, route, rng); break;
+  case INIT_SFC: build_sfc_route(city, n, route, rng); break;
+  case INIT_CHRIST: build_christofides_route(city, cand, n, route, rng); break;
+  default: gen_random_route(n, route, rng); break;
+  }
+  if (local.nb != NULL) free_candidates(local);
+  rotate_to_zero(route, n);
+}
+
+#endif
@@ -5,13 +5,12 @@
 #include <assert.h>
 #include <unistd.h>
 #include <errno.h> // strtol のエラー判定用
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
-// 町の構造体（今回は2次元座標）を定義
-typedef struct
-{
-  int x;
-  int y;
-} City;
+// 都市ファイルは共通のヘッダにある
+#include "tsp_city.h"
 
 // 描画用
 typedef struct
@@ -21,27 +20,24 @@ typedef struct
   char **dot;
 } Map;
 
-// 整数最大値をとる関数
-int max(const int a, const int b)
-{
-  return (a > b) ? a : b;
-}
+// search で部分木に分ける深さの既定値 (詳しくは solve() の前のコメントを参照)
+#ifndef BB_SPLIT_DEPTH
+#define BB_SPLIT_DEPTH 3
+#endif
 
 // プロトタイプ宣言
 // draw_line: 町の間を線で結ぶ
 // draw_route: routeでの巡回順を元に移動経路を線で結ぶ
 // plot_cities: 描画する
-// distance: 2地点間の距離を計算
 // solve(): TSPをといて距離を返す/ 引数route に巡回順を格納
 
 void draw_line(Map map, City a, City b);
 void draw_route(Map map, City *city, int n, const int *route);
 void plot_cities(FILE* fp, Map map, City *city, int n, const int *route);
-double distance(City a, City b);
-double solve(const City *city, int n, int *route, int *visited);
+double solve(const City *city, int n, int *route, int *visited, int nthreads, int split);
+double solve_dp(const City *city, int n, int *route, int nthreads);
 Map init_map(const int width, const int height);
 void free_map_dot(Map m);
-City *load_cities(const char* filename,int *n);
 
 Map init_map(const int width, const int height)
 {
@@ -58,23 +54,6 @@ void free_map_dot(Map m)
   free(m.dot);
 }
 
-City *load_cities(const char *filename, int *n)
-{
-  City *city;
-  FILE *fp;
-  if ((fp=fopen(filename,"rb")) == NULL){
-    fprintf(stderr, "%s: cannot open file.\n",filename);
-    exit(1);
-  }
-  fread(n,sizeof(int),1,fp);
-  city = (City*)malloc(sizeof(City) * *n);
-  for (int i = 0 ; i < *n ; i++){
-    fread(&city[i].x, sizeof(int), 1, fp);
-    fread(&city[i].y, sizeof(int), 1, fp);
-  }
-  fclose(fp);
-  return city;
-}
 int main(int argc, char**argv)
 {
   // const による定数定義
@@ -85,12 +64,33 @@ int main(int argc, char**argv)
   Map map = init_map(width, height);
   
   FILE *fp = stdout; // とりあえず描画先は標準出力としておく
-  if (argc != 2){
-    fprintf(stderr, "Usage: %s <city file>\n", argv[0]);
+  // search で部分木に分ける深さ (都市 0 の後に何都市目まで決めたところで分けるか)
+  int split = BB_SPLIT_DEPTH;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:")) != -1) {
+    if (opt == 's') split = atoi(optarg);
+    else argc = 0; // 使い方を表示して終わる
+  }
+  if (argc > 0) {
+    argv[optind - 1] = argv[0];
+    argv += optind - 1;
+    argc -= optind - 1;
+  }
+  if (argc < 2 || argc > 4 || split < 0){
+    fprintf(stderr, "Usage: %s [-s depth] <city file> [search|dp] [threads]\n", argv[0]);
     exit(1);
   }
-  int n;
-  City *city = load_cities(argv[1],&n);
+  // 解法の選択 (search: 再帰による全探索, dp: Held-Karp の動的計画法)
+  const int use_dp = (argc >= 3 && strcmp(argv[2], "dp") == 0);
+  if (argc >= 3 && !use_dp && strcmp(argv[2], "search") != 0){
+    fprintf(stderr, "%s: unknown mode.\n", argv[2]);
+    exit(1);
+  }
+  int nthreads = (argc == 4) ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 1) nthreads = 1;
+  CityFile cf = load_cities(argv[1]);
+  const int n = cf.n;
+  City *city = cf.city;
   assert( n > 1 && n <= max_cities); // さすがに都市数100は厳しいので
 
   // 町の初期配置を表示
@@ -102,7 +102,7 @@ int main(int argc, char**argv)
   // 訪れた町を記録するフラグ
   int *visited = (int*)calloc(n, sizeof(int));
 
-  const double d = solve(city,n,route,visited);
+  const double d = use_dp ? solve_dp(city,n,route,nthreads) : solve(city,n,route,visited,nthreads,split);
   plot_cities(fp, map, city, n, route);
   printf("total distance = %f\n", d);
   for (int i = 0 ; i < n ; i++){
@@ -113,7 +113,7 @@ int main(int argc, char**argv)
   // 動的確保した環境ではfreeをする
   free(route);
   free(visited);
-  free(city);
+  unload_cities(cf);
   
   return 0;
 }
@@ -150,8 +150,9 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   for (int i = 0; i < n; i++) {
     char buf[100];
     sprintf(buf, "C_%d", i);
-    for (int j = 0; j < strlen(buf); j++) {
-      const int x = city[i].x + j;
+    const size_t len = strlen(buf);
+    for (size_t j = 0; j < len; j++) {
+      const int x = city[i].x + (int)j;
       const int y = city[i].y;
       map.dot[x][y] = buf[j];
     }
@@ -169,86 +170,598 @@ void plot_cities(FILE *fp, Map map, City *city, int n, const int *route)
   fflush(fp);
 }
 
-double distance(City a, City b)
+// 分枝限定法
+// 部分経路の長さは再帰の引数で持ち回し、下界として
+//   (未訪問都市の最小全域木) + (最後の都市から未訪問への最短辺) + (未訪問から都市0への最短辺)
+// を使う。残りの経路 last -> (未訪問すべて) -> 0 は未訪問都市を結ぶパスを含むので、この値以上になる。
+// 距離には最初に1-treeの劣勾配法で求めたペナルティpiを加えた d'(i,j) = d(i,j) + pi[i] + pi[j] を使う。
+// 残りの経路では未訪問都市の次数が2、last と 0 の次数が1なので、d' で測った下界から
+// 2 * (未訪問のpiの和) + pi[last] + pi[0] を引けば元の距離での下界になる (piによらず成り立つ)。
+// 距離表・ペナルティ・最良解は全スレッドで共有し、経路と作業用の配列はスレッドごとに持つ
+typedef struct {
+  int n;
+  double *d;        // n x n の距離表
+  double *dm;       // ペナルティを加えた距離表 d'
+  double *pi;       // 1-tree のペナルティ
+  int *route;       // 探索中の経路
+  int *visited;
+  int *order;       // 各深さでの子の訪問順 (n x n)
+  double *key;      // Prim法の作業用
+  int *rest;        // 未訪問都市の作業用
+  int *best_route;  // これまでの最良解 (mu で守る)
+  _Atomic double *best; // その長さ。読むのはロックなしで、書くのは mu を取ってから
+  pthread_mutex_t *mu;
+  long nodes;       // 展開したノード数
+} BB;
+
+static inline double bb_best(const BB *bb)
 {
-  const double dx = a.x - b.x;
-  const double dy = a.y - b.y;
-  return sqrt(dx * dx + dy * dy);
+  return atomic_load_explicit(bb->best, memory_order_relaxed);
 }
 
-typedef struct ans{
-  double dist;
-  int *route;
-} Answer;
+// 未訪問都市の最小全域木 (Prim法) と last, 0 からの最短辺で下界を計算する
+double lower_bound(BB *bb, int last)
+{
+  const int n = bb->n;
+  const double *dm = bb->dm;
+  int k = 0;
+  for (int i = 1; i < n; i++)
+    if (!bb->visited[i]) bb->rest[k++] = i;
+  if (k == 0) return bb->d[last * n];
+
+  double min_last = 1e100, min_home = 1e100, pi_sum = 0;
+  for (int a = 0; a < k; a++) {
+    const int c = bb->rest[a];
+    if (dm[last * n + c] < min_last) min_last = dm[last * n + c];
+    if (dm[c * n] < min_home) min_home = dm[c * n];
+    pi_sum += bb->pi[c];
+    bb->key[a] = 1e100;
+  }
 
-Answer search(const City *city, int n, int *route, int *visited);
+  double mst = 0;
+  bb->key[0] = 0;
+  for (int step = 0; step < k; step++) {
+    // 木に入っていない中でkeyが最小の都市を木に加える (rest[step..k-1] が未追加)
+    int m = step;
+    for (int a = step + 1; a < k; a++)
+      if (bb->key[a] < bb->key[m]) m = a;
+    mst += bb->key[m];
+    int tc = bb->rest[m]; bb->rest[m] = bb->rest[step]; bb->rest[step] = tc;
+    double tk = bb->key[m]; bb->key[m] = bb->key[step]; bb->key[step] = tk;
+    for (int a = step + 1; a < k; a++) {
+      const double w = dm[tc * n + bb->rest[a]];
+      if (w < bb->key[a]) bb->key[a] = w;
+    }
+  }
+  return mst + min_last + min_home - 2 * pi_sum - bb->pi[last] - bb->pi[0];
+}
 
-double solve(const City *city, int n, int *route, int *visited)
+// 1-tree (都市1..n-1の最小全域木 + 都市0からの短い2辺) の長さを d' で計算し、各都市の次数を deg に入れる
+double one_tree(const BB *bb, int *deg, double *key, int *parent, int *in_tree)
 {
-  route[0] = 0; // 循環した結果を避けるため、常に0番目からスタート
-  visited[0] = 1;
+  const int n = bb->n;
+  const double *dm = bb->dm;
+  for (int i = 0; i < n; i++) {
+    deg[i] = 0;
+    key[i] = 1e100;
+    in_tree[i] = 0;
+  }
+  double len = 0;
+  key[1] = 0;
+  parent[1] = -1;
+  for (int step = 1; step < n; step++) {
+    int m = -1;
+    for (int i = 1; i < n; i++)
+      if (!in_tree[i] && (m < 0 || key[i] < key[m])) m = i;
+    in_tree[m] = 1;
+    len += key[m];
+    if (parent[m] >= 0) {
+      deg[m]++;
+      deg[parent[m]]++;
+    }
+    for (int i = 1; i < n; i++) {
+      if (!in_tree[i] && dm[m * n + i] < key[i]) {
+        key[i] = dm[m * n + i];
+        parent[i] = m;
+      }
+    }
+  }
+  // 都市0から短い2辺
+  int e1 = -1, e2 = -1;
+  for (int i = 1; i < n; i++) {
+    if (e1 < 0 || dm[i] < dm[e1]) { e2 = e1; e1 = i; }
+    else if (e2 < 0 || dm[i] < dm[e2]) e2 = i;
+  }
+  len += dm[e1] + dm[e2];
+  deg[0] = 2;
+  deg[e1]++;
+  deg[e2]++;
+  return len;
+}
 
-  Answer ans = search(city, n, route, visited);
-  
-  memcpy(route, ans.route, sizeof(int)*n);
-  free(ans.route);
-  return ans.dist;
-}
-
-Answer search(const City *city, int n, int *route, int *visited){
-  static double mindis = 10000000000;
-  int start = 0;
-  double cum_dis = 0;
-  // 訪問した個数を数える
-  int c0 = route[0];
-  for (int i = 1; i < n ; i++){
-    if (!route[i]){
-      start = i;
-      break;
+// 劣勾配法で1-treeの下界が大きくなるようにpiを決める
+void optimize_penalty(BB *bb, double upper)
+{
+  const int n = bb->n;
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      bb->dm[i * n + j] = bb->d[i * n + j];
+  if (n < 3) return; // 1-treeが作れない
+
+  int *deg = (int*)malloc(sizeof(int) * n);
+  int *parent = (int*)malloc(sizeof(int) * n);
+  int *in_tree = (int*)malloc(sizeof(int) * n);
+  double *key = (double*)malloc(sizeof(double) * n);
+  double *best_pi = (double*)calloc(n, sizeof(double));
+  double best_bound = -1e100;
+  double lambda = 2;
+  int no_improve = 0;
+
+  for (int it = 0; it < 100 * n && lambda > 1e-6; it++) {
+    double pi_sum = 0;
+    for (int i = 0; i < n; i++) pi_sum += bb->pi[i];
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++)
+        bb->dm[i * n + j] = bb->d[i * n + j] + bb->pi[i] + bb->pi[j];
+    const double bound = one_tree(bb, deg, key, parent, in_tree) - 2 * pi_sum;
+    if (bound > best_bound + 1e-9) {
+      best_bound = bound;
+      memcpy(best_pi, bb->pi, sizeof(double) * n);
+      no_improve = 0;
+    } else if (++no_improve >= n) {
+      lambda /= 2;
+      no_improve = 0;
     }
-    else{
-      int c1 = route[i];
-      cum_dis += distance(city[c0],city[c1]);
-      c0 = c1;
+    int norm = 0;
+    for (int i = 0; i < n; i++) norm += (deg[i] - 2) * (deg[i] - 2);
+    if (norm == 0) break; // 1-treeが巡回路になった (最適)
+    const double step = lambda * (upper - bound) / norm;
+    for (int i = 0; i < n; i++) bb->pi[i] += step * (deg[i] - 2);
+  }
+
+  memcpy(bb->pi, best_pi, sizeof(double) * n);
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      bb->dm[i * n + j] = bb->d[i * n + j] + bb->pi[i] + bb->pi[j];
+  free(deg);
+  free(parent);
+  free(in_tree);
+  free(key);
+  free(best_pi);
+}
+
+// depth番目に訪れる都市の候補を、last から近い順に bb->order + depth * n に並べて数を返す
+// (良い解が早く見つかるほど枝刈りが効く)
+int child_order(BB *bb, int depth, int last)
+{
+  const int n = bb->n;
+  int *order = bb->order + depth * n;
+  int k = 0;
+  for (int i = 1; i < n; i++) {
+    if (bb->visited[i]) continue;
+    if (i == 2 && !bb->visited[1]) continue; // 逆順の巡回経路を抑制
+    const double di = bb->d[last * n + i];
+    int a = k++;
+    while (a > 0 && bb->d[last * n + order[a-1]] > di) {
+      order[a] = order[a-1];
+      a--;
     }
+    order[a] = i;
   }
+  return k;
+}
+
+// depth番目まで決まっていて、最後の都市がlast、ここまでの長さがcost
+void search(BB *bb, int depth, int last, double cost)
+{
+  const int n = bb->n;
+  bb->nodes++;
+
   // 全て訪問したケース（ここが再帰の終端条件）
-  if (start == 0){
-    double sum_d = cum_dis + distance(city[c0],city[0]);
-    int *retarg = (int*)malloc(sizeof(int)*n);
-    memcpy(retarg, route, sizeof(int)*n);
-    if ( sum_d < mindis) mindis = sum_d; 
-    return (Answer){.dist = sum_d, .route = retarg};
+  if (depth == n) {
+    const double sum_d = cost + bb->d[last * n];
+    if (sum_d < bb_best(bb)) {
+      // ほかのスレッドが先に更新しているかもしれないので、ロックを取ってから確かめなおす
+      pthread_mutex_lock(bb->mu);
+      if (sum_d < bb_best(bb)) {
+        atomic_store_explicit(bb->best, sum_d, memory_order_relaxed);
+        memcpy(bb->best_route, bb->route, sizeof(int) * n);
+      }
+      pthread_mutex_unlock(bb->mu);
+    }
+    return;
   }
 
+  if (cost + lower_bound(bb, last) >= bb_best(bb)) return;
+
+  const int *order = bb->order + depth * n;
+  const int k = child_order(bb, depth, last);
+  for (int a = 0; a < k; a++) {
+    const int i = order[a];
+    const double c = cost + bb->d[last * n + i];
+    if (c >= bb_best(bb)) break; // 以降の子はさらに遠い
+    bb->route[depth] = i;
+    bb->visited[i] = 1;
+    search(bb, depth + 1, i, c);
+    bb->visited[i] = 0;
+  }
+}
 
-  // 特定の分岐における最小の巡回経路を調べる
-  Answer min = {.dist = 10000000000, .route = NULL};
-  for (int i = 1 ; i < n ; i++){
-    // 未訪問なら訪れる
-    if(!visited[i]){
-      if(i == 2 && !visited[1]) continue; // 逆順の巡回経路を抑制
+// 並列の分枝限定法
+// 都市 0 の後の split 都市までの決め方 (部分木の根) を search() と同じ順・同じ枝刈りで先に列挙して仕事にし、
+// スレッドごとの両端キューに順番に配る。自分のキューは先頭 (近い都市から選んだ有望な方) から取り、
+// 空になったらほかのスレッドのキューの末尾から盗む。
+// 最良解の長さは全スレッドで共有しているので、どこかで良い解が見つかるとすぐにほかのスレッドの枝刈りにも効く
+typedef struct {
+  int last;
+  double cost;
+  size_t prefix;    // 経路の 1..split 番目は prefix_pool[prefix] から
+} BBTask;
+
+typedef struct {
+  BBTask *task;
+  int ntask, cap;
+  int *prefix_pool;
+  int split;
+} BBTasks;
+
+typedef struct {
+  int *q;           // 仕事の番号
+  int head, tail;   // q[head..tail-1] が残り
+  pthread_mutex_t mu;
+} BBDeque;
+
+typedef struct {
+  BB bb;            // このスレッドの作業領域
+  const BBTasks *tasks;
+  BBDeque *dq;
+  int id, nthreads;
+} BBWorker;
+
+void split_tasks(BB *bb, int depth, int last, double cost, BBTasks *ts)
+{
+  const int n = bb->n;
+  if (depth > ts->split) {
+    if (ts->ntask == ts->cap) {
+      ts->cap = (ts->cap == 0) ? 1024 : ts->cap * 2;
+      ts->task = (BBTask*)realloc(ts->task, sizeof(BBTask) * ts->cap);
+      ts->prefix_pool = (int*)realloc(ts->prefix_pool, sizeof(int) * ((size_t)ts->cap * ts->split + 1));
+    }
+    const size_t p = (size_t)ts->ntask * ts->split;
+    memcpy(ts->prefix_pool + p, bb->route + 1, sizeof(int) * ts->split);
+    ts->task[ts->ntask++] = (BBTask){.last = last, .cost = cost, .prefix = p};
+    return;
+  }
+  if (cost + lower_bound(bb, last) >= bb_best(bb)) return;
+
+  const int *order = bb->order + depth * n;
+  const int k = child_order(bb, depth, last);
+  for (int a = 0; a < k; a++) {
+    const int i = order[a];
+    const double c = cost + bb->d[last * n + i];
+    if (c >= bb_best(bb)) break;
+    bb->route[depth] = i;
+    bb->visited[i] = 1;
+    split_tasks(bb, depth + 1, i, c, ts);
+    bb->visited[i] = 0;
+  }
+}
 
-      if ( cum_dis + distance(city[route[start-1]],city[i]) > mindis) continue;
-      
-      route[start] = i; 
-      visited[i] = 1;
+// 次の仕事の番号。残っていなければ -1
+static int bb_take(BBWorker *w)
+{
+  for (int o = 0; o < w->nthreads; o++) {
+    BBDeque *dq = &w->dq[(w->id + o) % w->nthreads];
+    int j = -1;
+    pthread_mutex_lock(&dq->mu);
+    if (dq->head < dq->tail) j = (o == 0) ? dq->q[dq->head++] : dq->q[--dq->tail];
+    pthread_mutex_unlock(&dq->mu);
+    if (j >= 0) return j;
+  }
+  return -1; // 仕事は途中で増えないので、全部のキューが空なら終わり
+}
 
-      Answer tmp = search(city, n, route, visited);
+void *bb_worker(void *arg)
+{
+  BBWorker *w = (BBWorker*)arg;
+  BB *bb = &w->bb;
+  const int split = w->tasks->split;
+  int j;
+  while ((j = bb_take(w)) >= 0) {
+    const BBTask *t = &w->tasks->task[j];
+    const int *prefix = w->tasks->prefix_pool + t->prefix;
+    for (int a = 0; a < split; a++) {
+      bb->route[a + 1] = prefix[a];
+      bb->visited[prefix[a]] = 1;
+    }
+    search(bb, split + 1, t->last, t->cost);
+    for (int a = 0; a < split; a++) bb->visited[prefix[a]] = 0;
+  }
+  return NULL;
+}
 
-      // 最小の巡回経路かどうか確認
-      if ( tmp.dist < min.dist ){
-	free(min.route);
-	min = tmp;
+// 最近傍法 + 2-opt で初期解 (枝刈りの上界) を作る
+double initial_tour(BB *bb)
+{
+  const int n = bb->n;
+  const double *d = bb->d;
+  int *r = bb->best_route;
+  int *used = (int*)calloc(n, sizeof(int));
+  int last = 0;
+  used[0] = 1;
+  r[0] = 0;
+  for (int depth = 1; depth < n; depth++) {
+    int next = -1;
+    for (int i = 1; i < n; i++)
+      if (!used[i] && (next < 0 || d[last * n + i] < d[last * n + next])) next = i;
+    used[next] = 1;
+    r[depth] = next;
+    last = next;
+  }
+  free(used);
+
+  // 改善がなくなるまで 2-opt (r[0] = 0 は動かさない)
+  int improved = 1;
+  while (improved) {
+    improved = 0;
+    for (int i = 0; i < n - 2; i++) {
+      for (int j = i + 2; j < n; j++) {
+        const int a = r[i], b = r[i+1], c = r[j], e = r[(j+1)%n];
+        if (a == e) continue;
+        if (d[a * n + c] + d[b * n + e] < d[a * n + b] + d[c * n + e] - 1e-10) {
+          for (int p = i + 1, q = j; p < q; p++, q--) {
+            const int t = r[p]; r[p] = r[q]; r[q] = t;
+          }
+          improved = 1;
+        }
       }
-      else{
-	free(tmp.route);
+    }
+  }
+
+  double sum_d = 0;
+  for (int i = 0; i < n; i++) sum_d += d[r[i] * n + r[(i+1)%n]];
+  return sum_d;
+}
+double solve(const City *city, int n, int *route, int *visited, int nthreads, int split)
+{
+  route[0] = 0; // 循環した結果を避けるため、常に0番目からスタート
+  visited[0] = 1;
+
+  _Atomic double best;
+  pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+  BB bb = {.n = n, .route = route, .visited = visited, .best = &best, .mu = &mu, .nodes = 0};
+  bb.d = (double*)malloc(sizeof(double) * n * n);
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      bb.d[i * n + j] = distance(city[i], city[j]);
+  bb.dm = (double*)malloc(sizeof(double) * n * n);
+  bb.pi = (double*)calloc(n, sizeof(double));
+  bb.order = (int*)malloc(sizeof(int) * n * n);
+  bb.key = (double*)malloc(sizeof(double) * n);
+  bb.rest = (int*)malloc(sizeof(int) * n);
+  bb.best_route = (int*)malloc(sizeof(int) * n);
+
+  // 上界を少しだけ大きくしておき、初期解そのものも探索で見つかるようにする
+  atomic_init(&best, initial_tour(&bb) * (1 + 1e-9));
+  optimize_penalty(&bb, bb_best(&bb));
+
+  // 部分木の根を列挙する (最後の都市は部分木の中で決めたいので、深さは n - 2 までにする)
+  BBTasks ts = {.task = NULL, .ntask = 0, .cap = 0, .prefix_pool = NULL, .split = split < n - 2 ? split : max(n - 2, 0)};
+  split_tasks(&bb, 1, 0, 0, &ts);
+
+  pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+  BBWorker *w = (BBWorker*)malloc(sizeof(BBWorker) * nthreads);
+  BBDeque *dq = (BBDeque*)malloc(sizeof(BBDeque) * nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    dq[t] = (BBDeque){.q = (int*)malloc(sizeof(int) * (ts.ntask / nthreads + 1)), .head = 0, .tail = 0};
+    pthread_mutex_init(&dq[t].mu, NULL);
+  }
+  // 有望な順に並んでいるので、どのスレッドにも前の方の仕事が行くように1つずつ順に配る
+  for (int j = 0; j < ts.ntask; j++) {
+    BBDeque *q = &dq[j % nthreads];
+    q->q[q->tail++] = j;
+  }
+  for (int t = 0; t < nthreads; t++) {
+    w[t] = (BBWorker){.bb = bb, .tasks = &ts, .dq = dq, .id = t, .nthreads = nthreads};
+    w[t].bb.route = (int*)malloc(sizeof(int) * n);
+    w[t].bb.visited = (int*)calloc(n, sizeof(int));
+    w[t].bb.order = (int*)malloc(sizeof(int) * n * n);
+    w[t].bb.key = (double*)malloc(sizeof(double) * n);
+    w[t].bb.rest = (int*)malloc(sizeof(int) * n);
+    w[t].bb.route[0] = 0;
+    w[t].bb.visited[0] = 1;
+    pthread_create(&th[t], NULL, bb_worker, &w[t]);
+  }
+  for (int t = 0; t < nthreads; t++) pthread_join(th[t], NULL);
+  for (int t = 0; t < nthreads; t++) {
+    bb.nodes += w[t].bb.nodes;
+    free(w[t].bb.route);
+    free(w[t].bb.visited);
+    free(w[t].bb.order);
+    free(w[t].bb.key);
+    free(w[t].bb.rest);
+    free(dq[t].q);
+    pthread_mutex_destroy(&dq[t].mu);
+  }
+  fprintf(stderr, "search: %ld nodes, %d subtrees\n", bb.nodes, ts.ntask);
+  free(th);
+  free(w);
+  free(dq);
+  free(ts.task);
+  free(ts.prefix_pool);
+
+  memcpy(route, bb.best_route, sizeof(int) * n);
+  free(bb.d);
+  free(bb.dm);
+  free(bb.pi);
+  free(bb.order);
+  free(bb.key);
+  free(bb.rest);
+  free(bb.best_route);
+
+  // 距離は経路から計算しなおす
+  double sum_d = 0;
+  for (int i = 0; i < n; i++) sum_d += distance(city[route[i]], city[route[(i+1)%n]]);
+  return sum_d;
+}
+
+// Held-Karp の動的計画法
+// dp[S][j] = 都市0から出発して集合Sの都市をすべて訪れ、最後にj(∈S)にいるときの最短距離
+// 都市1..n-1 をビット0..n-2 に対応させる。
+// 表は要素数kの集合ごとに連続した層に並べ、層の中は組合せ数体系での順位 (colex順) で並べる。
+// 各集合には S に含まれる j の分 (k個) だけ要素を持たせるので、全体で (n-1) * 2^(n-2) 要素になる。
+#define HK_MAX_CITIES 26 // float で (n-1) * 2^(n-2) 要素 = n=26 で約1.7GB
+
+typedef struct {
+  int m;              // ビット数 (= n-1)
+  const float *d;     // n x n の距離表
+  float *dp;
+  const size_t *off;  // 各層の先頭位置
+  const size_t (*binom)[HK_MAX_CITIES]; // 二項係数
+  int k;              // 計算中の層
+  size_t begin, end;  // このスレッドが担当する順位の範囲
+} HKTask;
+
+// 要素数kの集合の中での順位
+static size_t hk_rank(unsigned s, const size_t (*binom)[HK_MAX_CITIES])
+{
+  size_t r = 0;
+  int t = 1;
+  while (s) {
+    const int b = __builtin_ctz(s);
+    r += binom[b][t++];
+    s &= s - 1;
+  }
+  return r;
+}
+
+// 順位rの要素数kの集合 (hk_rank の逆)
+static unsigned hk_unrank(size_t r, int k, int m, const size_t (*binom)[HK_MAX_CITIES])
+{
+  unsigned s = 0;
+  for (int b = m - 1; k > 0; b--) {
+    if (binom[b][k] <= r) {
+      r -= binom[b][k];
+      s |= 1u << b;
+      k--;
+    }
+  }
+  return s;
+}
+
+// Sから1つ除いた集合での、都市(ビット)iの位置
+static inline int hk_pos(unsigned s, int i)
+{
+  return __builtin_popcount(s & ((1u << i) - 1));
+}
+
+static void *hk_layer(void *arg)
+{
+  const HKTask *task = (const HKTask*)arg;
+  const int m = task->m, k = task->k, n = m + 1;
+  const float *prev = task->dp + task->off[k-1];
+  float *cur = task->dp + task->off[k];
+  if (task->begin >= task->end) return NULL;
+
+  unsigned s = hk_unrank(task->begin, k, m, task->binom);
+  for (size_t r = task->begin; r < task->end; r++) {
+    int p = 0;
+    for (unsigned sj = s; sj; sj &= sj - 1, p++) {
+      const int j = __builtin_ctz(sj);
+      const unsigned rest = s & ~(1u << j);
+      const float *row = prev + hk_rank(rest, task->binom) * (k - 1);
+      float best = INFINITY;
+      int q = 0;
+      for (unsigned si = rest; si; si &= si - 1, q++) {
+        const int i = __builtin_ctz(si);
+        const float v = row[q] + task->d[(i+1) * n + (j+1)];
+        if (v < best) best = v;
       }
+      cur[r * k + p] = best;
+    }
+    // 次の要素数kの集合 (Gosper's hack)
+    const unsigned c = s & -s;
+    const unsigned t = s + c;
+    s = (((t ^ s) >> 2) / c) | t;
+  }
+  return NULL;
+}
+
+double solve_dp(const City *city, int n, int *route, int nthreads)
+{
+  if (n > HK_MAX_CITIES) {
+    fprintf(stderr, "dp: too many cities (n = %d > %d).\n", n, HK_MAX_CITIES);
+    exit(1);
+  }
+  const int m = n - 1;
 
-      route[start] = 0;
-      visited[i] = 0;
+  float *d = (float*)malloc(sizeof(float) * n * n);
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      d[i * n + j] = distance(city[i], city[j]);
+
+  size_t binom[HK_MAX_CITIES][HK_MAX_CITIES] = {{0}};
+  for (int a = 0; a < HK_MAX_CITIES; a++) {
+    binom[a][0] = 1;
+    for (int b = 1; b <= a; b++) binom[a][b] = binom[a-1][b-1] + binom[a-1][b];
+  }
+  size_t off[HK_MAX_CITIES + 1];
+  off[0] = off[1] = 0;
+  for (int k = 1; k <= m; k++) off[k+1] = off[k] + binom[m][k] * k;
+
+  float *dp = (float*)malloc(sizeof(float) * (off[m+1] > 0 ? off[m+1] : 1));
+  if (dp == NULL) {
+    fprintf(stderr, "dp: cannot allocate table.\n");
+    exit(1);
+  }
+
+  // 要素数1の層: 都市0から直接行く
+  for (int j = 0; j < m; j++) dp[off[1] + j] = d[j+1];
+
+  // 要素数kの層は k-1 の層だけから決まるので、層の中をスレッドで分割する
+  pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+  HKTask *task = (HKTask*)malloc(sizeof(HKTask) * nthreads);
+  for (int k = 2; k <= m; k++) {
+    const size_t total = binom[m][k];
+    for (int t = 0; t < nthreads; t++) {
+      task[t] = (HKTask){.m = m, .d = d, .dp = dp, .off = off, .binom = binom, .k = k,
+                         .begin = total * t / nthreads, .end = total * (t+1) / nthreads};
+      pthread_create(&th[t], NULL, hk_layer, &task[t]);
     }
+    for (int t = 0; t < nthreads; t++) pthread_join(th[t], NULL);
   }
-  
-  return min;
+  free(th);
+  free(task);
+
+  // 経路の復元: 最後の都市から順に、最小を与えた直前の都市をたどる
+  unsigned s = (1u << m) - 1;
+  int last = -1;
+  float best = INFINITY;
+  for (int j = 0; j < m; j++) {
+    const float v = dp[off[m] + j] + d[(j+1) * n];
+    if (v < best) { best = v; last = j; }
+  }
+  route[0] = 0;
+  for (int k = m; k >= 1; k--) {
+    route[k] = last + 1;
+    const unsigned rest = s & ~(1u << last);
+    if (k == 1) break;
+    const float *row = dp + off[k-1] + hk_rank(rest, binom) * (k - 1);
+    int prev = -1, q = 0;
+    best = INFINITY;
+    for (unsigned si = rest; si; si &= si - 1, q++) {
+      const int i = __builtin_ctz(si);
+      const float v = row[q] + d[(i+1) * n + (last+1)];
+      if (v < best) { best = v; prev = i; }
+    }
+    s = rest;
+    last = prev;
+  }
+  free(dp);
+  free(d);
+
+  // 距離は double で計算しなおす
+  double sum_d = 0;
+  for (int i = 0; i < n; i++) sum_d += distance(city[route[i]], city[route[(i+1)%n]]);
+  return sum_d;
 }
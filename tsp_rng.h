@@ -0,0 +1,80 @@
+/*
+
+  乱数 (xoshiro256**) (advance.c, advance_swap.c, bench.c, tsp1.c, tsp_ga.c で共通)
+  rand() は呼ぶたびにロックを取り、状態も全体で1つしかないので、スレッドや初期解ごとに Rng を持たせる
+  rng_init() で seed から状態を作り、rng_jump() で重ならない別の列に移る
+
+*/
+
+#ifndef TSP_RNG_H
+#define TSP_RNG_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+  uint64_t s[4];
+} Rng;
+
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(Rng *rng)
+{
+  uint64_t *s = rng->s;
+  const uint64_t result = rotl(s[1] * 5, 7) * 9;
+  const uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+// seed から状態を作る (splitmix64 で4つに広げる)
+static inline Rng rng_init(uint64_t seed)
+{
+  Rng rng;
+  for (int i = 0; i < 4; i++) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    rng.s[i] = z ^ (z >> 31);
+  }
+  return rng;
+}
+
+// 2^128 回分進める。jump した列どうしは重ならないので、スレッドや初期解ごとに使い分けられる
+static inline void rng_jump(Rng *rng)
+{
+  static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                  0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+  uint64_t s[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 4; i++) {
+    for (int b = 0; b < 64; b++) {
+      if (JUMP[i] & (1ULL << b)) {
+        for (int k = 0; k < 4; k++) s[k] ^= rng->s[k];
+      }
+      rng_next(rng);
+    }
+  }
+  memcpy(rng->s, s, sizeof(s));
+}
+
+// 0以上m未満の整数 (剰余の代わりに掛け算で範囲を縮める)
+static inline int rng_int(Rng *rng, int m)
+{
+  return (int)(((rng_next(rng) >> 32) * (uint64_t)m) >> 32);
+}
+
+// [0, 1) の実数
+static inline double rng_double(Rng *rng)
+{
+  return (rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+#endif
@@ -0,0 +1,262 @@
+/*
+
+  焼きなまし法 (advance.c, advance_swap.c, bench.c で共通)
+  sa_calc() は advance.c (2-opt などの近傍)、sa_swap_calc() は advance_swap.c (2点スワップ) の1回分。
+  bench.c も同じ関数を呼ぶので、計測しているのは各プログラムの探索そのもの
+
+*/
+
+#ifndef TSP_SA_H
+#define TSP_SA_H
+
+#include <stdlib.h>
+#include <math.h>
+#include "tsp_rng.h"
+#include "tsp_city.h"
+#include "tsp_dist.h"
+#include "tsp_tour.h"
+
+// 近傍 (移動の種類)。カンマ区切りで組み合わせられ、そのときは1回ごとにランダムに1つ選ぶ
+// SA_MOVE_2OPT : 2-opt
+// SA_MOVE_OROPT: Or-opt。1〜3都市の区間を、区間の端の近くの都市の隣へ (逆向きにもして) 移す
+// SA_MOVE_3OPT : 区間挿入の 3-opt。両端の新しい辺がどちらも候補リストの辺になるような、長さを決めない区間を移す
+// 2-opt 以外は候補リストを使う
+enum { SA_MOVE_2OPT, SA_MOVE_OROPT, SA_MOVE_3OPT, SA_MOVE_COUNT };
+static const char *const sa_move_names[SA_MOVE_COUNT] = {"2opt", "oropt", "3opt"};
+
+// 受理判定
+// 元の条件 u < exp(co * diff * t) (co < 0) は、改善 (diff <= 0) なら必ず成り立つので乱数もいらない。
+// 悪化のときは x = -co * diff * t に対する exp(-x) を表から線形補間で引き、x が大きければ必ず棄却する。
+#define EXP_TABLE_SIZE 1024
+#define EXP_TABLE_MAX 20.0 // exp(-20) ≒ 2e-9 より小さい確率は0とみなす
+
+static float exp_table[EXP_TABLE_SIZE + 1];
+
+static inline void init_exp_table(void)
+{
+  for (int i = 0; i <= EXP_TABLE_SIZE; i++)
+    exp_table[i] = exp(-EXP_TABLE_MAX * i / EXP_TABLE_SIZE);
+}
+
+static inline int accept(Rng *rng, double co, double diff, int t)
+{
+  if (diff <= 0) return 1;
+  const double x = -co * diff * t * (EXP_TABLE_SIZE / EXP_TABLE_MAX);
+  if (x >= EXP_TABLE_SIZE) return 0;
+  const int k = (int)x;
+  const double p = exp_table[k] + (exp_table[k+1] - exp_table[k]) * (x - k);
+  return rng_double(rng) < p;
+}
+
+#define SA_T_START 0.5 // 初期解を作ったときの開始温度 (最近傍の都市までの平均距離に対する比)
+
+// 最近傍の都市までの平均距離 (温度の目安)
+static inline double mean_nn_dist(const DistTable *dt, const Cand *cand, int n)
+{
+  double nn = 0;
+  for (int i = 0; i < n; i++) {
+    if (cand != NULL) {
+      nn += dt_get(dt, i, cand->nb[i * cand->k]);
+      continue;
+    }
+    double best = 1e300;
+    for (int j = 0; j < n; j++)
+      if (j != i && dt_get(dt, i, j) < best) best = dt_get(dt, i, j);
+    nn += best;
+  }
+  return nn / n;
+}
+
+// 初期解を作ったときの開始時刻 (温度は T/t)。高温で壊してしまわないよう最近傍距離の SA_T_START 倍から始める
+// (全部の都市が同じ点にあると nn = 0 になるので、int にする前に T/2 で抑える)
+static inline int sa_t0(int T, double nn)
+{
+  return (int)fmin(T / 2, T / (SA_T_START * nn));
+}
+
+// 候補リストを使って kind の移動を1回試し、受理したら巡回路を書き換えて距離の変化を返す (しなければ 0)
+// 焼きなまし (sa_calc) と advance.c の並列焼き戻し (pt_sweep) で共通。tried があれば、差分を計算した回数を足す
+static inline double sa_move(Tour *tour, const DistTable *dt, const Cand *cand, int n, int kind, Rng *rng, double co,
+                             int t, long *tried)
+{
+  if (kind == SA_MOVE_2OPT) {
+    // 都市 a とその近くの都市 c が隣り合うように、辺 (a, next(a)) と (c, next(c)) をつなぎ替える
+    const int a = rng_int(rng, n);
+    const int c = cand->nb[a * cand->k + rng_int(rng, cand->k)];
+    const int b = tour_next(tour, a);
+    const int d = tour_next(tour, c);
+    if (b == c || d == a) return 0; // 辺を共有している
+
+    const double diff = dt_get(dt, a, c) + dt_get(dt, b, d) - dt_get(dt, a, b) - dt_get(dt, c, d);
+    if (tried != NULL) (*tried)++;
+    if (!accept(rng, co, diff, t)) return 0;
+    tour_flip(tour, a, b, c, d);
+    return diff;
+  }
+
+  if (kind == SA_MOVE_OROPT) {
+    // s1 から始まる1〜3都市の区間を、区間の端の近くの都市 c とその次の都市 d の間に移す。向きは良い方
+    const int s1 = rng_int(rng, n);
+    const int len = 1 + rng_int(rng, 3);
+    int s2 = s1;
+    for (int k = 1; k < len; k++) s2 = tour_next(tour, s2);
+    const int end = rng_int(rng, 2) ? s1 : s2;
+    const int c = cand->nb[end * cand->k + rng_int(rng, cand->k)];
+    const int p = tour_prev(tour, s1), nx = tour_next(tour, s2);
+    if (c == p || nx == p || tour_between(tour, s1, c, s2)) return 0;
+    const int d = tour_next(tour, c);
+    if (d == p) return 0;
+
+    const double base = dt_get(dt, p, nx) - dt_get(dt, p, s1) - dt_get(dt, s2, nx) - dt_get(dt, c, d);
+    const double fwd = base + dt_get(dt, c, s1) + dt_get(dt, s2, d);
+    const double rev = base + dt_get(dt, c, s2) + dt_get(dt, s1, d);
+    const double diff = (rev < fwd) ? rev : fwd;
+    if (tried != NULL) (*tried)++;
+    if (!accept(rng, co, diff, t)) return 0;
+    tour_move_segment(tour, p, s1, s2, nx, c, d, rev < fwd);
+    return diff;
+  }
+
+  // 区間挿入の 3-opt: a b..c d ... e f → a d ... e b..c f
+  // d は a の候補、e は b の候補から選ぶので、新しい辺 (a, d), (e, b) はどちらも短い。区間の長さは決めない
+  const int a = rng_int(rng, n);
+  const int b = tour_next(tour, a);
+  const int d = cand->nb[a * cand->k + rng_int(rng, cand->k)];
+  if (d == b) return 0; // 区間が空
+  const int c = tour_prev(tour, d);
+  const int e = cand->nb[b * cand->k + rng_int(rng, cand->k)];
+  if (e == a || tour_between(tour, b, e, c)) return 0;
+  const int f = tour_next(tour, e);
+
+  const double diff = dt_get(dt, a, d) + dt_get(dt, e, b) + dt_get(dt, c, f)
+                    - dt_get(dt, a, b) - dt_get(dt, c, d) - dt_get(dt, e, f);
+  if (tried != NULL) (*tried)++;
+  if (!accept(rng, co, diff, t)) return 0;
+  tour_move_segment(tour, a, b, c, d, e, f, 0);
+  return diff;
+}
+
+// moves の近傍を並べたもの。1つだけなら乱数を使わずにそれを選ぶ
+static inline int move_kinds(int moves, int *kinds)
+{
+  int nk = 0;
+  for (int k = 0; k < SA_MOVE_COUNT; k++)
+    if (moves & (1 << k)) kinds[nk++] = k;
+  return nk;
+}
+
+// 焼きなましの途中経過を受け取る関数 (advance.c のチェックポイント用)
+// 反復 t を行う前に SA_CHECK 回ごとに呼ぶ。配列のまま探索しているときは tour は NULL で、route が今の巡回路
+#define SA_CHECK 65536
+typedef void (*SaHook)(void *arg, Tour *tour, const int *route, const Rng *rng, int T, int t0, int t, double co);
+
+// 焼きなまし法1回分 (advance.c)
+// route の巡回路から反復 start〜T-1 を行い、結果を route に入れて長さを返す。温度は T/t、t0 は始めた時刻
+// co は受理判定の係数 (co*T = -1 にそろえる)。候補リストがあれば moves の近傍を Tour の上で試し、なければ配列のまま 2-opt を試す
+// tried があれば、差分を計算した移動の回数を足す
+static inline double sa_calc(const City *city, const DistTable *dt, const Cand *cand, int n, int moves, int *route,
+                             Rng *rng, int T, double co, int t0, int start, SaHook hook, void *arg, long *tried)
+{
+  Tour tour;
+  if (cand != NULL) tour = tour_init((n >= TOUR_TREE_MIN_CITIES) ? TOUR_TREE : TOUR_ARRAY, route, n);
+  int kinds[SA_MOVE_COUNT];
+  const int nk = move_kinds(moves, kinds);
+  long count = 0;
+
+  for (int t=start; t<T; t++) {
+
+    if (hook != NULL && t % SA_CHECK == 0)
+      hook(arg, (cand != NULL) ? &tour : NULL, route, rng, T, t0, t, co);
+
+    if (cand != NULL) {
+      const int kind = (nk == 1) ? kinds[0] : kinds[rng_int(rng, nk)];
+      sa_move(&tour, dt, cand, n, kind, rng, co, t, &count);
+      continue;
+    }
+
+    int i = rng_int(rng, n-1) + 1;
+    int j = rng_int(rng, n-1) + 1;
+
+    // 2-opt法
+    
+    if (i > j) {
+      swap(&i, &j);
+    }
+    if (j - i <= 2) continue; // 確実に交差していない
+
+    double diff = 0;
+    diff -= dist(dt, route, i, (i + 1) % n);
+    diff -= dist(dt, route, (j - 1 + n) % n, j);
+    diff += dist(dt, route, i, (j - 1 + n) % n);
+    diff += dist(dt, route, (i + 1) % n, j);
+    count++;
+
+    if (accept(rng, co, diff, t)) {
+      // i番目とj番目の間をすべて逆向きにする
+      while (1) {
+        i = (i + 1) % n;
+        j = (j - 1 + n) % n;
+        swap(&route[i], &route[j]);
+        if (0 <= j - i && j - i <= 1) break;
+      }
+    }
+
+  }
+
+  if (cand != NULL) {
+    tour_get_route(&tour, route);
+    tour_free(tour);
+  }
+  if (tried != NULL) *tried += count;
+
+  double sum_d = 0;
+  for (int i = 0 ; i < n ; i++){
+    const int c0 = route[i];
+    const int c1 = route[(i+1)%n]; // nは0に戻る
+    sum_d += distance(city[c0],city[c1]);
+  }
+  return sum_d;
+}
+
+// 焼きなまし法 + 2点スワップ1回分 (advance_swap.c)
+// route の巡回路から反復 t0〜T-1 を行い、結果を route に入れて長さを返す。tried は sa_calc() と同じ
+static inline double sa_swap_calc(const City *city, const DistTable *dt, int n, int *route, Rng *rng, int T, int t0,
+                                  long *tried)
+{
+  const double co = -1.0 / T; //最大化なら正、最小化なら負。絶対値が小さいほど悪化方向へ進みやすい。Tが大きいほど小さくできる。
+
+  for (int t=t0; t<T; t++) {
+
+    int i = rng_int(rng, n-1) + 1;
+    int j = rng_int(rng, n-1) + 1;
+
+    // 2点スワップ
+
+    double diff = 0;
+    diff -= dist(dt, route, i, (i+n-1)%n);
+    diff -= dist(dt, route, i, (i+1)%n);
+    diff -= dist(dt, route, j, (j+n-1)%n);
+    diff -= dist(dt, route, j, (j+1)%n);
+    swap(&route[i], &route[j]);
+    diff += dist(dt, route, i, (i+n-1)%n);
+    diff += dist(dt, route, i, (i+1)%n);
+    diff += dist(dt, route, j, (j+n-1)%n);
+    diff += dist(dt, route, j, (j+1)%n);
+
+    if (!accept(rng, co, diff, t)) { // 大きく悪化した場合
+      swap(&route[i], &route[j]); // 元に戻す
+    }
+
+  }
+  if (tried != NULL && T > t0) *tried += T - t0;
+
+  double sum_d = 0;
+  for (int i = 0 ; i < n ; i++){
+    const int c0 = route[i];
+    const int c1 = route[(i+1)%n]; // nは0に戻る
+    sum_d += distance(city[c0],city[c1]);
+  }
+  return sum_d;
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+
+  多スタートの打ち切り判定 (advance.c, tsp1.c, tsp_ga.c で共通)
+  1回解くごとに stop_update() に長さを渡し、1 が返ったら止める
+  (tsp_ga.c は stop_update() を使わず、stop_time_up() と stop_at だけを見る)
+
+*/
+
+#ifndef TSP_STOP_H
+#define TSP_STOP_H
+
+#include <math.h>
+#include <time.h>
+
+// 多スタートの打ち切り判定
+// 最良解が出てからの回数 m (出た回も含む) と、そのうち最良解と同じ長さになった回数 h を数える。
+// 1回で最良解にたどり着く確率を h / (m + 1) とみて、もっと良い解があってもたどり着きやすさが同じくらいなら、
+// それを m 回続けて逃す確率は (1 - h / (m + 1))^m (h が増えるとほぼ e^-h)。これが 1 - confidence 以下になったら止める。
+// ほかに、経過時間が deadline を超えたときと、最良解が stop_at (下界から決めた目標) 以下になったときも止める
+#define STOP_CONFIDENCE 0.99 // 既定の信頼度
+#ifndef STOP_MIN_RESTARTS
+#define STOP_MIN_RESTARTS 16 // これより少ない回数では確率での判定をしない (advance.c は 4)
+#endif
+#define STOP_TIE 1e-9        // 相対差がこれ以下なら同じ長さとみなす
+
+typedef struct {
+  double confidence; // 0 なら確率での判定はしない
+  double deadline;   // 秒 (0 なら制限なし)
+  double stop_at;    // 0 なら使わない
+  struct timespec start;
+  int restarts, since, hits;
+  double best;
+  const char *reason; // 止めた理由 (止めていなければ NULL)
+} StopRule;
+
+// 多スタートの打ち切り判定 (StopRule の前のコメントを参照)
+static inline StopRule stop_init(double confidence, double deadline, double stop_at)
+{
+  StopRule st = {.confidence = confidence, .deadline = deadline, .stop_at = stop_at, .best = 1e300};
+  clock_gettime(CLOCK_MONOTONIC, &st.start);
+  return st;
+}
+
+static inline int stop_time_up(const StopRule *st)
+{
+  if (st->deadline <= 0) return 0;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - st->start.tv_sec) + (now.tv_nsec - st->start.tv_nsec) * 1e-9 >= st->deadline;
+}
+
+// 1回分の結果 (巡回路の長さ) を入れる。止めるなら 1 を返す
+static inline int stop_update(StopRule *st, double d)
+{
+  st->restarts++;
+  if (d < st->best * (1 - STOP_TIE)) {
+    st->best = d;
+    st->since = 1;
+    st->hits = 1;
+  } else {
+    st->since++;
+    if (d <= st->best * (1 + STOP_TIE)) st->hits++;
+  }
+  if (st->best <= st->stop_at) st->reason = "gap";
+  else if (stop_time_up(st)) st->reason = "deadline";
+  else if (st->confidence > 0 && st->restarts >= STOP_MIN_RESTARTS &&
+           pow(1 - (double)st->hits / (st->since + 1), st->since) <= 1 - st->confidence)
+    st->reason = "confidence";
+  return st->reason != NULL;
+}
+
+#endif
@@ -0,0 +1,299 @@
+/*
+
+  巡回路の表現 Tour (advance.c, bench.c で共通)
+  配列のままか、反転フラグ付きの平衡二分木 (treap) で持ち、tour_flip() で 2-opt のつなぎ替えをする
+
+*/
+
+#ifndef TSP_TOUR_H
+#define TSP_TOUR_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// 巡回路の表現
+// 探索からは tour_next / tour_prev / tour_between / tour_flip (と、それをつなげた tour_move2 など) だけを使う
+// TOUR_ARRAY: 配列 route と都市の位置 pos。flip は内側と外側の短い方を逆順にする (最悪 n/2)
+// TOUR_TREE : 位置の順に並べた平衡二分木 (treap) の各ノードに反転フラグを持たせたもの。
+//             区間の反転はフラグを立てるだけなので flip は O(log n) で、巡回路の長さにほぼよらない
+enum { TOUR_ARRAY, TOUR_TREE };
+#ifndef TOUR_TREE_MIN_CITIES
+#define TOUR_TREE_MIN_CITIES 10000 // これ以上の都市数なら TOUR_TREE を使う
+#endif
+
+typedef struct {
+  int type;
+  int n;
+  int *route;     // TOUR_ARRAY: i番目の都市
+  int *pos;       // TOUR_ARRAY: 都市の位置
+  int root;       // TOUR_TREE: 根の都市
+  int *lc, *rc, *par, *sz;
+  unsigned *pri;  // treap の優先度
+  char *rev;      // 部分木を反転するフラグ
+  int *stk;       // 作業用
+} Tour;
+
+static inline int tr_size(const Tour *t, int x)
+{
+  return (x < 0) ? 0 : t->sz[x];
+}
+
+static inline void tr_update(Tour *t, int x)
+{
+  t->sz[x] = 1 + tr_size(t, t->lc[x]) + tr_size(t, t->rc[x]);
+  if (t->lc[x] >= 0) t->par[t->lc[x]] = x;
+  if (t->rc[x] >= 0) t->par[t->rc[x]] = x;
+}
+
+// 反転フラグを子に伝える
+static inline void tr_push(Tour *t, int x)
+{
+  if (!t->rev[x]) return;
+  const int l = t->lc[x];
+  t->lc[x] = t->rc[x];
+  t->rc[x] = l;
+  if (t->lc[x] >= 0) t->rev[t->lc[x]] ^= 1;
+  if (t->rc[x] >= 0) t->rev[t->rc[x]] ^= 1;
+  t->rev[x] = 0;
+}
+
+static inline int tr_merge(Tour *t, int a, int b)
+{
+  if (a < 0) return b;
+  if (b < 0) return a;
+  if (t->pri[a] > t->pri[b]) {
+    tr_push(t, a);
+    t->rc[a] = tr_merge(t, t->rc[a], b);
+    tr_update(t, a);
+    return a;
+  } else {
+    tr_push(t, b);
+    t->lc[b] = tr_merge(t, a, t->lc[b]);
+    tr_update(t, b);
+    return b;
+  }
+}
+
+// 先頭k個を *l に、残りを *r に分ける
+static inline void tr_split(Tour *t, int x, int k, int *l, int *r)
+{
+  if (x < 0) {
+    *l = *r = -1;
+    return;
+  }
+  tr_push(t, x);
+  if (tr_size(t, t->lc[x]) < k) {
+    tr_split(t, t->rc[x], k - tr_size(t, t->lc[x]) - 1, &t->rc[x], r);
+    *l = x;
+  } else {
+    tr_split(t, t->lc[x], k, l, &t->lc[x]);
+    *r = x;
+  }
+  tr_update(t, x);
+}
+
+// 都市xの位置 (根からxまでの反転フラグを先に伝えておく)
+static inline int tr_index(Tour *t, int x)
+{
+  int top = 0;
+  for (int y = x; y >= 0; y = t->par[y]) t->stk[top++] = y;
+  while (top > 0) tr_push(t, t->stk[--top]);
+  int idx = tr_size(t, t->lc[x]);
+  for (int y = x; t->par[y] >= 0; y = t->par[y]) {
+    const int p = t->par[y];
+    if (t->rc[p] == y) idx += tr_size(t, t->lc[p]) + 1;
+  }
+  return idx;
+}
+
+// k番目の都市
+static inline int tr_at(Tour *t, int k)
+{
+  int x = t->root;
+  while (1) {
+    tr_push(t, x);
+    const int ls = tr_size(t, t->lc[x]);
+    if (k < ls) x = t->lc[x];
+    else if (k == ls) return x;
+    else {
+      k -= ls + 1;
+      x = t->rc[x];
+    }
+  }
+}
+
+// 位置 i〜j (i <= j) を逆順にする
+static inline void tr_reverse(Tour *t, int i, int j)
+{
+  int a, b, c;
+  tr_split(t, t->root, i, &a, &b);
+  tr_split(t, b, j - i + 1, &b, &c);
+  t->rev[b] ^= 1;
+  t->root = tr_merge(t, tr_merge(t, a, b), c);
+  t->par[t->root] = -1;
+}
+
+static inline Tour tour_init(int type, const int *route, int n)
+{
+  Tour t = {.type = type, .n = n};
+  t.route = (int*)malloc(sizeof(int) * n);
+  t.pos = (int*)malloc(sizeof(int) * n);
+  memcpy(t.route, route, sizeof(int) * n);
+  for (int i = 0; i < n; i++) t.pos[route[i]] = i;
+  if (type == TOUR_ARRAY) return t;
+
+  t.lc = (int*)malloc(sizeof(int) * n);
+  t.rc = (int*)malloc(sizeof(int) * n);
+  t.par = (int*)malloc(sizeof(int) * n);
+  t.sz = (int*)malloc(sizeof(int) * n);
+  t.pri = (unsigned*)malloc(sizeof(unsigned) * n);
+  t.rev = (char*)calloc(n, sizeof(char));
+  t.stk = (int*)malloc(sizeof(int) * n);
+
+  // 順に末尾へ merge していく (優先度は乱数)
+  unsigned x = 2463534242u;
+  t.root = -1;
+  for (int i = 0; i < n; i++) {
+    const int c = route[i];
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    t.pri[c] = x;
+    t.lc[c] = t.rc[c] = t.par[c] = -1;
+    t.sz[c] = 1;
+    t.root = tr_merge(&t, t.root, c);
+  }
+  t.par[t.root] = -1;
+  return t;
+}
+
+static inline void tour_free(Tour t)
+{
+  free(t.route);
+  free(t.pos);
+  if (t.type == TOUR_ARRAY) return;
+  free(t.lc);
+  free(t.rc);
+  free(t.par);
+  free(t.sz);
+  free(t.pri);
+  free(t.rev);
+  free(t.stk);
+}
+
+// 都市cの位置
+static inline int tour_pos(Tour *t, int c)
+{
+  return (t->type == TOUR_ARRAY) ? t->pos[c] : tr_index(t, c);
+}
+
+// 都市cの次の都市
+static inline int tour_next(Tour *t, int c)
+{
+  if (t->type == TOUR_ARRAY) return t->route[(t->pos[c] + 1) % t->n];
+  return tr_at(t, (tr_index(t, c) + 1) % t->n);
+}
+
+// 都市cの前の都市
+static inline int tour_prev(Tour *t, int c)
+{
+  if (t->type == TOUR_ARRAY) return t->route[(t->pos[c] + t->n - 1) % t->n];
+  return tr_at(t, (tr_index(t, c) + t->n - 1) % t->n);
+}
+
+// aから順方向にcまで進む間にbがあるか
+static inline int tour_between(Tour *t, int a, int b, int c)
+{
+  const int pa = tour_pos(t, a), pb = tour_pos(t, b), pc = tour_pos(t, c);
+  if (pa <= pc) return pa <= pb && pb <= pc;
+  return pb >= pa || pb <= pc;
+}
+
+// 位置 i から len 個を (末尾から先頭へ回り込みながら) 逆順にする
+static inline void array_reverse(Tour *t, int i, int len)
+{
+  const int n = t->n;
+  int p = i, q = (i + len - 1) % n;
+  for (int k = 0; k < len / 2; k++) {
+    const int cp = t->route[p], cq = t->route[q];
+    t->route[p] = cq;
+    t->route[q] = cp;
+    t->pos[cq] = p;
+    t->pos[cp] = q;
+    p = (p + 1 == n) ? 0 : p + 1;
+    q = (q == 0) ? n - 1 : q - 1;
+  }
+}
+
+// 辺 (a, b), (c, d) (b = next(a), d = next(c)) を (a, c), (b, d) につなぎ替える
+// b〜c を逆順にするのと d〜a を逆順にするのは巡回路として同じなので、都合のよい方を選ぶ
+static inline void tour_flip(Tour *t, int a, int b, int c, int d)
+{
+  const int n = t->n;
+  if (t->type == TOUR_ARRAY) {
+    const int len = (t->pos[c] - t->pos[b] + n) % n + 1;
+    if (2 * len <= n) array_reverse(t, t->pos[b], len);
+    else array_reverse(t, t->pos[d], n - len);
+    return;
+  }
+  const int pb = tr_index(t, b), pc = tr_index(t, c);
+  if (pb <= pc) tr_reverse(t, pb, pc);
+  else tr_reverse(t, tr_index(t, d), tr_index(t, a));
+}
+
+// 位置 p0 の都市から始まる順に route に書き出す
+static inline void tour_write(Tour *t, int *route, int p0)
+{
+  const int n = t->n;
+  if (t->type == TOUR_ARRAY) {
+    for (int i = 0; i < n; i++) route[i] = t->route[(p0 + i) % n];
+    return;
+  }
+  // 木を順に (中間順で) たどり、p0 が先頭になるようにずらす
+  int top = 0, k = 0;
+  int x = t->root;
+  while (top > 0 || x >= 0) {
+    if (x >= 0) {
+      tr_push(t, x);
+      t->stk[top++] = x;
+      x = t->lc[x];
+    } else {
+      x = t->stk[--top];
+      route[(k - p0 + n) % n] = x;
+      k++;
+      x = t->rc[x];
+    }
+  }
+}
+
+// 都市0から始まる順に route に書き出す
+static inline void tour_get_route(Tour *t, int *route)
+{
+  tour_write(t, route, tour_pos(t, 0));
+}
+
+// 中の順のまま書き出す。tour_init() に渡すと同じ状態に戻る (treap の形は変わるが、順序と以後の動きは同じ)
+static inline void tour_get_sequence(Tour *t, int *route)
+{
+  tour_write(t, route, 0);
+}
+
+// 辺 (u1, u2), (v1, v2) を外して (u1, v1), (u2, v2) をつなぐ 2-opt
+// 巡回路の上で u1 u2 ... v1 v2 の順に並んでいればよく、tour_next の向きはどちらでもよい
+static inline void tour_move2(Tour *t, int u1, int u2, int v1, int v2)
+{
+  if (tour_next(t, u1) == u2) tour_flip(t, u1, u2, v1, v2);
+  else tour_flip(t, u2, u1, v2, v1);
+}
+
+// 区間 s1..s2 (前が p, 後ろが nx) を、区間の外の辺 (c, d) の間に移す (rev なら逆向きにして c s2..s1 d)
+// p s1..s2 nx ... c d の並びを、2-opt を2回 (rev) か3回つなげて作る
+//   p [s1..s2 nx..c] d  → p c..nx s2..s1 d
+//   p [c..nx] s2..s1 d  → p nx..c s2..s1 d
+//   c [s2..s1] d        → c s1..s2 d
+static inline void tour_move_segment(Tour *t, int p, int s1, int s2, int nx, int c, int d, int rev)
+{
+  tour_move2(t, p, s1, c, d);
+  if (nx != c) tour_move2(t, p, c, nx, s2);
+  if (!rev && s1 != s2) tour_move2(t, c, s2, s1, d);
+}
+
+#endif
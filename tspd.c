@@ -0,0 +1,1070 @@
+/*
+
+  TSP を解くデーモン
+  Unix ドメインソケットで要求を受け付け、決まった数のワーカースレッドで解いて巡回路を返す。
+  1回ごとにプロセスを起動したり、地図を描いて sleep(1) したりしないので、小さな問題をたくさん解くときに速い。
+  ワーカーはそれぞれ作業領域 (距離表・候補リスト・巡回路など) を持ち、問題が変わっても使い回す。
+
+  解き方: 候補リストの辺での貪欲法で初期解を作り、2-opt と Or-opt の局所探索 (don't-look bits) で改善する
+
+  要求は Request の後に本体が続く (整数はすべてリトルエンディアン)
+    REQ_INLINE: len 組の (x, y) を int32 で
+    REQ_PATH  : len バイトの都市ファイルのパス (v1 でも v2 でもよい)
+    REQ_DELTA : 前の問題と巡回路への変更。len 組の (x, y) (int32)、前の巡回路 (len 個の uint32)、
+                変更の数 m (uint32)、m 個の Edit が続く
+  変更 (EDIT_INSERT / EDIT_DELETE / EDIT_MOVE) のあとの都市の番号は、消さなかった都市を前の番号の順に詰め、
+  その後ろに追加した都市を Edit の順に並べたもの。巡回路は前の巡回路から消した・動かした都市を抜いて
+  つなぎ、動かした都市と追加した都市を一番短くなる辺へ挿入 (cheapest insertion) してから、
+  変わったところの周りだけで局所探索する。都市数が多くても、全体を解き直すよりずっと速い
+  1つの接続で返信を待たずに要求を続けて送ってよい。返信は解けた順なので、id で要求と対応を取る
+  返信は flags に REPLY_JSON がなければ ReplyHeader の後に n 個の都市番号 (uint32)。JSON なら1行で
+    {"id":1,"status":0,"length":123.456789,"tour":[0,3,1,2]}
+    {"id":2,"status":2,"error":"cannot open file"}
+  エラーのときはバイナリでも n = 0 で、status に理由が入る
+
+  -d を指定すると、デーモンにはならずに1回だけ変更を当てて巡回路を表示する
+  (巡回路のファイルは都市番号を並べたテキスト。advance などの "0 -> 3 -> ... -> 0" もそのまま読める。
+   変更のファイルは1行に1つ "insert x y" / "delete id" / "move id x y"。-o で変更後の都市ファイルを v1 形式で書き出す)
+  1つの都市を消したり動かしたりできるのは1回まで (2回目の変更があるとエラーになる)
+
+  使い方: tspd [-s socket] [-j workers] [-q queue]
+          tspd -d <city file> <tour file> <edit file> [-o new city file]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// 都市ファイルと候補リストの格子は共通のヘッダにある
+#include "tsp_city.h"
+#include "tsp_dist.h"
+
+#define TSPD_SOCKET "/tmp/tspd.sock"
+#define TSPD_QUEUE 1024           // 待ち行列の長さ (いっぱいなら要求の読み込みを待たせる)
+#define TSPD_MAX_CITIES (1 << 22) // 1つの要求で受け付ける都市数の上限
+#define TSPD_TABLE_MAX 2048       // これ以下の都市数なら距離表を作る (ワーカーごとに最大 16MB)
+#define LS_EPS 1e-9               // 局所探索で改善とみなす下限 (誤差で行ったり来たりしないように)
+
+// 要求と返信
+#define REQ_MAGIC 0x51505354u   // "TSPQ"
+#define REPLY_MAGIC 0x52505354u // "TSPR"
+enum { REQ_INLINE, REQ_PATH, REQ_DELTA };
+#define REPLY_JSON 1
+enum { ST_OK, ST_BAD_REQUEST, ST_LOAD_FAILED, ST_TOO_LARGE };
+
+typedef struct {
+  uint32_t magic;
+  uint32_t id;    // 返信にそのまま付ける
+  uint16_t kind;  // REQ_INLINE, REQ_PATH, REQ_DELTA
+  uint16_t flags; // REPLY_JSON
+  uint32_t len;   // REQ_INLINE, REQ_DELTA: 都市数, REQ_PATH: パスのバイト数
+} Request;
+
+// 都市の追加・削除・移動
+enum { EDIT_INSERT, EDIT_DELETE, EDIT_MOVE };
+typedef struct {
+  int32_t op;
+  int32_t id;   // EDIT_DELETE, EDIT_MOVE: 前の番号
+  int32_t x, y; // EDIT_INSERT, EDIT_MOVE: 新しい座標
+} Edit;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t id;
+  int32_t status;
+  uint32_t n;
+  double length;
+} ReplyHeader;
+
+// 接続。読み込みスレッドと、この接続の要求を持っているジョブが参照し、refs が 0 になったら閉じる
+typedef struct {
+  int fd;
+  atomic_int refs;
+  pthread_mutex_t wmu; // 返信を書くときのロック (ワーカーどうしで混ざらないように)
+} Conn;
+
+typedef struct {
+  Conn *conn;
+  uint32_t id;
+  uint16_t kind, flags;
+  int n;
+  City *city; // REQ_INLINE, REQ_DELTA の座標
+  char *path; // REQ_PATH のパス
+  int *tour;  // REQ_DELTA の前の巡回路と変更
+  Edit *edit;
+  int m;
+} Job;
+
+// ワーカーへ渡す待ち行列 (リングバッファ)
+typedef struct {
+  Job **buf;
+  int cap, head, len;
+  int stop;
+  pthread_mutex_t mu;
+  pthread_cond_t not_empty, not_full;
+} JobQueue;
+
+// ワーカーごとの作業領域。cap 都市分まではそのまま使い、大きい問題が来たら広げる
+typedef struct {
+  int cap;
+  int table_cap;  // 距離表を確保してある都市数
+  int n;
+  const City *city;
+  float *d;       // 距離表 (use_table のとき。n x n)
+  int use_table;
+  int *nb;        // 候補リスト: 都市 i の候補は nb[i*k] 〜 (近い順)。has_cand[i] が 0 ならまだ作っていない
+  char *has_cand;
+  int k;
+  int *route, *pos;
+  int *queue;     // 調べる都市の待ち行列
+  char *in_queue;
+  CandGrid grid;                // 候補リスト用の格子
+  uint64_t *edges;              // 貪欲法の辺
+  int *adj, *parent, *ends;
+  char *mark, *in_tour;         // 巡回路を直すとき用
+  char *out;      // 返信
+  size_t out_cap;
+} Workspace;
+
+// 都市ファイルを読んで *city (malloc したもの) と *n に入れる
+// デーモンは止まってはいけないので、load_cities() と違って exit せずにエラーの理由を返す (成功なら NULL)
+const char *read_city_file(const char *filename, City **city, int *n)
+{
+  CityFile cf;
+  const char *err = read_cities(filename, TSPD_MAX_CITIES, &cf);
+  if (err != NULL) return err;
+  *n = cf.n;
+  *city = (City*)malloc(sizeof(City) * (size_t)cf.n);
+  memcpy(*city, cf.city, sizeof(City) * (size_t)cf.n);
+  unload_cities(cf);
+  return NULL;
+}
+
+// 作業領域を n 都市分以上にする (足りているときは何もしない)
+void ws_reserve(Workspace *ws, int n)
+{
+  if (n > ws->cap) {
+    const int cap = max(n, 2 * ws->cap);
+    ws->nb = (int*)realloc(ws->nb, sizeof(int) * (size_t)cap * CAND_K);
+    ws->route = (int*)realloc(ws->route, sizeof(int) * cap);
+    ws->pos = (int*)realloc(ws->pos, sizeof(int) * cap);
+    ws->queue = (int*)realloc(ws->queue, sizeof(int) * cap);
+    ws->in_queue = (char*)realloc(ws->in_queue, cap);
+    ws->grid.cell_of = (int*)realloc(ws->grid.cell_of, sizeof(int) * cap);
+    ws->grid.start = (int*)realloc(ws->grid.start, sizeof(int) * (cap + 1));
+    ws->grid.items = (int*)realloc(ws->grid.items, sizeof(int) * cap);
+    ws->edges = (uint64_t*)realloc(ws->edges, sizeof(uint64_t) * (size_t)cap * CAND_K);
+    ws->adj = (int*)realloc(ws->adj, sizeof(int) * 2 * cap);
+    ws->parent = (int*)realloc(ws->parent, sizeof(int) * cap);
+    ws->ends = (int*)realloc(ws->ends, sizeof(int) * cap);
+    ws->has_cand = (char*)realloc(ws->has_cand, cap);
+    ws->mark = (char*)realloc(ws->mark, cap);
+    ws->in_tour = (char*)realloc(ws->in_tour, cap);
+    ws->cap = cap;
+  }
+  if (n <= TSPD_TABLE_MAX && n > ws->table_cap) {
+    const int cap = min(TSPD_TABLE_MAX, max(n, 2 * ws->table_cap));
+    free(ws->d);
+    ws->d = (float*)malloc(sizeof(float) * (size_t)cap * cap);
+    ws->table_cap = cap;
+  }
+}
+
+void ws_free(Workspace *ws)
+{
+  free(ws->d);
+  free(ws->nb);
+  free(ws->route);
+  free(ws->pos);
+  free(ws->queue);
+  free(ws->in_queue);
+  free(ws->grid.cell_of);
+  free(ws->grid.start);
+  free(ws->grid.items);
+  free(ws->edges);
+  free(ws->adj);
+  free(ws->parent);
+  free(ws->ends);
+  free(ws->has_cand);
+  free(ws->mark);
+  free(ws->in_tour);
+  free(ws->out);
+}
+
+// 都市 a, b 間の距離 (表があれば表から)
+static inline double wd(const Workspace *ws, int a, int b)
+{
+  if (ws->use_table) return ws->d[(size_t)a * ws->n + b];
+  return distance(ws->city[a], ws->city[b]);
+}
+
+// 候補リスト: 各都市について近い順に k 個の都市を持つ (作り方は build_candidates() と同じ)
+// 格子は先に作っておき、各都市の候補は使うときに作る (巡回路を直すときは、変わったところの周りしか使わない)
+static void ws_grid(Workspace *ws)
+{
+  ws->k = min(CAND_K, ws->n - 1);
+  memset(ws->has_cand, 0, ws->n);
+  cand_grid_build(&ws->grid, ws->city, ws->n, ws->route); // 詰めるときの作業用には route を借りる
+}
+
+// 都市 i の候補リストを作る
+static void ws_cand_city(Workspace *ws, int i)
+{
+  double best[CAND_K];
+  cand_grid_nearest(&ws->grid, ws->city, i, ws->k, ws->nb + (size_t)i * ws->k, best);
+  ws->has_cand[i] = 1;
+}
+
+static inline const int *cand_of(Workspace *ws, int i)
+{
+  if (!ws->has_cand[i]) ws_cand_city(ws, i);
+  return ws->nb + (size_t)i * ws->k;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static int uf_find(int *parent, int x)
+{
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
+}
+
+// 貪欲法 (build_greedy_route() と同じ。ただし乱数の揺らぎは入れない)
+// 候補リストの辺を短い順に、次数が2を超えず閉路もできない辺だけ採用し、
+// 断片をたどり終えた端から一番近い別の断片の端点へ進む (端点は線形に探す。小さい問題向け)
+static void ws_greedy(Workspace *ws)
+{
+  const int n = ws->n, k = ws->k;
+  size_t m = 0;
+  for (int i = 0; i < n; i++) {
+    for (int t = 0; t < k; t++) {
+      const int j = ws->nb[i * k + t];
+      if (j < i) {
+        int dup = 0;
+        for (int u = 0; u < k; u++) dup |= (ws->nb[j * k + u] == i);
+        if (dup) continue;
+      }
+      const float w = wd(ws, i, j);
+      uint32_t bits;
+      memcpy(&bits, &w, sizeof(bits));
+      ws->edges[m++] = ((uint64_t)bits << 32) | (uint32_t)(i * k + t);
+    }
+  }
+  qsort(ws->edges, m, sizeof(uint64_t), cmp_u64);
+
+  int *adj = ws->adj, *parent = ws->parent;
+  for (int i = 0; i < n; i++) {
+    adj[2*i] = adj[2*i+1] = -1;
+    parent[i] = i;
+  }
+  for (size_t p = 0; p < m; p++) {
+    const uint32_t q = (uint32_t)ws->edges[p];
+    const int a = q / k, b = ws->nb[q];
+    if (adj[2*a+1] >= 0 || adj[2*b+1] >= 0) continue;
+    const int ra = uf_find(parent, a), rb = uf_find(parent, b);
+    if (ra == rb) continue;
+    parent[ra] = rb;
+    adj[2*a + (adj[2*a] >= 0)] = b;
+    adj[2*b + (adj[2*b] >= 0)] = a;
+  }
+
+  int ne = 0;
+  for (int i = 0; i < n; i++)
+    if (adj[2*i+1] < 0) ws->ends[ne++] = i;
+  // 端点の番号から ends の中の位置を引くのに pos を借りる
+  for (int e = 0; e < ne; e++) ws->pos[ws->ends[e]] = e;
+  int cur = ws->ends[0], len = 0;
+  while (cur >= 0) {
+    int prev = -1, x = cur;
+    while (1) {
+      ws->route[len++] = x;
+      const int next = (adj[2*x] >= 0 && adj[2*x] != prev) ? adj[2*x] : (adj[2*x+1] != prev ? adj[2*x+1] : -1);
+      if (next < 0) break;
+      prev = x;
+      x = next;
+    }
+    // たどった断片の両端を端点から取り除く
+    const int both[2] = {cur, x};
+    for (int a = 0; a < 2; a++) {
+      const int e = ws->pos[both[a]];
+      if (e >= ne || ws->ends[e] != both[a]) continue;
+      ws->ends[e] = ws->ends[--ne];
+      ws->pos[ws->ends[e]] = e;
+    }
+    cur = -1;
+    double best = 1e300;
+    for (int e = 0; e < ne; e++) {
+      const double d = wd(ws, x, ws->ends[e]);
+      if (d < best) {
+        best = d;
+        cur = ws->ends[e];
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) ws->pos[ws->route[i]] = i;
+}
+
+// 配列の巡回路の操作 (advance.c の TOUR_ARRAY と同じ)
+static inline int next_city(const Workspace *ws, int c)
+{
+  return ws->route[(ws->pos[c] + 1) % ws->n];
+}
+
+static inline int prev_city(const Workspace *ws, int c)
+{
+  return ws->route[(ws->pos[c] + ws->n - 1) % ws->n];
+}
+
+// aから順方向にcまで進む間にbがあるか
+static int between(const Workspace *ws, int a, int b, int c)
+{
+  const int pa = ws->pos[a], pb = ws->pos[b], pc = ws->pos[c];
+  if (pa <= pc) return pa <= pb && pb <= pc;
+  return pb >= pa || pb <= pc;
+}
+
+// 位置 i から len 個を (末尾から先頭へ回り込みながら) 逆順にする
+static void reverse_span(Workspace *ws, int i, int len)
+{
+  const int n = ws->n;
+  int p = i, q = (i + len - 1) % n;
+  for (int k = 0; k < len / 2; k++) {
+    const int cp = ws->route[p], cq = ws->route[q];
+    ws->route[p] = cq;
+    ws->route[q] = cp;
+    ws->pos[cq] = p;
+    ws->pos[cp] = q;
+    p = (p + 1 == n) ? 0 : p + 1;
+    q = (q == 0) ? n - 1 : q - 1;
+  }
+}
+
+// 辺 (a, b), (c, d) (b = next(a), d = next(c)) を (a, c), (b, d) につなぎ替える。短い方を逆順にする
+static void flip(Workspace *ws, int a, int b, int c, int d)
+{
+  const int n = ws->n;
+  (void)a;
+  const int len = (ws->pos[c] - ws->pos[b] + n) % n + 1;
+  if (2 * len <= n) reverse_span(ws, ws->pos[b], len);
+  else reverse_span(ws, ws->pos[d], n - len);
+}
+
+// 辺 (u1, u2), (v1, v2) を外して (u1, v1), (u2, v2) をつなぐ (巡回路の向きはどちらでもよい)
+static void move2(Workspace *ws, int u1, int u2, int v1, int v2)
+{
+  if (next_city(ws, u1) == u2) flip(ws, u1, u2, v1, v2);
+  else flip(ws, u2, u1, v2, v1);
+}
+
+// 区間 s1..s2 (前が p, 後ろが nx) を、区間の外の辺 (c, d) の間に移す (rev なら c s2..s1 d)
+static void move_segment(Workspace *ws, int p, int s1, int s2, int nx, int c, int d, int rev)
+{
+  move2(ws, p, s1, c, d);
+  if (nx != c) move2(ws, p, c, nx, s2);
+  if (!rev && s1 != s2) move2(ws, c, s2, s1, d);
+}
+
+static inline void push_city(Workspace *ws, int *tail, int *len, int c)
+{
+  if (ws->in_queue[c]) return;
+  ws->queue[*tail] = c;
+  *tail = (*tail + 1) % ws->n;
+  (*len)++;
+  ws->in_queue[c] = 1;
+}
+
+// 都市 a の周りで改善する 2-opt か Or-opt を1つ探して行う。行ったら、周りが変わった都市を待ち行列に入れて 1 を返す
+static int improve_city(Workspace *ws, int a, int *tail, int *len)
+{
+  const int k = ws->k;
+  // 2-opt: a とその近くの都市 c を隣り合わせる (a の後ろの辺と前の辺の両方で試す)
+  for (int dir = 0; dir < 2; dir++) {
+    const int b = dir ? prev_city(ws, a) : next_city(ws, a);
+    const double dab = wd(ws, a, b);
+    for (int t = 0; t < k; t++) {
+      const int c = cand_of(ws, a)[t];
+      const double dac = wd(ws, a, c);
+      if (dac >= dab) break; // 近い順なので、これより先は改善しない
+      const int d = dir ? prev_city(ws, c) : next_city(ws, c);
+      if (c == b || d == a) continue;
+      if (dac + wd(ws, b, d) - dab - wd(ws, c, d) < -LS_EPS) {
+        if (dir) flip(ws, b, a, d, c);
+        else flip(ws, a, b, c, d);
+        const int touched[4] = {a, b, c, d};
+        for (int u = 0; u < 4; u++) push_city(ws, tail, len, touched[u]);
+        return 1;
+      }
+    }
+  }
+
+  // Or-opt: a から始まる1〜3都市の区間を、区間の端の近くの都市の前後へ (逆向きにもして) 移す
+  int s2 = a;
+  for (int sl = 1; sl <= 3 && sl < ws->n - 2; sl++) {
+    if (sl > 1) s2 = next_city(ws, s2);
+    const int p = prev_city(ws, a), nx = next_city(ws, s2);
+    if (nx == p) break;
+    const double base = wd(ws, p, nx) - wd(ws, p, a) - wd(ws, s2, nx);
+    for (int t = 0; t < 2 * k; t++) {
+      const int y = cand_of(ws, (t < k) ? a : s2)[t % k];
+      if (between(ws, a, y, s2)) continue;
+      for (int side = 0; side < 2; side++) {
+        // 辺 (c, d) は y の後ろか前の辺
+        const int c = side ? prev_city(ws, y) : y;
+        const int d = next_city(ws, c);
+        if (c == p || d == a || d == p || between(ws, a, c, s2)) continue;
+        const double cut = base - wd(ws, c, d);
+        const double fwd = cut + wd(ws, c, a) + wd(ws, s2, d);
+        const double rev = cut + wd(ws, c, s2) + wd(ws, a, d);
+        if (fwd < -LS_EPS || rev < -LS_EPS) {
+          move_segment(ws, p, a, s2, nx, c, d, rev < fwd);
+          const int touched[6] = {p, a, s2, nx, c, d};
+          for (int u = 0; u < 6; u++) push_city(ws, tail, len, touched[u]);
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// 待ち行列 (先頭は 0、tail と len まで入っている) の都市から、改善がなくなるまで局所探索する
+static void ws_local_search(Workspace *ws, int tail, int len)
+{
+  int head = 0;
+  while (len > 0) {
+    const int c = ws->queue[head];
+    head = (head + 1) % ws->n;
+    len--;
+    ws->in_queue[c] = 0;
+    if (improve_city(ws, c, &tail, &len)) push_city(ws, &tail, &len, c);
+  }
+}
+
+// 都市 0 が先頭に来るように回して、巡回路の長さを返す (作業用に queue を借りる)
+static double ws_finish(Workspace *ws)
+{
+  const int n = ws->n;
+  const int z = ws->pos[0];
+  for (int i = 0; i < n; i++) ws->queue[i] = ws->route[(z + i) % n];
+  memcpy(ws->route, ws->queue, sizeof(int) * n);
+  for (int i = 0; i < n; i++) ws->pos[ws->route[i]] = i;
+  double sum_d = 0;
+  for (int i = 0; i < n; i++) sum_d += distance(ws->city[ws->route[i]], ws->city[ws->route[(i+1)%n]]);
+  return sum_d;
+}
+
+// n 都市の問題を解いて ws->route に巡回路 (都市 0 から) を入れ、長さを返す
+double solve_job(Workspace *ws, const City *city, int n)
+{
+  ws_reserve(ws, n);
+  ws->n = n;
+  ws->city = city;
+  ws->use_table = (n <= TSPD_TABLE_MAX);
+  if (n <= 3) {
+    for (int i = 0; i < n; i++) ws->route[i] = ws->pos[i] = i;
+  } else {
+    if (ws->use_table) {
+      for (int a = 0; a < n; a++) {
+        ws->d[(size_t)a * n + a] = 0;
+        for (int b = a + 1; b < n; b++)
+          ws->d[(size_t)a * n + b] = ws->d[(size_t)b * n + a] = distance(city[a], city[b]);
+      }
+    }
+    // 貪欲法は全都市の候補リストを使う
+    ws_grid(ws);
+    for (int i = 0; i < n; i++) ws_cand_city(ws, i);
+    ws_greedy(ws);
+
+    // 局所探索 (全都市を待ち行列に入れ、改善がなくなるまで)
+    int tail = 0, len = 0;
+    memset(ws->in_queue, 0, n);
+    for (int i = 0; i < n; i++) push_city(ws, &tail, &len, ws->route[i]);
+    ws_local_search(ws, tail, len);
+  }
+  return ws_finish(ws);
+}
+
+// 前の問題 (n 都市の city と巡回路 tour) に m 個の変更を当てて、巡回路を直す
+// 変更後の都市を *new_city (malloc したもの) と *new_n に、巡回路 (都市 0 から) を ws->route に、長さを *length に入れる
+// 距離表は作らず、候補リストも変わったところの周りの都市の分しか作らないので、都市数が多くても速い
+// 変更がおかしければエラーの理由を返す (成功なら NULL)
+const char *reoptimize(Workspace *ws, const City *city, int n, const int *tour, const Edit *edit, int m,
+                       City **new_city, int *new_n, double *length)
+{
+  enum { KEEP, DELETED, MOVED };
+  int ins = 0;
+  for (int e = 0; e < m; e++) ins += (edit[e].op == EDIT_INSERT);
+  if (n < 0 || ins > TSPD_MAX_CITIES - n) return "too large";
+  ws_reserve(ws, n + ins);
+
+  // 前の巡回路が順列になっているか
+  char *mark = ws->mark;
+  memset(mark, 0, n);
+  for (int i = 0; i < n; i++) {
+    if (tour[i] < 0 || tour[i] >= n || mark[tour[i]]) return "tour is not a permutation";
+    mark[tour[i]] = 1;
+  }
+  // 1つの都市への変更は1回まで (動かした都市を消すと、動かす先の番号がなくなる)
+  memset(mark, KEEP, n);
+  for (int e = 0; e < m; e++) {
+    if (edit[e].op == EDIT_INSERT) continue;
+    if ((edit[e].op != EDIT_DELETE && edit[e].op != EDIT_MOVE) || edit[e].id < 0 || edit[e].id >= n ||
+        mark[edit[e].id] != KEEP)
+      return "bad edit";
+    mark[edit[e].id] = (edit[e].op == EDIT_DELETE) ? DELETED : MOVED;
+  }
+
+  // 新しい番号 (newid には parent を借りる) と座標
+  int *newid = ws->parent;
+  int nn = 0;
+  for (int i = 0; i < n; i++) newid[i] = (mark[i] == DELETED) ? -1 : nn++;
+  if (nn + ins < 1) return "no cities";
+  City *nc = (City*)malloc(sizeof(City) * (size_t)(nn + ins));
+  for (int i = 0; i < n; i++)
+    if (newid[i] >= 0) nc[newid[i]] = city[i];
+  for (int e = 0, a = nn; e < m; e++) {
+    if (edit[e].op == EDIT_MOVE) nc[newid[edit[e].id]] = (City){.x = edit[e].x, .y = edit[e].y};
+    if (edit[e].op == EDIT_INSERT) nc[a++] = (City){.x = edit[e].x, .y = edit[e].y};
+  }
+  *new_city = nc;
+  *new_n = nn + ins;
+  ws->n = nn + ins;
+  ws->city = nc;
+  ws->use_table = 0;
+  if (ws->n > 3) ws_grid(ws);
+
+  // 残した都市を前の巡回路の順に双方向リストでつなぐ (next は adj[2c], prev は adj[2c+1])
+  // 抜いた都市の両隣は新しい辺でつながるので、局所探索の待ち行列に入れる
+  int *adj = ws->adj;
+  int tail = 0, len = 0;
+  memset(ws->in_queue, 0, ws->n);
+  memset(ws->in_tour, 0, ws->n);
+  int i0 = 0;
+  while (i0 < n && mark[tour[i0]] != KEEP) i0++;
+  int first = -1, last = -1, gap = 0;
+  for (int k = 0; k < n && i0 < n; k++) {
+    const int o = tour[(i0 + k) % n];
+    if (mark[o] != KEEP) {
+      gap = 1;
+      continue;
+    }
+    const int c = newid[o];
+    if (first < 0) first = c;
+    else {
+      adj[2*last] = c;
+      adj[2*c+1] = last;
+    }
+    if (gap) {
+      push_city(ws, &tail, &len, last);
+      push_city(ws, &tail, &len, c);
+      gap = 0;
+    }
+    ws->in_tour[c] = 1;
+    last = c;
+  }
+  if (first >= 0) {
+    adj[2*last] = first;
+    adj[2*first+1] = last;
+    if (gap) {
+      push_city(ws, &tail, &len, last);
+      push_city(ws, &tail, &len, first);
+    }
+  }
+
+  // 動かした都市と追加した都市を、候補リストの都市の前後の辺のうち一番短くなるところへ挿入する
+  // 候補がまだ1つも巡回路にないときは、全部の辺を調べる
+  for (int c = 0; c < ws->n; c++) {
+    if (ws->in_tour[c]) continue;
+    if (first < 0) {
+      first = c;
+      adj[2*c] = adj[2*c+1] = c;
+    } else {
+      int ba = -1;
+      double best = 1e300;
+      const int *cd = (ws->n > 3) ? cand_of(ws, c) : NULL;
+      for (int t = 0; cd && t < 2 * ws->k; t++) {
+        const int y = cd[t / 2];
+        if (!ws->in_tour[y]) continue;
+        const int a = (t % 2) ? adj[2*y+1] : y; // 辺 (y, next(y)) か (prev(y), y)
+        const double dlt = wd(ws, a, c) + wd(ws, c, adj[2*a]) - wd(ws, a, adj[2*a]);
+        if (dlt < best) {
+          best = dlt;
+          ba = a;
+        }
+      }
+      for (int a = 0; ba < 0 && a < ws->n; a++) {
+        if (!ws->in_tour[a]) continue;
+        const double dlt = wd(ws, a, c) + wd(ws, c, adj[2*a]) - wd(ws, a, adj[2*a]);
+        if (dlt < best) best = dlt, ba = a;
+      }
+      const int b = adj[2*ba];
+      adj[2*ba] = c;
+      adj[2*c+1] = ba;
+      adj[2*c] = b;
+      adj[2*b+1] = c;
+      push_city(ws, &tail, &len, ba);
+      push_city(ws, &tail, &len, b);
+    }
+    ws->in_tour[c] = 1;
+    push_city(ws, &tail, &len, c);
+  }
+
+  // 配列の巡回路にしてから、変わったところの周りだけ局所探索する
+  for (int i = 0, x = first; i < ws->n; i++, x = adj[2*x]) {
+    ws->route[i] = x;
+    ws->pos[x] = i;
+  }
+  if (ws->n > 3) ws_local_search(ws, tail, len);
+  *length = ws_finish(ws);
+  return NULL;
+}
+
+// fd へ len バイトすべて書く (相手が閉じていたら -1)
+int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = (const char*)buf;
+  while (len > 0) {
+    const ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return -1;
+    p += w;
+    len -= (size_t)w;
+  }
+  return 0;
+}
+
+// fd から len バイトちょうど読む (途中で閉じられたら -1)
+int read_all(int fd, void *buf, size_t len)
+{
+  char *p = (char*)buf;
+  while (len > 0) {
+    const ssize_t r = read(fd, p, len);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return -1;
+    p += r;
+    len -= (size_t)r;
+  }
+  return 0;
+}
+
+void conn_release(Conn *conn)
+{
+  if (atomic_fetch_sub(&conn->refs, 1) == 1) {
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->wmu);
+    free(conn);
+  }
+}
+
+// 返信を ws->out に組み立てて送る。status が ST_OK でなければ巡回路は付けない
+void send_reply(Workspace *ws, const Job *job, int status, const char *err, int n, double length)
+{
+  if (status != ST_OK) n = 0;
+  // JSON は1都市あたり最大 11 文字 (uint32 の10桁とカンマ)
+  const size_t need = (job->flags & REPLY_JSON) ? 128 + (size_t)n * 11 + strlen(err ? err : "")
+                                                : sizeof(ReplyHeader) + sizeof(uint32_t) * (size_t)n;
+  if (need > ws->out_cap) {
+    ws->out_cap = (need > 2 * ws->out_cap) ? need : 2 * ws->out_cap;
+    ws->out = (char*)realloc(ws->out, ws->out_cap);
+  }
+  size_t len = 0;
+  if (job->flags & REPLY_JSON) {
+    if (status != ST_OK) {
+      len = sprintf(ws->out, "{\"id\":%u,\"status\":%d,\"error\":\"%s\"}\n", job->id, status, err);
+    } else {
+      len = sprintf(ws->out, "{\"id\":%u,\"status\":0,\"length\":%.6f,\"tour\":[", job->id, length);
+      for (int i = 0; i < n; i++) len += sprintf(ws->out + len, (i == 0) ? "%d" : ",%d", ws->route[i]);
+      len += sprintf(ws->out + len, "]}\n");
+    }
+  } else {
+    const ReplyHeader h = {.magic = REPLY_MAGIC, .id = job->id, .status = status, .n = (uint32_t)n, .length = length};
+    memcpy(ws->out, &h, sizeof(h));
+    for (int i = 0; i < n; i++) {
+      const uint32_t c = (uint32_t)ws->route[i];
+      memcpy(ws->out + sizeof(h) + sizeof(uint32_t) * i, &c, sizeof(c));
+    }
+    len = need;
+  }
+  pthread_mutex_lock(&job->conn->wmu);
+  write_all(job->conn->fd, ws->out, len); // 相手が先に閉じていたら捨てる
+  pthread_mutex_unlock(&job->conn->wmu);
+}
+
+void queue_init(JobQueue *q, int cap)
+{
+  *q = (JobQueue){.buf = (Job**)malloc(sizeof(Job*) * cap), .cap = cap};
+  pthread_mutex_init(&q->mu, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+}
+
+// いっぱいなら空くまで待つ (要求を読むのも止まるので、送り手も待たされる)
+void queue_push(JobQueue *q, Job *job)
+{
+  pthread_mutex_lock(&q->mu);
+  while (q->len == q->cap) pthread_cond_wait(&q->not_full, &q->mu);
+  q->buf[(q->head + q->len) % q->cap] = job;
+  q->len++;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->mu);
+}
+
+// 空なら待つ。止めるときは NULL
+Job *queue_pop(JobQueue *q)
+{
+  pthread_mutex_lock(&q->mu);
+  while (q->len == 0 && !q->stop) pthread_cond_wait(&q->not_empty, &q->mu);
+  Job *job = NULL;
+  if (q->len > 0) {
+    job = q->buf[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->len--;
+    pthread_cond_signal(&q->not_full);
+  }
+  pthread_mutex_unlock(&q->mu);
+  return job;
+}
+
+void *worker(void *arg)
+{
+  JobQueue *q = (JobQueue*)arg;
+  Workspace ws = {.cap = 0};
+  Job *job;
+  while ((job = queue_pop(q)) != NULL) {
+    City *city = job->city;
+    int n = job->n;
+    const char *err = NULL;
+    int status = ST_OK;
+    if (job->kind == REQ_PATH && (err = read_city_file(job->path, &city, &n)) != NULL) status = ST_LOAD_FAILED;
+    else if (n < 1) {
+      err = "no cities";
+      status = ST_BAD_REQUEST;
+    }
+    double length = 0;
+    if (status == ST_OK && job->kind == REQ_DELTA) {
+      // 返す巡回路は変更後の番号
+      if ((err = reoptimize(&ws, job->city, job->n, job->tour, job->edit, job->m, &city, &n, &length)) != NULL)
+        status = ST_BAD_REQUEST;
+    } else if (status == ST_OK) {
+      length = solve_job(&ws, city, n);
+    }
+    send_reply(&ws, job, status, err, n, length);
+
+    if (city != job->city) free(city);
+    free(job->city);
+    free(job->path);
+    free(job->tour);
+    free(job->edit);
+    conn_release(job->conn);
+    free(job);
+  }
+  ws_free(&ws);
+  return NULL;
+}
+
+typedef struct {
+  Conn *conn;
+  JobQueue *q;
+} Reader;
+
+// 接続ごとのスレッド。要求を読んでは待ち行列に入れる
+void *reader(void *arg)
+{
+  Reader *r = (Reader*)arg;
+  Conn *conn = r->conn;
+  Request req;
+  while (read_all(conn->fd, &req, sizeof(req)) == 0) {
+    Job *job = (Job*)calloc(1, sizeof(Job));
+    *job = (Job){.conn = conn, .id = req.id, .kind = req.kind, .flags = req.flags};
+    // 形式の合わない要求は返信してから接続を切る (続きの区切りがわからないので)
+    const char *err = NULL;
+    int status = ST_OK;
+    if (req.magic != REQ_MAGIC || (req.kind != REQ_INLINE && req.kind != REQ_PATH && req.kind != REQ_DELTA)) {
+      err = "bad request";
+      status = ST_BAD_REQUEST;
+    } else if ((req.kind != REQ_PATH && req.len > TSPD_MAX_CITIES) || (req.kind == REQ_PATH && req.len > 4096)) {
+      err = "too large";
+      status = ST_TOO_LARGE;
+    } else if (req.kind == REQ_INLINE) {
+      job->n = (int)req.len;
+      job->city = (City*)malloc(sizeof(City) * max(job->n, 1));
+      if (read_all(conn->fd, job->city, sizeof(City) * job->n) != 0) status = -1;
+    } else if (req.kind == REQ_DELTA) {
+      job->n = (int)req.len;
+      job->city = (City*)malloc(sizeof(City) * max(job->n, 1));
+      job->tour = (int*)malloc(sizeof(int) * max(job->n, 1));
+      uint32_t m;
+      if (read_all(conn->fd, job->city, sizeof(City) * job->n) != 0 ||
+          read_all(conn->fd, job->tour, sizeof(int) * job->n) != 0 || read_all(conn->fd, &m, sizeof(m)) != 0) {
+        status = -1;
+      } else if (m > TSPD_MAX_CITIES) {
+        err = "too large";
+        status = ST_TOO_LARGE;
+      } else {
+        job->m = (int)m;
+        job->edit = (Edit*)malloc(sizeof(Edit) * max(job->m, 1));
+        if (read_all(conn->fd, job->edit, sizeof(Edit) * job->m) != 0) status = -1;
+      }
+    } else {
+      job->path = (char*)calloc(req.len + 1, 1);
+      if (read_all(conn->fd, job->path, req.len) != 0) status = -1;
+    }
+    if (status != ST_OK) {
+      if (status > 0) {
+        Workspace ws = {.cap = 0};
+        send_reply(&ws, job, status, err, 0, 0);
+        ws_free(&ws);
+      }
+      free(job->city);
+      free(job->path);
+      free(job->tour);
+      free(job->edit);
+      free(job);
+      break;
+    }
+    atomic_fetch_add(&conn->refs, 1);
+    queue_push(r->q, job);
+  }
+  conn_release(conn);
+  free(r);
+  return NULL;
+}
+
+// 巡回路のテキストから都市番号を順に読む (数字以外は区切りとして読み飛ばす)
+// 最後が先頭と同じ都市なら (巡回路を閉じるために書いたもの) 落とす
+int *read_tour_file(const char *path, int *len)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp) return NULL;
+  int cap = 1024, n = 0;
+  int *tour = (int*)malloc(sizeof(int) * cap);
+  int ch, v = -1;
+  while ((ch = fgetc(fp)) != EOF || v >= 0) {
+    if (ch >= '0' && ch <= '9') {
+      v = ((v < 0) ? 0 : v * 10) + (ch - '0');
+      continue;
+    }
+    if (v >= 0) {
+      if (n == cap) tour = (int*)realloc(tour, sizeof(int) * (cap *= 2));
+      tour[n++] = v;
+      v = -1;
+    }
+    if (ch == EOF) break;
+  }
+  fclose(fp);
+  if (n > 1 && tour[n-1] == tour[0]) n--;
+  *len = n;
+  return tour;
+}
+
+// 変更のファイルを読む。1行に1つ "insert x y" / "delete id" / "move id x y" (# から後は読み飛ばす)
+Edit *read_edit_file(const char *path, int *len)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp) return NULL;
+  int cap = 64, m = 0;
+  Edit *edit = (Edit*)malloc(sizeof(Edit) * cap);
+  char line[256], op[16];
+  for (int lineno = 1; fgets(line, sizeof(line), fp); lineno++) {
+    char *hash = strchr(line, '#');
+    if (hash) *hash = 0;
+    Edit e = {.op = -1};
+    int a = 0, b = 0, c = 0;
+    const int got = sscanf(line, "%15s %d %d %d", op, &a, &b, &c);
+    if (got <= 0) continue;
+    if (strcmp(op, "insert") == 0 && got == 3) e = (Edit){.op = EDIT_INSERT, .x = a, .y = b};
+    else if (strcmp(op, "delete") == 0 && got == 2) e = (Edit){.op = EDIT_DELETE, .id = a};
+    else if (strcmp(op, "move") == 0 && got == 4) e = (Edit){.op = EDIT_MOVE, .id = a, .x = b, .y = c};
+    if (e.op < 0) {
+      fprintf(stderr, "%s:%d: bad edit.\n", path, lineno);
+      free(edit);
+      fclose(fp);
+      return NULL;
+    }
+    if (m == cap) edit = (Edit*)realloc(edit, sizeof(Edit) * (cap *= 2));
+    edit[m++] = e;
+  }
+  fclose(fp);
+  *len = m;
+  return edit;
+}
+
+// tspd -d: デーモンにせず、1回だけ変更を当てて結果を表示する
+int run_delta(const char *city_path, const char *tour_path, const char *edit_path, const char *out_path)
+{
+  City *city;
+  int n, tn, m;
+  const char *err = read_city_file(city_path, &city, &n);
+  if (err) {
+    fprintf(stderr, "%s: %s\n", city_path, err);
+    return 1;
+  }
+  int *tour = read_tour_file(tour_path, &tn);
+  if (!tour) {
+    perror(tour_path);
+    return 1;
+  }
+  if (tn != n) {
+    fprintf(stderr, "%s: %d cities in the tour, %d in %s.\n", tour_path, tn, n, city_path);
+    return 1;
+  }
+  errno = 0;
+  Edit *edit = read_edit_file(edit_path, &m);
+  if (!edit) {
+    if (errno) perror(edit_path);
+    return 1;
+  }
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  Workspace ws = {.cap = 0};
+  City *new_city = NULL;
+  int new_n;
+  double length;
+  if ((err = reoptimize(&ws, city, n, tour, edit, m, &new_city, &new_n, &length)) != NULL) {
+    fprintf(stderr, "%s: %s\n", edit_path, err);
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  fprintf(stderr, "reoptimized %d -> %d cities in %.3f ms\n", n, new_n,
+          (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+  printf("total distance = %f\n", length);
+  for (int i = 0; i < new_n; i++) printf("%d -> ", ws.route[i]);
+  printf("%d\n", ws.route[0]);
+
+  if (out_path) {
+    // gencity と同じ v1 形式
+    FILE *fp = fopen(out_path, "wb");
+    if (!fp || fwrite(&new_n, sizeof(int), 1, fp) != 1 || fwrite(new_city, sizeof(City), new_n, fp) != (size_t)new_n ||
+        fclose(fp) != 0) {
+      perror(out_path);
+      return 1;
+    }
+  }
+  ws_free(&ws);
+  free(new_city);
+  free(city);
+  free(tour);
+  free(edit);
+  return 0;
+}
+
+static volatile sig_atomic_t stop_flag = 0;
+static sigset_t stop_signals;
+
+void on_signal(int sig)
+{
+  (void)sig;
+  stop_flag = 1;
+}
+
+// シグナルは accept しているメインスレッドだけが受け取るように、ほかのスレッドでは止めておく
+void spawn(pthread_t *th, void *(*fn)(void*), void *arg)
+{
+  sigset_t old;
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &old);
+  pthread_create(th, NULL, fn, arg);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = TSPD_SOCKET;
+  int nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int qcap = TSPD_QUEUE;
+  const char *out_path = NULL;
+  int delta = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:j:q:do:")) != -1) {
+    if (opt == 's') path = optarg;
+    else if (opt == 'j') nworkers = atoi(optarg);
+    else if (opt == 'q') qcap = atoi(optarg);
+    else if (opt == 'd') delta = 1;
+    else if (opt == 'o') out_path = optarg;
+    else optind = argc + 1;
+  }
+  if (optind > argc || (delta && argc - optind != 3) || (!delta && optind != argc)) {
+    fprintf(stderr, "Usage: %s [-s socket] [-j workers] [-q queue]\n"
+                    "       %s -d <city file> <tour file> <edit file> [-o new city file]\n", argv[0], argv[0]);
+    exit(1);
+  }
+  if (delta) return run_delta(argv[optind], argv[optind+1], argv[optind+2], out_path);
+  if (nworkers < 1) nworkers = 1;
+  if (qcap < 1) qcap = 1;
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: socket path is too long.\n", path);
+    exit(1);
+  }
+  strcpy(addr.sun_path, path);
+  const int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+    perror(path);
+    exit(1);
+  }
+
+  // SIGINT / SIGTERM で accept を抜けて後片付けする (SA_RESTART を付けない)
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+
+  JobQueue q;
+  queue_init(&q, qcap);
+  pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nworkers);
+  for (int t = 0; t < nworkers; t++) spawn(&th[t], worker, &q);
+  fprintf(stderr, "tspd: listening on %s (%d workers)\n", path, nworkers);
+
+  while (!stop_flag) {
+    const int fd = accept(lfd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      perror("accept");
+      break;
+    }
+    Conn *conn = (Conn*)malloc(sizeof(Conn));
+    conn->fd = fd;
+    atomic_init(&conn->refs, 1);
+    pthread_mutex_init(&conn->wmu, NULL);
+    Reader *r = (Reader*)malloc(sizeof(Reader));
+    *r = (Reader){.conn = conn, .q = &q};
+    pthread_t rt;
+    spawn(&rt, reader, r);
+    pthread_detach(rt);
+  }
+
+  // 受け付けをやめ、待ち行列に残っている分を解き終えてから終わる
+  close(lfd);
+  unlink(path);
+  pthread_mutex_lock(&q.mu);
+  q.stop = 1;
+  pthread_cond_broadcast(&q.not_empty);
+  pthread_mutex_unlock(&q.mu);
+  for (int t = 0; t < nworkers; t++) pthread_join(th[t], NULL);
+  free(th);
+  free(q.buf);
+  return 0;
+}